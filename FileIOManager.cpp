@@ -1,5 +1,9 @@
 #include "FileIOManager.hpp"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 UncompressedFile::UncompressedFile(void) { return; }
 
 bool UncompressedFile::good(void) { return !(feof(f) || ferror(f)); }
@@ -56,6 +60,13 @@ std::string UncompressedFile::getline(void)
 
 }
 
+size_t UncompressedFile::read(char* out, size_t n)
+{
+    size_t got = fread(out, 1, n, f);
+    if (got < n && ferror(f)) { throw std::runtime_error("Error reading file: " + filename); }
+    return got;
+}
+
 #ifdef HAVE_ZLIB
 GZFile::GZFile(void) { return; }
 GZFile::GZFile(const std::string filename)
@@ -102,10 +113,117 @@ std::string GZFile::getline(void)
 
 }
 
+size_t GZFile::read(char* out, size_t n)
+{
+    size_t got = 0;
+    while (got < n) {
+        int r = gzread(gzf, out + got, std::min(n - got, (size_t)1 << 30));
+        if (r < 0) { throw std::runtime_error("Error reading file: " + filename); }
+        if (r == 0) { break; }
+        got += r;
+    }
+    return got;
+}
+
 
 
 #endif
 
+LineReader::LineReader(FileObject* f)
+    : source(f), source_eof(false), mapped(NULL), mapped_size(0),
+      buf_size(0), buf_len(0), pos(0), scanned(0) {}
+
+LineReader::LineReader(const std::string& filename)
+    : source(NULL), source_eof(false), mapped(NULL), mapped_size(0),
+      buf_size(0), buf_len(0), pos(0), scanned(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) { throw std::invalid_argument("Couldn't open file: " + filename); }
+
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            mapped = static_cast<const char*>(p);
+            mapped_size = st.st_size;
+        }
+    }
+    close(fd);
+
+    // Pipes and the like get read instead
+    if (!mapped) {
+        owned.reset(new UncompressedFile(filename));
+        source = owned.get();
+    }
+}
+
+LineReader::~LineReader(void)
+{
+    if (mapped) { munmap(const_cast<char*>(mapped), mapped_size); }
+}
+
+bool LineReader::getline(stringops::StringSpan& line)
+{
+    if (mapped) {
+        if (pos >= mapped_size) { return false; }
+        const char* start = mapped + pos;
+        const char* nl = static_cast<const char*>(memchr(start, '\n', mapped_size - pos));
+        size_t len = nl ? nl - start : mapped_size - pos;
+        line = stringops::StringSpan(start, len);
+        pos += len + 1;
+        return true;
+    }
+
+    while (true) {
+        const char* start = buf.get() + pos;
+        const char* nl = NULL;
+        if (scanned < buf_len) {
+            nl = static_cast<const char*>(memchr(buf.get() + scanned, '\n', buf_len - scanned));
+        }
+        if (nl) {
+            line = stringops::StringSpan(start, nl - start);
+            pos = scanned = nl - buf.get() + 1;
+            return true;
+        }
+        scanned = buf_len;
+
+        if (source_eof) {
+            if (pos == buf_len) { return false; }
+            // A last line with no newline
+            line = stringops::StringSpan(start, buf_len - pos);
+            pos = buf_len;
+            return true;
+        }
+        fill();
+    }
+}
+
+// Moves the partial line at pos to the front of the buffer and reads
+// another block after it, growing the buffer if a line won't fit
+void LineReader::fill(void)
+{
+    if (pos) {
+        memmove(buf.get(), buf.get() + pos, buf_len - pos);
+        buf_len -= pos;
+        scanned -= pos;
+        pos = 0;
+    }
+
+    if (buf_size - buf_len < BLOCK_SIZE) {
+        size_t newsize = std::max(2 * buf_size, buf_len + BLOCK_SIZE);
+        std::unique_ptr<char[]> bigger(new char[newsize]);
+        if (buf_len) { memcpy(bigger.get(), buf.get(), buf_len); }
+        buf.swap(bigger);
+        buf_size = newsize;
+    }
+
+    size_t want = buf_size - buf_len;
+    size_t got = source->read(buf.get() + buf_len, want);
+    buf_len += got;
+    if (got < want) { source_eof = true; }
+}
+
 DelimitedFileWriter::DelimitedFileWriter(const std::string& fn, char delimiter)
 {
     openfile(fn, true);
@@ -139,6 +257,11 @@ void DelimitedFileWriter::writeline(const std::string& line) {
     write("\n");
 }
 
+void DelimitedFileWriter::writeblock(const std::string& text) {
+    size_t res = fwrite(text.data(), 1, text.size(), f);
+    if (res != text.size()) { throw std::runtime_error("Couldn't write to file"); }
+}
+
 Logstream::Logstream(const std::string& fn) {
     logfile = std::ofstream(fn);
 }
\ No newline at end of file
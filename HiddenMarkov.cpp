@@ -1,24 +1,46 @@
+#include <algorithm>
+#include <stdexcept>
+
 #include "HiddenMarkov.hpp"
 
 
-GenotypeHMM::GenotypeHMM(const std::vector<int>& obs,
-                         const std::vector<Matrix*>& emissions,
-                         const Linalg::Matrix& transition)
+GenotypeHMM::GenotypeHMM(const int* obs,
+                         const uint32_t* codes,
+                         size_t n,
+                         const double* emission_table,
+                         size_t nsyms,
+                         const Linalg::Matrix& transition,
+                         const double* log_emission_table)
+    : nstates(transition.nrow), nsymbols(nsyms), nobs(n),
+      observations(obs), emission_codes(codes),
+      emissions(emission_table), log_emissions(log_emission_table),
+      transition_matrix(transition)
 {
-    observations = obs;
-    nstates = transition.nrow;
-    emission_matrices = emissions;
-    transition_matrix = transition;
+}
 
+GenotypeHMM::GenotypeHMM(const std::vector<int>& obs,
+                         const std::vector<uint32_t>& codes,
+                         const double* emission_table,
+                         size_t nsyms,
+                         const Linalg::Matrix& transition,
+                         const double* log_emission_table)
+    : GenotypeHMM(obs.data(), codes.data(), obs.size(), emission_table, nsyms,
+                  transition, log_emission_table)
+{
 }
 
 
 
 std::vector<int> GenotypeHMM::forwards_backwards(void) const
 {
-    size_t nobs = observations.size();
-    size_t nemiss = emission_matrices[0]->nrow;
-    size_t nstate = emission_matrices[0]->ncol;
+    // The unphased IBD model always has two states
+    if (nstates == 2) { return forwards_backwards_fixed<2>(); }
+    return forwards_backwards_generic();
+}
+
+std::vector<int> GenotypeHMM::forwards_backwards_generic(void) const
+{
+    size_t nstate = nstates;
 
     std::vector<int> outp(nobs);
 
@@ -34,9 +56,7 @@ std::vector<int> GenotypeHMM::forwards_backwards(void) const
     fwmat.set_column(0, fw);
     for (size_t obsidx = 1; obsidx < (nobs+1); ++obsidx) {
         int obs = observations[obsidx-1];
-        const Matrix& cur_obs_probs = *(emission_matrices[obsidx-1]);
-
-        auto d = cur_obs_probs.row_view(obs);
+        Linalg::VectorView d(const_cast<double*>(emission_row(obsidx - 1, obs)), nstate, 1);
 
         vector_matrix_product(fw, transition_matrix, &v);
         dmatrix_vector_product(d, v, &col);
@@ -55,9 +75,8 @@ std::vector<int> GenotypeHMM::forwards_backwards(void) const
     for (int obsidx=nobs; obsidx>0; obsidx--) 
     {
 
-        const Matrix& cur_obs_probs = *(emission_matrices[obsidx-1]);
-
-        auto d = cur_obs_probs.row_view(observations[obsidx - 1]);
+        int obs = observations[obsidx-1];
+        Linalg::VectorView d(const_cast<double*>(emission_row(obsidx - 1, obs)), nstate, 1);
         
         Linalg::dmatrix_vector_product(d, bw, &v);
         Linalg::matrix_vector_product(transition_matrix, v, &col);
@@ -88,49 +107,166 @@ std::vector<int> GenotypeHMM::forwards_backwards(void) const
 
 
 
-std::vector<int> GenotypeHMM::viterbi(void) const
+// One forward step: cur[j] = d[j] * (sum or max over i of trans(i, j) * prev[i]),
+// normalized
+static inline void forward_step(const Matrix& trans, size_t ns, bool max_product,
+                                const double* prev, const double* d, double* cur)
 {
-    using std::log;
-    int nobs = observations.size();
+    double total = 0.0;
+    for (size_t j = 0; j < ns; ++j) {
+        double v = 0.0;
+        for (size_t i = 0; i < ns; ++i) {
+            double p = trans.get(i, j) * prev[i];
+            v = max_product ? std::max(v, p) : v + p;
+        }
+        cur[j] = d[j] * v;
+        total += cur[j];
+    }
+    for (size_t j = 0; j < ns; ++j) { cur[j] /= total; }
+}
+
+// One backward step: prev[i] = sum or max over j of trans(i, j) * d[j] * next[j],
+// normalized
+static inline void backward_step(const Matrix& trans, size_t ns, bool max_product,
+                                 const double* next, const double* d, double* prev)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < ns; ++i) {
+        double v = 0.0;
+        for (size_t j = 0; j < ns; ++j) {
+            double p = trans.get(i, j) * d[j] * next[j];
+            v = max_product ? std::max(v, p) : v + p;
+        }
+        prev[i] = v;
+        total += v;
+    }
+    for (size_t i = 0; i < ns; ++i) { prev[i] /= total; }
+}
 
-    Linalg::Vector log_probs(nstates);
+void GenotypeHMM::messages(bool max_product, std::vector<double>& fw, std::vector<double>& bw) const
+{
+    size_t ns = nstates;
+    fw.resize(nobs * ns);
+    bw.resize(nobs * ns);
+    if (!nobs) { return; }
+
+    std::vector<double> start(ns, 1.0 / ns);
+    const double* prev = start.data();
+    for (size_t obsidx = 0; obsidx < nobs; ++obsidx) {
+        double* cur = &fw[obsidx * ns];
+        forward_step(transition_matrix, ns, max_product, prev,
+                     emission_row(obsidx, observations[obsidx]), cur);
+        prev = cur;
+    }
 
-    Linalg::Vector starts(nstates);
-    for (size_t i = 0; i < starts.size; ++i) { starts.set(i, i); }
+    std::fill(bw.end() - ns, bw.end(), 1.0);
+    for (size_t obsidx = nobs - 1; obsidx > 0; --obsidx) {
+        backward_step(transition_matrix, ns, max_product, &bw[obsidx * ns],
+                      emission_row(obsidx, observations[obsidx]), &bw[(obsidx - 1) * ns]);
+    }
+}
 
+std::vector<int> GenotypeHMM::decode_window(bool max_product, const double* entry, const double* exit) const
+{
+    size_t ns = nstates;
     std::vector<int> outp(nobs);
+    if (!nobs) { return outp; }
+
+    std::vector<double> fw(nobs * ns);
+    std::vector<double> start(ns, 1.0 / ns);
+    const double* prev = entry ? entry : start.data();
+    for (size_t obsidx = 0; obsidx < nobs; ++obsidx) {
+        double* cur = &fw[obsidx * ns];
+        forward_step(transition_matrix, ns, max_product, prev,
+                     emission_row(obsidx, observations[obsidx]), cur);
+        prev = cur;
+    }
 
-    Matrix ln_transition_matrix = transition_matrix.apply(&log);
+    // Backwards, deciding each observation once its backward message is
+    // known. Ties go to the lowest numbered state.
+    std::vector<double> bw(ns, 1.0), next(ns);
+    if (exit) { bw.assign(exit, exit + ns); }
+    for (size_t obsidx = nobs; obsidx-- > 0; ) {
+        const double* cur = &fw[obsidx * ns];
+        size_t best = 0;
+        for (size_t i = 1; i < ns; ++i) {
+            if (cur[i] * bw[i] > cur[best] * bw[best]) { best = i; }
+        }
+        outp[obsidx] = best;
+
+        if (!obsidx) { break; }
+        backward_step(transition_matrix, ns, max_product, bw.data(),
+                      emission_row(obsidx, observations[obsidx]), next.data());
+        bw.swap(next);
+    }
 
-    Matrix paths = Linalg::Matrix(nstates, nobs + 1);
-    paths = 0; // set all to zero;
-    paths.set_column(0, starts);
+    return outp;
+}
 
-    for (int obsidx = 0; obsidx < nobs; ++obsidx) {
-        auto obs = observations[obsidx];
+std::vector<int> GenotypeHMM::viterbi(void) const
+{
+    using std::log;
+    size_t ns = nstates;
 
-        Linalg::Vector new_log_probs(nstates);
-        for (int state = 0; state < nstates; ++state) {
-            Linalg::Vector temp_prob(nstates);
+    if (ns > 256) {
+        throw std::invalid_argument("Viterbi backpointers are limited to 256 states");
+    }
 
-            temp_prob = (log_probs +
-                         log(emission_matrices[obsidx]->get(obs, state)) +
-                         ln_transition_matrix.col_view(state));
+    std::vector<int> outp(nobs);
+    if (!nobs) { return outp; }
+
+    // Scratch space is kept per thread so repeated calls don't allocate.
+    // back[obsidx * ns + state] is the best predecessor of state at obsidx.
+    static thread_local std::vector<uint8_t> back;
+    static thread_local std::vector<double> scratch;
+    back.resize(nobs * ns);
+    scratch.resize(ns * ns + 2 * ns);
+
+    double* ln_trans = scratch.data();
+    double* scores = ln_trans + ns * ns;
+    double* next_scores = scores + ns;
+
+    for (size_t i = 0; i < ns; ++i) {
+        for (size_t j = 0; j < ns; ++j) {
+            ln_trans[i * ns + j] = log(transition_matrix.get(i, j));
+        }
+        scores[i] = 0.0;
+    }
 
-            auto best = temp_prob.argmax();
-            auto best_path = paths.row_view(best);
-            paths.set_row(state, best_path);
-            paths.set(state, obsidx + 1, state);
-            new_log_probs.data[state] = temp_prob.get(best);
+    bool have_logs = log_emissions != NULL;
+
+    for (size_t obsidx = 0; obsidx < nobs; ++obsidx) {
+        int obs = observations[obsidx];
+        uint8_t* bp = &back[obsidx * ns];
+
+        for (size_t state = 0; state < ns; ++state) {
+            // Ties go to the lowest numbered state
+            size_t best = 0;
+            double best_score = scores[0] + ln_trans[state];
+            for (size_t prev = 1; prev < ns; ++prev) {
+                double v = scores[prev] + ln_trans[prev * ns + state];
+                if (v > best_score) {
+                    best = prev;
+                    best_score = v;
+                }
+            }
+
+            double ln_emit = have_logs ? log_emission_row(obsidx, obs)[state] :
+                                         log(emission_row(obsidx, obs)[state]);
+            next_scores[state] = best_score + ln_emit;
+            bp[state] = best;
         }
-        log_probs = new_log_probs;
+        std::swap(scores, next_scores);
+    }
 
+    size_t state = 0;
+    for (size_t i = 1; i < ns; ++i) {
+        if (scores[i] > scores[state]) { state = i; }
     }
 
-    int best_final_state = log_probs.argmax();
-    Linalg::Vector hidden_states = paths.get_row(best_final_state);
-    for (size_t i = 1; i < hidden_states.size; ++i) {
-        outp[i-1] = (int)hidden_states.get(i);
+    for (size_t obsidx = nobs; obsidx-- > 0; ) {
+        outp[obsidx] = state;
+        state = back[obsidx * ns + state];
     }
     return outp;
 }
@@ -1,5 +1,10 @@
 #include "adios.hpp"
 #include <assert.h>
+#include <chrono>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
 namespace adios
 {
 
@@ -83,6 +88,47 @@ adios_parameters params_from_args(std::map<std::string, std::vector<std::string>
 
     params.viterbi = (args["viterbi"][0].compare("YES") == 0);
     params.finemap_ends = (args["fine_ends"][0].compare("YES") == 0);
+    params.packed = (args.count("packed") && args["packed"][0].compare("YES") == 0);
+
+    // Megabytes of buffered output allowed before workers wait on the writer
+    params.output_buffer = 256UL << 20;
+    if (args.count("output_buffer")) {
+        params.output_buffer = stod(args["output_buffer"][0]) * (1 << 20);
+    }
+
+    params.binary_output = (args.count("binary") && args["binary"][0].compare("YES") == 0);
+
+    params.schedule = SCHEDULE_CHROMOSOME;
+    if (args.count("schedule")) {
+        const std::string& sched = args["schedule"][0];
+        if (sched == "global") {
+            params.schedule = SCHEDULE_GLOBAL;
+        } else if (sched == "steal") {
+            params.schedule = SCHEDULE_STEAL;
+        } else if (sched != "chromosome") {
+            throw std::invalid_argument("Unknown schedule: " + sched);
+        }
+    }
+
+    params.prefilter = (args.count("prefilter") && args["prefilter"][0].compare("YES") == 0);
+    params.prefilter_window = 0;
+    if (args.count("prefilter_window")) {
+        params.prefilter_window = stod(args["prefilter_window"][0]) * 1e6;
+    }
+    params.carrier_memory = 1024UL << 20;
+    if (args.count("carrier_memory")) {
+        params.carrier_memory = stod(args["carrier_memory"][0]) * (1 << 20);
+    }
+
+    params.engine = ENGINE_PAIR;
+    if (args.count("engine")) {
+        const std::string& engine = args["engine"][0];
+        if (engine == "batch") {
+            params.engine = ENGINE_BATCH;
+        } else if (engine != "pair") {
+            throw std::invalid_argument("Unknown engine: " + engine);
+        }
+    }
 
     return params;
 
@@ -99,21 +145,34 @@ void adios_parameters::get_rare_sites(Dataset& data)
             }
         }
         rare_sites.push_back(rares);
+        rare_masks.push_back(bitpack::pack(rares, chrom->nmark()));
+    }
+}
+
+EmissionTable::EmissionTable(const std::vector<double>& levels, const Matrix& error_mat)
+{
+    probs.reserve(levels.size() * STRIDE);
+    for (double fq : levels) {
+        Matrix m = Linalg::matrix_product(error_mat, unphased_emission_matrix(fq));
+        probs.insert(probs.end(), m.data, m.data + STRIDE);
+    }
+
+    ln_probs.resize(probs.size());
+    log10_probs.resize(probs.size());
+    for (size_t i = 0; i < probs.size(); ++i) {
+        ln_probs[i] = std::log(probs[i]);
+        log10_probs[i] = std::log10(probs[i]);
     }
 }
 
 void adios_parameters::calculate_emission_mats(const Dataset& data)
 {
-    std::set<double> fqs;
+    emission_tables.clear();
     for (auto c : data.chromosomes) {
-        for (auto f : c->frequencies) {
-            fqs.insert(f);
+        if (c->freq_codes.size() != c->nmark()) {
+            throw std::logic_error("Frequencies for chromosome " + c->label + " have not been encoded");
         }
-    }
-    for (auto fq : fqs) {
-        Matrix& err = unphased_error_mat;
-        Matrix m = Linalg::matrix_product(err, unphased_emission_matrix(fq));
-        emission_mats[fq] = m;
+        emission_tables.push_back(EmissionTable(c->freq_levels, unphased_error_mat));
     }
 }
 
@@ -174,9 +233,9 @@ adios_sites find_informative_sites_unphased(const Individual& ind1,
             while (missidx < nmiss && miss[missidx]     < current_position) { missidx++; }
             while (requidx < nrequ && requests[requidx] < current_position) { requidx++; }
 
-            bool is_rare = current_position == rares[rareidx];
-            bool is_miss = (nmiss > 0 && current_position == miss[missidx]);
-            bool is_requ = (nrequ > 0 && current_position == requests[requidx]);
+            bool is_rare = (rareidx < nrare && current_position == rares[rareidx]);
+            bool is_miss = (missidx < nmiss && current_position == miss[missidx]);
+            bool is_requ = (requidx < nrequ && current_position == requests[requidx]);
 
             int s1 = (cur_vars[0] == current_position) + (cur_vars[1] == current_position);
             int s2 = (cur_vars[2] == current_position) + (cur_vars[3] == current_position);
@@ -196,162 +255,674 @@ adios_sites find_informative_sites_unphased(const Individual& ind1,
 
         } while (current_position != max_pos);
 
-        adios_sites selected = { ind1.label, ind2.label, states, informatives, chromobj };
+        adios_sites selected = { ind1.label, ind2.label, states, informatives, chromobj, chromidx };
         return selected;
 
     }
 
+adios_sites find_informative_sites_unphased_packed(const Individual& ind1,
+    const Individual& ind2,
+    const int chromidx,
+    const PackedSites& rares,
+    const std::vector<int>& requests,
+    sitekernel::Implementation impl)
+{
+    const Genotypes& g1 = ind1.chromosomes[chromidx];
+    const Genotypes& g2 = ind2.chromosomes[chromidx];
+    auto chromobj = g1.info;
+    const int nmark = chromobj->nmark();
+
+    PackedSites requ;
+    if (!requests.empty()) { requ = bitpack::pack(requests, nmark); }
+
+    sitekernel::PackedPair p = {
+        g1.packed_a.data(), g1.packed_b.data(),
+        g2.packed_a.data(), g2.packed_b.data(),
+        g1.packed_missing.data(), g2.packed_missing.data(),
+        rares.data(),
+        requ.empty() ? NULL : requ.data(),
+        bitpack::nwords(nmark)
+    };
+
+    std::vector<int> informatives;
+    std::vector<int> states;
+
+    // Same guess as the list-based version
+    const int reserve_amount = (int)(0.05 * nmark);
+    informatives.reserve(reserve_amount);
+    states.reserve(reserve_amount);
 
+    sitekernel::classify(p, informatives, states, impl);
 
-void adios(Dataset& d, const adios_parameters& params, DelimitedFileWriter& out)
+    adios_sites selected = { ind1.label, ind2.label, states, informatives, chromobj, chromidx };
+    return selected;
+}
+
+// Pick the informative site finder matching how the genotypes are stored
+static adios_sites informative_sites(const Individual& ind1,
+                                     const Individual& ind2,
+                                     int chromidx,
+                                     const adios_parameters& params,
+                                     const AlleleSites& requests=AlleleSites())
 {
-    using namespace combinatorics;
+    if (ind1.chromosomes[chromidx].packed && ind2.chromosomes[chromidx].packed) {
+        return find_informative_sites_unphased_packed(ind1, ind2, chromidx,
+                                                      params.rare_masks[chromidx],
+                                                      requests);
+    }
+    return find_informative_sites_unphased(ind1, ind2, chromidx,
+                                           params.rare_sites[chromidx],
+                                           requests);
+}
 
-    std::vector<std::string> header = {
-        "IND_1", "IND_2", "CHROM", "START", "END", "LENGTH",
-        "STATE", "NMARK", "NRARE", "NERR", "LOD"
-    };
-    out.writetoks(header);
+
+
+static inline int max_threads(void)
+{
+#ifdef HAVE_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static inline int thread_num(void)
+{
+#ifdef HAVE_OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static inline double seconds_since(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+long pair_block_size(const Dataset& d, size_t chridx)
+{
+    long ninds = d.ninds();
+    if (ninds < 2) return 1;
+
+    // Average genotype footprint of one individual on this chromosome
+    size_t bytes = 0;
+    for (const Individual& ind : d.individuals) {
+        const Genotypes& g = ind.chromosomes[chridx];
+        bytes += sizeof(int) * (g.hapa.size() + g.hapb.size() + g.missing.size());
+        bytes += sizeof(uint64_t) * (g.packed_a.size() + g.packed_b.size() + g.packed_missing.size());
+    }
+    bytes = bytes / ninds + 1;
+
+    // The row and column individuals of a tile should fit in L2 together
+    long blocksize = l2_cache_size() / (2 * bytes);
+
+    // But keep enough tiles around to spread over the threads. This
+    // deliberately doesn't depend on the thread count, since the tiling
+    // sets the output order.
+    long max_blocksize = ninds / 16 + 1;
+
+    blocksize = std::min(blocksize, max_blocksize);
+    return std::max(blocksize, 1L);
+}
+
+// The batched engine takes pairs in pools of this many, and decodes them
+// shortest first, so the sequences in a batch are about the same length
+// and little of it is padding
+static const size_t BATCH_POOL = 8 * batchhmm::LANES;
+
+// Runs adios_pair_unphased on each pair with the batched engine. results[k]
+// is for pairs[k].
+static void adios_pairs_batched(const Dataset& d,
+                                const std::vector<std::pair<long, long>>& pairs,
+                                int chromidx,
+                                const adios_parameters& params,
+                                std::vector<adios_result>& results);
+
+void adios(Dataset& d, const adios_parameters& params, DelimitedFileWriter& out,
+           ChromosomeLoads* loads)
+{
+    using namespace combinatorics;
 
     long ninds = d.ninds();
     long npairs = nCk(ninds, 2);
 
+    // Pairs are handed out in cache-sized tiles, so each individual's
+    // genotypes are reused across a whole row or column of the tile.
+    std::vector<std::vector<PairBlock>> chrom_blocks;
     for (size_t chridx = 0; chridx < d.nchrom(); chridx++) {
-        double signpost = 0.0; 
-        double signpost_step = npairs > 100000 ? 0.001 : 0.01;
-        int completed = 0;
-        unsigned long markers_used = 0;
-        unsigned long total_mark = d.chromosomes[chridx]->nmark();
-
-        // If openmp is available, this is the loop we want to parallelize.
-        // This gives each thread a set of individual pairs to compute.
-        #pragma omp parallel for
-        for (size_t pairidx = 0; pairidx < npairs; ++pairidx) {
-            std::vector<long> indices = combination_at_index(pairidx,
-                                        ninds,
-                                        2);
-
-            Individual& ind1 = d.individuals[indices[0]];
-            Individual& ind2 = d.individuals[indices[1]];
-
-            adios_result res = adios_pair_unphased(ind1, ind2, chridx, params);
-
-            #pragma omp critical
-            {
-                // File IO needs to be locked. This block is OMP critical
-                // to prevent output (both to stdout and file) from being
-                // garbled.
-                for (Segment s : res.segments) { 
-                    out.writetoks(s.record()); 
+        chrom_blocks.push_back(pair_blocks(ninds, pair_block_size(d, chridx)));
+    }
+
+    // Who carries each rare variant, for the pre-filter. The dataset's own
+    // index is used if it has one for the same threshold, otherwise one is
+    // built here. Between them they stay within carrier_memory, and
+    // chromosomes without room for an index aren't filtered.
+    std::vector<CarrierIndex> own_carriers(d.nchrom());
+    std::vector<const CarrierIndex*> carriers(d.nchrom(), NULL);
+    if (params.prefilter) {
+        bool reuse = !d.carriers.empty() && d.carrier_thresh == params.rare_thresh;
+        size_t used = 0;
+        for (size_t chridx = 0; chridx < d.nchrom(); chridx++) {
+            const std::vector<int>& rares = params.rare_sites[chridx];
+            if (reuse && !d.carriers[chridx].built) { continue; }
+            if (reuse && d.carriers[chridx].sites == rares) {
+                carriers[chridx] = &d.carriers[chridx];
+            } else {
+                size_t left = used < params.carrier_memory ? params.carrier_memory - used : 0;
+                own_carriers[chridx] = carrier_index(d, chridx, rares, left);
+                if (!own_carriers[chridx].built) { continue; }
+                carriers[chridx] = &own_carriers[chridx];
+            }
+            used += carriers[chridx]->bytes();
+        }
+    }
+
+    // Binary output gets an index of where each tile's records ended up.
+    // The entries are all made here, and filled in by the writer thread.
+    segfile::Index index;
+    if (params.binary_output) {
+        out.writeblock(segfile::header());
+        for (const Individual& ind : d.individuals) { index.individuals.push_back(ind.label); }
+        for (size_t chridx = 0; chridx < d.nchrom(); chridx++) {
+            index.chromosomes.push_back(segfile::ChromEntry{d.chromosomes[chridx]->label, 0, 0});
+            for (const PairBlock& b : chrom_blocks[chridx]) {
+                segfile::BlockEntry e = {(uint32_t)chridx,
+                                         (uint32_t)b.i_start, (uint32_t)b.i_stop,
+                                         (uint32_t)b.j_start, (uint32_t)b.j_stop,
+                                         0, 0};
+                index.blocks.push_back(e);
+            }
+        }
+    } else {
+        out.writetoks(segfile::text_header());
+    }
+    uint64_t records_written = 0;
+
+    // Progress is tracked by the writer thread as batches are written, so
+    // workers never have to synchronize for it.
+    struct {
+        size_t chridx;
+        long completed;
+        long skipped;
+        unsigned long markers_used;
+        double signpost;
+    } progress = {0, 0, 0, 0, 0.0};
+    const double signpost_step = npairs > 100000 ? 0.001 : 0.01;
+
+    auto report_progress = [&](const SegmentBatch& batch) {
+        if (params.binary_output) {
+            segfile::BlockEntry& e = index.blocks[batch.sequence];
+            e.first_record = records_written;
+            e.nrecords = batch.nsegments;
+        }
+        records_written += batch.nsegments;
+
+        if (batch.chromidx != progress.chridx) {
+            progress.chridx = batch.chromidx;
+            progress.completed = 0;
+            progress.skipped = 0;
+            progress.markers_used = 0;
+            progress.signpost = 0.0;
+        }
+        progress.completed += batch.npairs;
+        progress.skipped += batch.nskipped;
+        progress.markers_used += batch.markers_used;
+
+        double fraction = (double)progress.completed / (double)(npairs);
+        if (fraction > progress.signpost) {
+            long decoded = std::max(progress.completed - progress.skipped, 1L);
+            double mean_mark = progress.markers_used / (double)decoded;
+            unsigned long total_mark = d.chromosomes[batch.chromidx]->nmark();
+
+            if (!out.is_stdout()) {
+                std::cout << "\rChromosome " << d.chromosomes[batch.chromidx]->label;
+                std::cout << ": " << sfloat(fraction * 100, 1) << "% complete. ";
+                std::cout << "Average markers per pair " << sfloat(mean_mark, 2);
+                std::cout << " (" << sfloat(100 * mean_mark / total_mark, 3) << "%)";
+                if (params.prefilter) {
+                    std::cout << ". Pre-filter skipped ";
+                    std::cout << sfloat(100.0 * progress.skipped / progress.completed, 1) << "% of pairs";
+                }
+                std::cout << std::flush;
+            }
+            while (fraction > progress.signpost) { progress.signpost += signpost_step; }
+        }
+    };
+
+    SegmentWriter writer(out, params.output_buffer, report_progress);
+
+    // Compute one block of pairs. Its output is collected in its own batch
+    // and handed off to the writer thread. Blocks are numbered
+    // consecutively across chromosomes so the writer can put them back in
+    // order.
+    auto run_block = [&](size_t chridx, const PairBlock& block, long sequence) {
+        SegmentBatch* batch = new SegmentBatch;
+        batch->sequence = sequence;
+        batch->chromidx = chridx;
+
+        auto add_result = [&](long i, long j, const adios_result& res) {
+            for (const Segment& s : res.segments) { 
+                if (params.binary_output) {
+                    segfile::append(batch->text, s.binary_record(i, j, chridx));
+                } else {
+                    s.append_record(batch->text, out.delim);
                 }
-                
-                markers_used += res.nmark;
-                completed++;
-                double progress = (double)completed / (double)(npairs);
-                
-                if (progress > signpost) {
-                    double mean_mark = markers_used / (double)completed;
-
-                    if (!out.is_stdout()) {
-                        std::cout << "\rChromosome " << d.chromosomes[chridx]->label;
-                        std::cout << ": " << sfloat(progress * 100, 1) << "% complete. ";
-                        std::cout << "Average markers per pair " << sfloat(mean_mark, 2);
-                        std::cout << " (" << sfloat(100 * mean_mark / total_mark, 3) << "%)";
-                        std::cout << std::flush;
+            }
+            batch->nsegments += res.segments.size();
+            batch->npairs++;
+            batch->markers_used += res.nmark;
+        };
+
+        // Pairs that can't have a segment passing min_mark are skipped
+        std::unique_ptr<prefilter::PairFilter> filter;
+        if (carriers[chridx]) {
+            filter.reset(new prefilter::PairFilter(*carriers[chridx], *d.chromosomes[chridx],
+                                                   block, (int)params.min_mark,
+                                                   params.prefilter_window));
+        }
+        auto skip = [&](long i, long j) {
+            if (!filter || filter->passes(i, j)) { return false; }
+            batch->npairs++;
+            batch->nskipped++;
+            return true;
+        };
+
+        if (params.engine == ENGINE_BATCH) {
+            std::vector<std::pair<long, long>> pairs;
+            std::vector<adios_result> results;
+            auto flush = [&](void) {
+                adios_pairs_batched(d, pairs, chridx, params, results);
+                for (size_t k = 0; k < pairs.size(); ++k) {
+                    add_result(pairs[k].first, pairs[k].second, results[k]);
+                }
+                pairs.clear();
+            };
+
+            block.for_each_pair([&](long i, long j) {
+                if (skip(i, j)) { return; }
+                pairs.push_back(std::make_pair(i, j));
+                if (pairs.size() == BATCH_POOL) { flush(); }
+            });
+            if (!pairs.empty()) { flush(); }
+        } else {
+            block.for_each_pair([&](long i, long j) {
+                if (skip(i, j)) { return; }
+                Individual& ind1 = d.individuals[i];
+                Individual& ind2 = d.individuals[j];
+                add_result(i, j, adios_pair_unphased(ind1, ind2, chridx, params));
+            });
+        }
+
+        writer.submit(batch);
+    };
+
+    if (params.schedule == SCHEDULE_GLOBAL) {
+        // Every chromosome's blocks in one loop, so threads go straight on
+        // to the next chromosome instead of waiting at the end of each one
+        // for the slowest block. Tasks are in sequence order, and dynamic
+        // scheduling hands them out in that order, so the writer still
+        // gets chromosomes roughly one at a time.
+        std::vector<std::pair<size_t, const PairBlock*>> tasks;
+        for (size_t chridx = 0; chridx < d.nchrom(); chridx++) {
+            for (const PairBlock& b : chrom_blocks[chridx]) { tasks.push_back(std::make_pair(chridx, &b)); }
+        }
+        long ntasks = tasks.size();
+
+        #pragma omp parallel for schedule(dynamic)
+        for (long taskidx = 0; taskidx < ntasks; ++taskidx) {
+            run_block(tasks[taskidx].first, *tasks[taskidx].second, taskidx);
+        }
+    } else {
+        long sequence_base = 0;
+        int nthreads = max_threads();
+
+        for (size_t chridx = 0; chridx < d.nchrom(); chridx++) {
+            const std::vector<PairBlock>& blocks = chrom_blocks[chridx];
+            long nblocks = blocks.size();
+            std::vector<ThreadLoad> chrom_loads;
+            auto chrom_start = std::chrono::steady_clock::now();
+
+            if (params.schedule == SCHEDULE_STEAL) {
+                WorkStealingScheduler sched(nblocks, nthreads);
+
+                #pragma omp parallel num_threads(nthreads)
+                {
+                    int tid = thread_num();
+                    long blockidx;
+                    while (sched.next(tid, blockidx)) {
+                        auto t = std::chrono::steady_clock::now();
+                        run_block(chridx, blocks[blockidx], sequence_base + blockidx);
+                        sched.done(tid, seconds_since(t));
                     }
-                    while (progress > signpost) { signpost += signpost_step; }
                 }
 
+                chrom_loads = sched.loads(seconds_since(chrom_start));
+            } else {
+                chrom_loads.resize(nthreads);
+
+                // If openmp is available, this is the loop we want to
+                // parallelize. This gives each thread a set of blocks of
+                // pairs to compute.
+                #pragma omp parallel for schedule(dynamic)
+                for (long blockidx = 0; blockidx < nblocks; ++blockidx) {
+                    auto t = std::chrono::steady_clock::now();
+                    run_block(chridx, blocks[blockidx], sequence_base + blockidx);
+                    ThreadLoad& l = chrom_loads[thread_num()];
+                    l.busy += seconds_since(t);
+                    l.tasks++;
+                }
+
+                double elapsed = seconds_since(chrom_start);
+                for (ThreadLoad& l : chrom_loads) { l.idle = std::max(0.0, elapsed - l.busy); }
             }
 
+            if (loads) { loads->push_back(chrom_loads); }
+            sequence_base += nblocks;
         }
     }
+
+    writer.finish();
+
+    if (params.binary_output) {
+        index.summarize_chromosomes();
+        out.writeblock(segfile::footer(index));
+    }
+
     if (!out.is_stdout()) { std::cout << '\n' << std::flush;  }
 }
 
+// Turn a pair's decoded states into the segments that pass the filters
+static void collect_segments(const adios_sites& useful,
+                             const std::vector<uint32_t>& codes,
+                             std::vector<int>& hidden_states,
+                             const adios_parameters& params,
+                             adios_result& res)
+{
+    const EmissionTable& table = params.emission_tables[useful.chromidx];
+    std::vector<ValueRun> runs = runs_gte_classic(hidden_states, 1, 5);
+
+    for (ValueRun r : runs) {
+        Segment seg(useful.ind1_label, useful.ind2_label, r, useful.info,
+                    useful.states, codes, table,
+                    useful.sites, params);
+
+        if (seg.passes_filters(params)) {
+            res.segments.push_back(seg);
+        }
+    }
+}
+
 adios_result run_adios_pair_unphased(const adios_sites& useful,  
                                      const adios_parameters& params) {
     using Linalg::Matrix;
 
     adios_result res;
     
-    auto observations = useful.states;
-    auto informative_sites = useful.sites;
-    auto chromobj = useful.info;
+    const std::vector<int>& observations = useful.states;
+    const std::vector<int>& informative_sites = useful.sites;
+    const Chromptr& chromobj = useful.info;
 
     int nmark = informative_sites.size();
     res.nmark = nmark;
 
-    // Make the emission matrices
-    std::vector<Matrix*> emissions;
-    emissions.reserve(nmark);
-    for (int i = 0; i < nmark; ++i) {
-        // Save the precomputed matrices
-        Matrix* mp = const_cast<Matrix*>(&(params.emission_mats.at(chromobj->frequencies[i])));
-        emissions.push_back(mp);
-    }
+    // Gather the emission table row for each informative site. The buffer
+    // is reused across pairs so this doesn't allocate.
+    const EmissionTable& table = params.emission_tables[useful.chromidx];
+    static thread_local std::vector<uint32_t> codes;
+    codes.resize(nmark);
+    sitekernel::gather(chromobj->freq_codes.data(), informative_sites.data(), nmark, codes.data());
 
-    GenotypeHMM model(observations, emissions, params.unphased_transition_mat);
+    GenotypeHMM model(observations.data(), codes.data(), nmark,
+                      table.probs.data(), EmissionTable::NOBS,
+                      params.unphased_transition_mat, table.ln_probs.data());
     std::vector<int> hidden_states = model.decode(params.viterbi);
 
-    std::vector<ValueRun> runs = runs_gte_classic(hidden_states, 1, 5);
+    collect_segments(useful, codes, hidden_states, params, res);
+    return res;    
 
-    for (ValueRun r : runs) {
-        Segment seg(useful.ind1_label, useful.ind2_label, r, chromobj,
-                    observations, emissions,
-                    informative_sites, params);
+}
 
-        if (seg.passes_filters(params)) {
-            res.segments.push_back(seg);
+
+// The pair's observation at marker m, coded the way the informative site
+// finders code it. Returns false where a requested site would still be
+// left out: if either genotype is missing, or neither carries the allele.
+static bool pair_observation(const Genotypes& g1, const Genotypes& g2, int m, int& obs)
+{
+    auto has = [m](const AlleleSites& sites, const PackedSites& packed, bool use_packed) {
+        return use_packed ? bitpack::test(packed, m) :
+                            std::binary_search(sites.begin(), sites.end(), m);
+    };
+    bool p1 = g1.packed, p2 = g2.packed;
+
+    if (has(g1.missing, g1.packed_missing, p1) || has(g2.missing, g2.packed_missing, p2)) {
+        return false;
+    }
+    int s1 = has(g1.hapa, g1.packed_a, p1) + has(g1.hapb, g1.packed_b, p1);
+    int s2 = has(g2.hapa, g2.packed_a, p2) + has(g2.hapb, g2.packed_b, p2);
+    obs = 3 * s1 + s2;
+    return obs != 0;
+}
+
+// Informative sites on either side of a segment end that are decoded again
+// when fine-mapping it
+static const long FINEMAP_WINDOW = 32;
+
+// Fine-map segment ends. The first pass only sees informative sites, so a
+// segment's true end can be anywhere in the gap between its outermost
+// informative site and the next one out. Every usable genotype in those
+// gaps is added, and a window of FINEMAP_WINDOW sites around each end is
+// decoded again, entering and leaving it with the first pass's forward
+// and backward messages. The rest of the first pass's states are kept, so
+// the cost depends on the number of segments, not the chromosome length.
+static adios_result finemap_segment_ends(const Individual& ind1, const Individual& ind2,
+                                         const adios_sites& useful,
+                                         const adios_result& first,
+                                         const adios_parameters& params)
+{
+    const long n = useful.sites.size();
+    const Chromptr& chromobj = useful.info;
+    const long nmarkers = chromobj->nmark();
+    const Genotypes& g1 = ind1.chromosomes[useful.chromidx];
+    const Genotypes& g2 = ind2.chromosomes[useful.chromidx];
+    const EmissionTable& table = params.emission_tables[useful.chromidx];
+    const bool max_product = params.viterbi;
+    const size_t ns = params.unphased_transition_mat.nrow;
+
+    std::vector<uint32_t> codes(n);
+    sitekernel::gather(chromobj->freq_codes.data(), useful.sites.data(), n, codes.data());
+    GenotypeHMM model(useful.states.data(), codes.data(), n,
+                      table.probs.data(), EmissionTable::NOBS,
+                      params.unphased_transition_mat, table.ln_probs.data());
+    static thread_local std::vector<double> fw, bw;
+    model.messages(max_product, fw, bw);
+
+    // The first pass's states, from the same messages
+    std::vector<int> states(n);
+    for (long i = 0; i < n; ++i) {
+        const double* f = &fw[i * ns];
+        const double* b = &bw[i * ns];
+        size_t best = 0;
+        for (size_t k = 1; k < ns; ++k) {
+            if (f[k] * b[k] > f[best] * b[best]) { best = k; }
         }
+        states[i] = best;
     }
 
-    return res;    
+    // Segments close enough to share sites are refined together, as one
+    // region. Regions are widened to take in any run of IBD states at
+    // their edges, so no run is cut short.
+    struct Region { long lo, hi; std::vector<std::pair<long, long>> windows; };
+    std::vector<Region> regions;
+    for (const Segment& seg : first.segments) {
+        long start = seg.start, stop = seg.stop;
+        long lo = std::max(0L, start - FINEMAP_WINDOW);
+        long hi = std::min(n - 1, stop + FINEMAP_WINDOW);
+        while (lo > 0 && states[lo - 1]) { lo--; }
+        while (hi < n - 1 && states[hi + 1]) { hi++; }
+
+        if (regions.empty() || lo > regions.back().hi + 1) {
+            regions.push_back(Region{lo, hi, {}});
+        }
+        Region& r = regions.back();
+        r.hi = std::max(r.hi, hi);
 
-}
+        // Windows around each end, merged where they overlap
+        std::pair<long, long> ends[2] = {
+            std::make_pair(std::max(lo, start - FINEMAP_WINDOW), std::min(hi, start + FINEMAP_WINDOW)),
+            std::make_pair(std::max(lo, stop - FINEMAP_WINDOW), std::min(hi, stop + FINEMAP_WINDOW))
+        };
+        for (const auto& w : ends) {
+            if (!r.windows.empty() && w.first <= r.windows.back().second + 1) {
+                r.windows.back().second = std::max(r.windows.back().second, w.second);
+            } else {
+                r.windows.push_back(w);
+            }
+        }
+    }
+
+    // Whether the gap after first pass site k (k = -1 for the one before
+    // the first site) holds a segment end
+    std::vector<long> gaps;
+    for (const Segment& seg : first.segments) {
+        gaps.push_back((long)seg.start - 1);
+        gaps.push_back(seg.stop);
+    }
+    std::sort(gaps.begin(), gaps.end());
+
+    adios_result res;
+    res.nmark = n;
+
+    std::vector<int> sites, obs, local_states;
+    std::vector<uint32_t> local_codes;
+    std::vector<long> local_index;  // Where each first pass site went
+    for (const Region& r : regions) {
+        sites.clear();
+        obs.clear();
+        local_states.clear();
+        local_index.clear();
+
+        auto add_gap = [&](long k) {
+            if (!std::binary_search(gaps.begin(), gaps.end(), k)) { return; }
+            // As with the full re-run, the gap after the last site stops
+            // short of the chromosome's last marker
+            int first_marker = k < 0 ? 0 : useful.sites[k] + 1;
+            int last_marker = k + 1 < n ? useful.sites[k + 1] : nmarkers - 1;
+            for (int m = first_marker; m < last_marker; ++m) {
+                int o;
+                if (!pair_observation(g1, g2, m, o)) { continue; }
+                sites.push_back(m);
+                obs.push_back(o);
+                local_states.push_back(0);
+            }
+        };
 
+        if (r.lo == 0) { add_gap(-1); }
+        for (long k = r.lo; k <= r.hi; ++k) {
+            local_index.push_back(sites.size());
+            sites.push_back(useful.sites[k]);
+            obs.push_back(useful.states[k]);
+            local_states.push_back(states[k]);
+            add_gap(k);
+        }
+
+        local_codes.resize(sites.size());
+        sitekernel::gather(chromobj->freq_codes.data(), sites.data(), sites.size(), local_codes.data());
+
+        for (const auto& w : r.windows) {
+            // Sites added before the first site of the sequence or after
+            // the last belong to the window that reaches the end
+            size_t from = w.first == 0 ? 0 : local_index[w.first - r.lo];
+            size_t to = w.second == n - 1 ? sites.size() : local_index[w.second - r.lo] + 1;
+
+            GenotypeHMM window(obs.data() + from, local_codes.data() + from, to - from,
+                               table.probs.data(), EmissionTable::NOBS,
+                               params.unphased_transition_mat, table.ln_probs.data());
+            const double* entry = w.first > 0 ? &fw[(w.first - 1) * ns] : NULL;
+            const double* exit = w.second < n - 1 ? &bw[w.second * ns] : NULL;
+            std::vector<int> decoded = window.decode_window(max_product, entry, exit);
+            std::copy(decoded.begin(), decoded.end(), local_states.begin() + from);
+        }
+
+        for (ValueRun run : runs_gte_classic(local_states, 1, 5)) {
+            Segment seg(useful.ind1_label, useful.ind2_label, run, chromobj,
+                        obs, local_codes, table, sites, params);
+            if (seg.passes_filters(params)) {
+                res.segments.push_back(seg);
+            }
+        }
+    }
+
+    return res;
+}
 
 adios_result adios_pair_unphased(const Individual& ind1, const Individual& ind2,
         int chromidx,
         const adios_parameters& params)
 {
  
-    auto useful = find_informative_sites_unphased(ind1,
-                                                  ind2,
-                                                  chromidx,
-                                                  params.rare_sites[chromidx]);
+    auto useful = informative_sites(ind1, ind2, chromidx, params);
 
     auto res = run_adios_pair_unphased(useful, params);
 
     if (res.segments.size() == 0 || !params.finemap_ends) return res;
 
-    AlleleSites requested;
-    for (auto& segment : res.segments) {
-        
-        int cur_start = useful.sites[segment.start];
-        int new_start = segment.start > 0 ? useful.sites[segment.start - 1] : 0;
-        
-
-        int cur_stop = useful.sites[segment.stop];
-        int new_stop = (segment.stop + 1) >= useful.sites.size() ? 
-                       useful.info->positions.size() - 1 : 
-                       useful.sites[segment.stop + 1];
-
-
-        for (int i = new_start; i < cur_start; i++) { requested.push_back(i); }
-        for (int i = cur_stop; i < new_stop; i++) { requested.push_back(i); }
+    return finemap_segment_ends(ind1, ind2, useful, res, params);
+}
 
+static void adios_pairs_batched(const Dataset& d,
+                                const std::vector<std::pair<long, long>>& pairs,
+                                int chromidx,
+                                const adios_parameters& params,
+                                std::vector<adios_result>& results)
+{
+    size_t npairs = pairs.size();
+    const Chromptr& chromobj = d.chromosomes[chromidx];
+    const EmissionTable& table = params.emission_tables[chromidx];
+
+    std::vector<adios_sites> useful(npairs);
+    std::vector<std::vector<uint32_t>> codes(npairs);
+    std::vector<size_t> order(npairs);
+    for (size_t k = 0; k < npairs; ++k) {
+        useful[k] = informative_sites(d.individuals[pairs[k].first],
+                                      d.individuals[pairs[k].second],
+                                      chromidx, params);
+        const std::vector<int>& sites = useful[k].sites;
+        codes[k].resize(sites.size());
+        sitekernel::gather(chromobj->freq_codes.data(), sites.data(), sites.size(), codes[k].data());
+        order[k] = k;
+    }
+    std::stable_sort(order.begin(), order.end(), [&useful](size_t a, size_t b) {
+        return useful[a].sites.size() < useful[b].sites.size();
+    });
+
+    batchhmm::BatchDecoder decoder(table.probs.data(), table.ln_probs.data(),
+                                   EmissionTable::NOBS, params.unphased_transition_mat);
+    batchhmm::Sequence seqs[batchhmm::LANES];
+    std::vector<int> states[batchhmm::LANES];
+
+    results.assign(npairs, adios_result());
+    for (size_t first = 0; first < npairs; first += batchhmm::LANES) {
+        size_t n = std::min(batchhmm::LANES, npairs - first);
+        for (size_t lane = 0; lane < n; ++lane) {
+            const adios_sites& u = useful[order[first + lane]];
+            seqs[lane] = batchhmm::Sequence{u.states.data(), codes[order[first + lane]].data(), u.sites.size()};
+        }
+        decoder.decode(seqs, n, params.viterbi, states);
+
+        for (size_t lane = 0; lane < n; ++lane) {
+            size_t k = order[first + lane];
+            adios_result& res = results[k];
+            res.nmark = useful[k].sites.size();
+            collect_segments(useful[k], codes[k], states[lane], params, res);
+
+            if (!res.segments.empty() && params.finemap_ends) {
+                res = finemap_segment_ends(d.individuals[pairs[k].first],
+                                           d.individuals[pairs[k].second],
+                                           useful[k], res, params);
+            }
+        }
     }
-    
-
-    auto useful2 = find_informative_sites_unphased(ind1, 
-                                                   ind2, 
-                                                   chromidx, 
-                                                   params.rare_sites[chromidx], 
-                                                   requested);
-    auto res2 = run_adios_pair_unphased(useful2, params); 
-    return res2;
-
 }
 
 
@@ -360,9 +931,10 @@ Segment::Segment(const std::string& a,
                  const std::string& b,
                  ValueRun& run,
                  Chromptr c,
-                 std::vector<int>& obs,
-                 std::vector<Matrix*>& emissions,
-                 std::vector<int>& adiossites,
+                 const std::vector<int>& obs,
+                 const std::vector<uint32_t>& emission_codes,
+                 const EmissionTable& emissions,
+                 const std::vector<int>& adiossites,
                  const adios_parameters& params)
 {
 
@@ -379,7 +951,7 @@ Segment::Segment(const std::string& a,
     full_start = adiossites[start];
     full_stop = adiossites[stop];
 
-    lod = calculate_lod(obs, emissions, params);
+    lod = calculate_lod(obs, emission_codes, emissions, params);
 
     nerr = 0;
     nrare = 0;
@@ -391,7 +963,7 @@ Segment::Segment(const std::string& a,
 }
 
 
-void Segment::trim(std::vector<int>& observations)
+void Segment::trim(const std::vector<int>& observations)
 {
     // return;
     using adios::is_shared_rv;
@@ -407,8 +979,9 @@ void Segment::trim(std::vector<int>& observations)
     }
 }
 
-double Segment::calculate_lod(std::vector<int>& observations,
-                              std::vector<Matrix*>& emissions,
+double Segment::calculate_lod(const std::vector<int>& observations,
+                              const std::vector<uint32_t>& emission_codes,
+                              const EmissionTable& emissions,
                               const adios::adios_parameters& params) const
 {
     using std::log10;
@@ -425,8 +998,8 @@ double Segment::calculate_lod(std::vector<int>& observations,
 
     for (size_t i = start; i < stop; ++i) {
         int obs = observations[i];
-        log_ibd_prob += log10(emissions[i]->get(obs, state));
-        log_null_prob += log10(emissions[i]->get(obs, 0));
+        log_ibd_prob += emissions.get_log10(emission_codes[i], obs, state);
+        log_null_prob += emissions.get_log10(emission_codes[i], obs, 0);
     }
 
     log_ibd_prob += log10(entry) + log10(exit);
@@ -464,6 +1037,31 @@ std::vector<std::string> Segment::record(void) const
     return s;
 }
 
+void Segment::append_record(std::string& buf, char delim) const
+{
+    std::vector<std::string> toks = record();
+    for (size_t i = 0; i < toks.size(); ++i) {
+        buf.append(toks[i]);
+        buf.push_back((i != toks.size() - 1) ? delim : '\n');
+    }
+}
+
+segfile::Record Segment::binary_record(uint32_t ind1idx, uint32_t ind2idx, uint32_t chromidx) const
+{
+    segfile::Record r;
+    r.ind1 = ind1idx;
+    r.ind2 = ind2idx;
+    r.chrom = chromidx;
+    r.start = chrom->positions[full_start];
+    r.stop = chrom->positions[full_stop];
+    r.state = state;
+    r.nmark = nmark;
+    r.nrare = nrare;
+    r.nerr = nerr;
+    r.lod = lod;
+    return r;
+}
+
 std::string Segment::record_string(void) const
 {
 
@@ -0,0 +1,188 @@
+#include "batchhmm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace batchhmm {
+
+BatchDecoder::BatchDecoder(const double* emission_table, const double* log_emission_table,
+                           size_t nsyms, const Linalg::Matrix& transition)
+    : emissions(emission_table), log_emissions(log_emission_table), nsymbols(nsyms), nsteps(0)
+{
+    if (transition.nrow != 2 || transition.ncol != 2) {
+        throw std::invalid_argument("Batched decoding needs a two state model");
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        for (size_t j = 0; j < 2; ++j) {
+            trans[i][j] = transition.get(i, j);
+            ln_trans[i][j] = std::log(trans[i][j]);
+        }
+    }
+    std::fill(len, len + LANES, 0);
+}
+
+// Lay the sequences' emissions out lane by lane. Past the end of a
+// sequence its lane is padded with emissions that don't favour either
+// state; the decoders don't let the padding change anything anyway.
+void BatchDecoder::load(const Sequence* seqs, size_t n, bool logs)
+{
+    nsteps = 0;
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        len[lane] = lane < n ? seqs[lane].nobs : 0;
+        nsteps = std::max(nsteps, len[lane]);
+    }
+
+    const double pad = logs ? 0.0 : 1.0;
+    e0.assign(nsteps * LANES, pad);
+    e1.assign(nsteps * LANES, pad);
+
+    for (size_t lane = 0; lane < n; ++lane) {
+        const Sequence& s = seqs[lane];
+        for (size_t t = 0; t < s.nobs; ++t) {
+            size_t row = (s.emission_codes[t] * nsymbols + s.observations[t]) * 2;
+            double a, b;
+            if (!logs) {
+                a = emissions[row];
+                b = emissions[row + 1];
+            } else if (log_emissions) {
+                a = log_emissions[row];
+                b = log_emissions[row + 1];
+            } else {
+                a = std::log(emissions[row]);
+                b = std::log(emissions[row + 1]);
+            }
+            e0[t * LANES + lane] = a;
+            e1[t * LANES + lane] = b;
+        }
+    }
+}
+
+void BatchDecoder::decode(const Sequence* seqs, size_t n, bool use_posteriori,
+                          std::vector<int>* states)
+{
+    if (n > LANES) { throw std::invalid_argument("Too many sequences for one batch"); }
+
+    load(seqs, n, use_posteriori);
+    if (use_posteriori) {
+        viterbi();
+    } else {
+        forwards_backwards();
+    }
+
+    for (size_t lane = 0; lane < n; ++lane) {
+        std::vector<int>& out = states[lane];
+        out.resize(len[lane]);
+        for (size_t t = 0; t < len[lane]; ++t) { out[t] = path[t * LANES + lane]; }
+    }
+}
+
+// As GenotypeHMM::forwards_backwards_fixed<2>, a lane at a time
+void BatchDecoder::forwards_backwards(void)
+{
+    fw0.resize(nsteps * LANES);
+    fw1.resize(nsteps * LANES);
+    path.assign(nsteps * LANES, 0);
+
+    double p0[LANES], p1[LANES];
+    std::fill(p0, p0 + LANES, 0.5);
+    std::fill(p1, p1 + LANES, 0.5);
+
+    for (size_t t = 0; t < nsteps; ++t) {
+        const double* d0 = &e0[t * LANES];
+        const double* d1 = &e1[t * LANES];
+        double* c0 = &fw0[t * LANES];
+        double* c1 = &fw1[t * LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            double v0 = trans[0][0] * p0[lane] + trans[1][0] * p1[lane];
+            double v1 = trans[0][1] * p0[lane] + trans[1][1] * p1[lane];
+            double a = d0[lane] * v0;
+            double b = d1[lane] * v1;
+            double total = a + b;
+            c0[lane] = p0[lane] = a / total;
+            c1[lane] = p1[lane] = b / total;
+        }
+    }
+
+    // Backwards. Each lane's backward probabilities stay at 1 until the
+    // pass reaches the end of its sequence.
+    double b0[LANES], b1[LANES];
+    std::fill(b0, b0 + LANES, 1.0);
+    std::fill(b1, b1 + LANES, 1.0);
+    long lens[LANES];
+    for (size_t lane = 0; lane < LANES; ++lane) { lens[lane] = len[lane]; }
+
+    for (long t = (long)nsteps - 1; t >= 0; --t) {
+        const double* c0 = &fw0[t * LANES];
+        const double* c1 = &fw1[t * LANES];
+        uint8_t* decided = &path[t * LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            decided[lane] = c1[lane] * b1[lane] > c0[lane] * b0[lane];
+        }
+
+        if (!t) { break; }
+
+        const double* d0 = &e0[t * LANES];
+        const double* d1 = &e1[t * LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            double v0 = d0[lane] * b0[lane];
+            double v1 = d1[lane] * b1[lane];
+            double n0 = trans[0][0] * v0 + trans[0][1] * v1;
+            double n1 = trans[1][0] * v0 + trans[1][1] * v1;
+            double total = n0 + n1;
+            bool past_end = t >= lens[lane];
+            b0[lane] = past_end ? 1.0 : n0 / total;
+            b1[lane] = past_end ? 1.0 : n1 / total;
+        }
+    }
+}
+
+// As GenotypeHMM::viterbi, a lane at a time
+void BatchDecoder::viterbi(void)
+{
+    std::vector<uint8_t> back0(nsteps * LANES), back1(nsteps * LANES);
+    path.assign(nsteps * LANES, 0);
+
+    double s0[LANES], s1[LANES];
+    std::fill(s0, s0 + LANES, 0.0);
+    std::fill(s1, s1 + LANES, 0.0);
+    long lens[LANES];
+    for (size_t lane = 0; lane < LANES; ++lane) { lens[lane] = len[lane]; }
+
+    for (size_t t = 0; t < nsteps; ++t) {
+        const double* d0 = &e0[t * LANES];
+        const double* d1 = &e1[t * LANES];
+        uint8_t* bp0 = &back0[t * LANES];
+        uint8_t* bp1 = &back1[t * LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            // Ties go to the lowest numbered state
+            double stay0 = s0[lane] + ln_trans[0][0];
+            double from1 = s1[lane] + ln_trans[1][0];
+            bool best0 = from1 > stay0;
+            double n0 = (best0 ? from1 : stay0) + d0[lane];
+
+            double from0 = s0[lane] + ln_trans[0][1];
+            double stay1 = s1[lane] + ln_trans[1][1];
+            bool best1 = stay1 > from0;
+            double n1 = (best1 ? stay1 : from0) + d1[lane];
+
+            bp0[lane] = best0;
+            bp1[lane] = best1;
+
+            // Scores stop changing at the end of the lane's sequence
+            bool active = (long)t < lens[lane];
+            s0[lane] = active ? n0 : s0[lane];
+            s1[lane] = active ? n1 : s1[lane];
+        }
+    }
+
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        int state = s1[lane] > s0[lane];
+        for (size_t t = len[lane]; t-- > 0; ) {
+            path[t * LANES + lane] = state;
+            state = state ? back1[t * LANES + lane] : back0[t * LANES + lane];
+        }
+    }
+}
+
+}
@@ -0,0 +1,408 @@
+#include "bcf.hpp"
+#include "bgzf.hpp"
+
+#ifdef HAVE_ZLIB
+
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Types of BCF typed values
+enum {
+    BCF_NULL = 0,
+    BCF_INT8 = 1,
+    BCF_INT16 = 2,
+    BCF_INT32 = 3,
+    BCF_FLOAT = 5,
+    BCF_CHAR = 7
+};
+
+static const uint32_t BCF_FLOAT_MISSING = 0x7F800001;
+
+// Size of the fixed fields at the start of a record's shared block
+static const size_t SHARED_FIXED_SIZE = 24;
+
+static void truncated(void)
+{
+    throw std::invalid_argument("Truncated BCF record");
+}
+
+static size_t type_size(int type)
+{
+    switch (type) {
+    case BCF_NULL: return 0;
+    case BCF_INT8: return 1;
+    case BCF_INT16: return 2;
+    case BCF_INT32: return 4;
+    case BCF_FLOAT: return 4;
+    case BCF_CHAR: return 1;
+    default: throw std::invalid_argument("Unknown BCF type " + std::to_string(type));
+    }
+}
+
+static inline int32_t get_int(const char* p, int type)
+{
+    switch (type) {
+    case BCF_INT8: return (int8_t)*p;
+    case BCF_INT16: { int16_t v; memcpy(&v, p, 2); return v; }
+    case BCF_INT32: { int32_t v; memcpy(&v, p, 4); return v; }
+    default: throw std::invalid_argument("Expected a BCF integer");
+    }
+}
+
+// Integer sentinels: the smallest value of the type is missing, the next
+// smallest pads vectors shorter than the declared length
+static inline int32_t int_missing(int type)
+{
+    return type == BCF_INT8 ? INT8_MIN : (type == BCF_INT16 ? INT16_MIN : INT32_MIN);
+}
+
+static inline int32_t int_vector_end(int type) { return int_missing(type) + 1; }
+
+// The shortest decimal that rounds to f, as a double. Text VCF gives us
+// the decimal that was written (0.017), and BCF the nearest float to it
+// (0.0170000009), so this is what keeps the two loading identically.
+static double float_to_decimal(float f)
+{
+    char buf[32];
+    for (int precision = 1; precision < 9; ++precision) {
+        snprintf(buf, sizeof(buf), "%.*g", precision, f);
+        if ((float)strtod(buf, NULL) == f) { return strtod(buf, NULL); }
+    }
+    snprintf(buf, sizeof(buf), "%.9g", f);
+    return strtod(buf, NULL);
+}
+
+// A typed value's descriptor. data points just past it.
+struct Typed {
+    int type;
+    size_t count;
+    const char* data;
+
+    inline size_t bytes(void) const { return count * type_size(type); }
+};
+
+static int32_t read_typed_int(const char*& p, const char* end);
+
+// Reads a descriptor at p, leaving p at the data it describes
+static Typed read_typed(const char*& p, const char* end)
+{
+    if (p >= end) { truncated(); }
+    Typed t;
+    t.type = *p & 0xF;
+    t.count = (*p >> 4) & 0xF;
+    p++;
+    // Counts of 15 or more follow as a typed integer
+    if (t.count == 15) {
+        int32_t n = read_typed_int(p, end);
+        if (n < 0) { throw std::invalid_argument("Negative BCF vector length"); }
+        t.count = n;
+    }
+    t.data = p;
+    return t;
+}
+
+// Reads a typed scalar integer (a dictionary key or a count)
+static int32_t read_typed_int(const char*& p, const char* end)
+{
+    Typed t = read_typed(p, end);
+    if (t.count != 1 || (size_t)(end - p) < t.bytes()) { truncated(); }
+    p += t.bytes();
+    return get_int(t.data, t.type);
+}
+
+// Skips over a typed value, n values per descriptor count
+static void skip_typed(const char*& p, const char* end, size_t n=1)
+{
+    Typed t = read_typed(p, end);
+    size_t bytes = t.bytes() * n;
+    if ((size_t)(end - p) < bytes) { truncated(); }
+    p += bytes;
+}
+
+// The ID (and IDX, if given) of a structured header line like
+// ##INFO=<ID=DP,...>
+static std::string header_id(const std::string& line, int& idx)
+{
+    size_t start = line.find("<ID=");
+    if (start == std::string::npos) { throw std::invalid_argument("Malformed BCF header line: " + line); }
+    start += 4;
+    size_t stop = line.find_first_of(",>", start);
+    if (stop == std::string::npos) { throw std::invalid_argument("Malformed BCF header line: " + line); }
+
+    size_t idxpos = line.find(",IDX=");
+    idx = idxpos == std::string::npos ? -1 : atoi(line.c_str() + idxpos + 5);
+    return line.substr(start, stop - start);
+}
+
+// Adds an ID to a dictionary, at IDX if the header gave one
+static void add_to_dictionary(std::vector<std::string>& dict, std::map<std::string, int>& index,
+                              const std::string& id, int idx)
+{
+    if (index.count(id)) { return; }
+    if (idx < 0) { idx = dict.size(); }
+    if ((size_t)idx >= dict.size()) { dict.resize(idx + 1); }
+    dict[idx] = id;
+    index[id] = idx;
+}
+
+BCFHeader::BCFHeader(const std::string& text) : gt_key(-1)
+{
+    using stringops::startswith;
+
+    // PASS is always the first filter
+    add_to_dictionary(keys, key_index, "PASS", -1);
+
+    std::map<std::string, int> contig_index;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == std::string::npos) { nl = text.size(); }
+        std::string line = text.substr(pos, nl - pos);
+        pos = nl + 1;
+
+        // The header text is NUL terminated
+        while (!line.empty() && (line.back() == '\0' || line.back() == '\r')) { line.pop_back(); }
+
+        int idx = -1;
+        if (startswith(line, "##contig=")) {
+            std::string id = header_id(line, idx);
+            add_to_dictionary(contigs, contig_index, id, idx);
+        } else if (startswith(line, "##INFO=") || startswith(line, "##FILTER=") ||
+                   startswith(line, "##FORMAT=")) {
+            std::string id = header_id(line, idx);
+            add_to_dictionary(keys, key_index, id, idx);
+        } else if (startswith(line, "#CHROM")) {
+            std::vector<std::string> fields = stringops::split(line, "\t");
+            samples.assign(fields.begin() + std::min(fields.size(), (size_t)9), fields.end());
+        }
+    }
+
+    gt_key = key("GT");
+}
+
+int BCFHeader::key(const std::string& id) const
+{
+    auto it = key_index.find(id);
+    return it == key_index.end() ? -1 : it->second;
+}
+
+BCFRecordView::BCFRecordView(const BCFHeader& h,
+                             const char* shared, size_t shared_len,
+                             const char* indiv_block, size_t indiv_len)
+    : header(h), shared_end(shared + shared_len), indiv(indiv_block),
+      indiv_end(indiv_block + indiv_len)
+{
+    if (shared_len < SHARED_FIXED_SIZE) { truncated(); }
+
+    int32_t chromidx;
+    int32_t pos0;
+    uint32_t n_allele_info;
+    uint32_t n_fmt_sample;
+    memcpy(&chromidx, shared, 4);
+    memcpy(&pos0, shared + 4, 4);
+    memcpy(&n_allele_info, shared + 16, 4);
+    memcpy(&n_fmt_sample, shared + 20, 4);
+
+    if (chromidx < 0 || (size_t)chromidx >= header.contigs.size()) {
+        throw std::invalid_argument("BCF record on undefined contig " + std::to_string(chromidx));
+    }
+    const std::string& c = header.contigs[chromidx];
+    chrom = Span(c.data(), c.size());
+    pos = pos0 + 1;
+    n_allele = n_allele_info >> 16;
+    n_info = n_allele_info & 0xFFFF;
+    n_fmt = n_fmt_sample >> 24;
+    n_sample = n_fmt_sample & 0xFFFFFF;
+    if ((size_t)n_sample != header.samples.size()) {
+        throw std::invalid_argument("BCF record has " + std::to_string(n_sample) + " samples, header has " +
+                                    std::to_string(header.samples.size()));
+    }
+
+    const char* p = shared + SHARED_FIXED_SIZE;
+    Typed id = read_typed(p, shared_end);
+    if ((size_t)(shared_end - p) < id.bytes()) { truncated(); }
+    p += id.bytes();
+    // A missing ID is stored as an empty string
+    label = id.count ? Span(id.data, strnlen(id.data, id.count)) : Span(".", 1);
+
+    alleles = p;
+    for (int i = 0; i < n_allele; ++i) { skip_typed(p, shared_end); }
+    skip_typed(p, shared_end);      // FILTER
+    info = p;
+}
+
+int BCFRecordView::nalleles(void) const
+{
+    return n_allele;
+}
+
+// Same rule as text VCF: REF and every ALT at most two characters
+bool BCFRecordView::is_snv(void) const
+{
+    const char* p = alleles;
+    for (int i = 0; i < n_allele; ++i) {
+        Typed a = read_typed(p, shared_end);
+        if ((size_t)(shared_end - p) < a.bytes()) { truncated(); }
+        if (strnlen(a.data, a.count) > 2) { return false; }
+        p += a.bytes();
+    }
+    return true;
+}
+
+double BCFRecordView::get_info_freq(const std::string& key) const
+{
+    return get_info_freq(header.key(key));
+}
+
+double BCFRecordView::get_info_freq(int k) const
+{
+    if (k < 0) { return 0.0; }
+
+    const char* p = info;
+    for (int i = 0; i < n_info; ++i) {
+        int32_t infokey = read_typed_int(p, shared_end);
+        Typed v = read_typed(p, shared_end);
+        if ((size_t)(shared_end - p) < v.bytes()) { truncated(); }
+        p += v.bytes();
+        if (infokey != k) { continue; }
+
+        // Flags have no value and count as 0, as do missing values
+        if (!v.count) { return 0.0; }
+        switch (v.type) {
+        case BCF_FLOAT: {
+            uint32_t bits;
+            float f;
+            memcpy(&bits, v.data, 4);
+            memcpy(&f, v.data, 4);
+            return bits == BCF_FLOAT_MISSING ? 0.0 : float_to_decimal(f);
+        }
+        case BCF_CHAR:
+            return atof(std::string(v.data, strnlen(v.data, v.count)).c_str());
+        case BCF_NULL:
+            return 0.0;
+        default: {
+            int32_t x = get_int(v.data, v.type);
+            return (x == int_missing(v.type) || x == int_vector_end(v.type)) ? 0.0 : x;
+        }
+        }
+    }
+    return 0.0;
+}
+
+void BCFRecordView::get_minor_alleles(VCFRecordGenotypeContainer& con) const
+{
+    if (!n_sample) { return; }
+
+    const char* p = indiv;
+    for (int f = 0; f < n_fmt; ++f) {
+        int32_t fmtkey = read_typed_int(p, indiv_end);
+        if (fmtkey != header.gt_key) {
+            skip_typed(p, indiv_end, n_sample);
+            continue;
+        }
+
+        Typed gt = read_typed(p, indiv_end);
+        if ((size_t)(indiv_end - p) < gt.bytes() * n_sample) { truncated(); }
+        size_t tsize = type_size(gt.type);
+        int32_t missing = int_missing(gt.type);
+        int32_t vector_end = int_vector_end(gt.type);
+
+        for (int indidx = 0; indidx < n_sample; ++indidx) {
+            const char* g = gt.data + indidx * gt.count * tsize;
+
+            // Haploid calls count as homozygous, like in text. Haploid
+            // samples in a diploid field are padded with vector_end.
+            int32_t a = gt.count ? get_int(g, gt.type) : vector_end;
+            int32_t b = gt.count >= 2 ? get_int(g + tsize, gt.type) : vector_end;
+            if (a == vector_end ||
+                (gt.count > 2 && b != vector_end && get_int(g + 2 * tsize, gt.type) != vector_end)) {
+                con.malformed++;
+                con.missing.push_back(indidx);
+                continue;
+            }
+            if (b == vector_end) { b = a; }
+
+            if (a == missing || b == missing || (a >> 1) == 0 || (b >> 1) == 0) {
+                con.missing.push_back(indidx);
+            } else {
+                if ((a >> 1) != 1) { con.alts.push_back(2 * indidx); }
+                if ((b >> 1) != 1) { con.alts.push_back(2 * indidx + 1); }
+            }
+        }
+        return;
+    }
+
+    throw std::invalid_argument("No GT field in FORMAT at " + chrom.str() + ':' + std::to_string(pos));
+}
+
+Dataset read_bcf(const std::string& filename, const VCFParams& fileparams, int nthreads,
+                 const VCFRegion& region)
+{
+    if (!BGZFFile::is_bgzf(filename)) {
+        throw std::invalid_argument("Only BGZF compressed BCF is supported: " + filename);
+    }
+
+    BGZFFile f(nthreads);
+    f.openfile(filename, false);
+
+    char magic[5];
+    if (f.read(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, "BCF\2", 4)) {
+        throw std::invalid_argument("Not a BCF2 file: " + filename);
+    }
+
+    uint32_t l_text = 0;
+    if (f.read((char*)&l_text, sizeof(l_text)) != sizeof(l_text)) { truncated(); }
+    std::string text(l_text, '\0');
+    if (f.read(&text[0], l_text) != l_text) { throw std::invalid_argument("Truncated BCF header"); }
+    BCFHeader header(text);
+
+    Dataset data;
+    for (const std::string& sample : header.samples) { data.add_individual(sample); }
+
+    const int freq_key = header.key(fileparams.freq_field);
+    VCFMerger merger(data);
+    VCFRecordGenotypeContainer con(data.ninds());
+    VCFParsedLine parsed;
+    std::string shared, indiv;
+    while (true) {
+        uint32_t lens[2];
+        size_t n = f.read((char*)lens, sizeof(lens));
+        if (!n) { break; }
+        if (n != sizeof(lens)) { truncated(); }
+
+        shared.resize(lens[0]);
+        indiv.resize(lens[1]);
+        if (f.read(&shared[0], lens[0]) != lens[0] || f.read(&indiv[0], lens[1]) != lens[1]) {
+            truncated();
+        }
+
+        if (!region.whole_file()) {
+            if (shared.size() < SHARED_FIXED_SIZE) { truncated(); }
+            int32_t chromidx;
+            int32_t pos0;
+            memcpy(&chromidx, shared.data(), 4);
+            memcpy(&pos0, shared.data() + 4, 4);
+            if (chromidx < 0 || (size_t)chromidx >= header.contigs.size() ||
+                !region.contains(header.contigs[chromidx], pos0 + 1)) {
+                continue;
+            }
+        }
+
+        BCFRecordView rec(header, shared.data(), shared.size(), indiv.data(), indiv.size());
+        parse_record(rec, fileparams, freq_key, con, parsed);
+        merger.add(parsed);
+    }
+
+    if (!region.whole_file() && !data.nchrom()) {
+        throw std::invalid_argument("No variants in region " + region.chrom);
+    }
+
+    data.finalize();
+    return data;
+}
+
+#endif
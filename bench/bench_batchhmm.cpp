@@ -0,0 +1,96 @@
+// Microbenchmark for batched decoding: compares decoding LANES pairs one at
+// a time with GenotypeHMM against decoding them together with
+// batchhmm::BatchDecoder, for both posterior and Viterbi decoding, on
+// simulated pairs with adios' own transition and emission matrices.
+//
+// Usage: bench_batchhmm [observation lengths...]
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "adios.hpp"
+#include "HiddenMarkov.hpp"
+#include "batchhmm.hpp"
+
+typedef std::chrono::steady_clock Clock;
+using Linalg::Matrix;
+
+static double seconds_since(const Clock::time_point& start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    std::vector<long> lengths;
+    for (int i = 1; i < argc; ++i) { lengths.push_back(atol(argv[i])); }
+    if (lengths.empty()) { lengths = {100, 1000, 10000}; }
+
+    Matrix single_error = adios::unphased_genotype_error_matrix(0.001);
+    Matrix err = Linalg::kronecker_product(single_error, single_error);
+    std::vector<double> levels;
+    for (double q = 0.001; q < 0.05; q += 0.001) { levels.push_back(q); }
+    adios::EmissionTable table(levels, err);
+    Matrix transition = adios::unphased_transition_matrix(4, 3);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick_level(0, levels.size() - 1);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    const int unshared[] = {1, 2, 3, 5, 6, 7};
+    const int shared[] = {4, 8};
+    const size_t K = batchhmm::LANES;
+
+    for (long nobs : lengths) {
+        // Pairs in a batch have about the same number of informative sites
+        std::vector<std::vector<int>> obs(K);
+        std::vector<std::vector<uint32_t>> codes(K);
+        for (size_t k = 0; k < K; ++k) {
+            long len = nobs + (long)(0.05 * nobs * unif(rng));
+            bool ibd = false;
+            for (long i = 0; i < len; ++i) {
+                if (unif(rng) < 0.002) { ibd = !ibd; }
+                obs[k].push_back(ibd ? shared[rng() % 2] : unshared[rng() % 6]);
+                codes[k].push_back(pick_level(rng));
+            }
+        }
+
+        batchhmm::BatchDecoder decoder(table.probs.data(), table.ln_probs.data(),
+                                       adios::EmissionTable::NOBS, transition);
+        batchhmm::Sequence seqs[batchhmm::LANES];
+        for (size_t k = 0; k < K; ++k) {
+            seqs[k] = batchhmm::Sequence{obs[k].data(), codes[k].data(), obs[k].size()};
+        }
+
+        long reps = std::max(1L, 2000000L / nobs);
+        for (bool use_posteriori : {false, true}) {
+            std::vector<int> single[batchhmm::LANES];
+            auto start = Clock::now();
+            for (long r = 0; r < reps; ++r) {
+                for (size_t k = 0; k < K; ++k) {
+                    GenotypeHMM hmm(obs[k], codes[k], table.probs.data(), adios::EmissionTable::NOBS,
+                                    transition, table.ln_probs.data());
+                    single[k] = hmm.decode(use_posteriori);
+                }
+            }
+            double single_time = seconds_since(start) / reps;
+
+            std::vector<int> batched[batchhmm::LANES];
+            start = Clock::now();
+            for (long r = 0; r < reps; ++r) { decoder.decode(seqs, K, use_posteriori, batched); }
+            double batch_time = seconds_since(start) / reps;
+
+            size_t differences = 0;
+            for (size_t k = 0; k < K; ++k) { differences += single[k] != batched[k]; }
+
+            std::cout << K << " x " << nobs << " observations, ";
+            std::cout << (use_posteriori ? "Viterbi: " : "forward-backward: ");
+            std::cout << "one at a time " << single_time * 1e6 << "us, ";
+            std::cout << "batched " << batch_time * 1e6 << "us ";
+            std::cout << "(" << single_time / batch_time << "x), ";
+            std::cout << differences << " differing pairs\n";
+        }
+    }
+
+    return 0;
+}
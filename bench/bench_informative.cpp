@@ -0,0 +1,90 @@
+// Microbenchmark for informative site classification: compares the sorted
+// list merge in find_informative_sites_unphased against the bit-packed
+// kernels over every pair of individuals on a whole chromosome.
+//
+// Usage: bench_informative file.vcf [chromosome index] [max pairs]
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vcf.hpp"
+#include "adios.hpp"
+#include "sitekernel.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(const Clock::time_point& start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " file.vcf [chromosome index] [max pairs]\n";
+        return 64;
+    }
+
+    int chromidx = argc > 2 ? atoi(argv[2]) : 0;
+    long maxpairs = argc > 3 ? atol(argv[3]) : 100000;
+
+    VCFParams vcfp = {true, true, true, "-"};
+    Dataset d = read_vcf(argv[1], vcfp);
+    d.pack();
+
+    adios::adios_parameters params;
+    params.rare_thresh = 0.05;
+    params.get_rare_sites(d);
+
+    auto chrom = d.chromosomes[chromidx];
+    std::cout << "Chromosome " << chrom->label << ": " << chrom->nmark() << " markers, ";
+    std::cout << params.rare_sites[chromidx].size() << " rare, ";
+    std::cout << d.ninds() << " individuals\n";
+
+    std::vector<std::pair<int, int>> pairs;
+    for (size_t i = 0; i < d.ninds() && (long)pairs.size() < maxpairs; ++i) {
+        for (size_t j = i + 1; j < d.ninds() && (long)pairs.size() < maxpairs; ++j) {
+            pairs.push_back(std::make_pair(i, j));
+        }
+    }
+
+    // Reference: the sorted-list merge
+    std::vector<adios::adios_sites> reference;
+    reference.reserve(pairs.size());
+    auto start = Clock::now();
+    for (auto& pr : pairs) {
+        reference.push_back(adios::find_informative_sites_unphased(d.individuals[pr.first],
+                                                                   d.individuals[pr.second],
+                                                                   chromidx,
+                                                                   params.rare_sites[chromidx]));
+    }
+    double list_time = seconds_since(start);
+    std::cout << "list merge: " << list_time << "s for " << pairs.size() << " pairs\n";
+
+    const sitekernel::Implementation impls[] = {
+        sitekernel::KERNEL_SCALAR, sitekernel::KERNEL_AVX2, sitekernel::KERNEL_AVX512
+    };
+    for (auto impl : impls) {
+        if (!sitekernel::is_available(impl)) {
+            std::cout << sitekernel::name(impl) << ": not supported on this CPU\n";
+            continue;
+        }
+
+        size_t mismatches = 0;
+        start = Clock::now();
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            auto res = adios::find_informative_sites_unphased_packed(d.individuals[pairs[i].first],
+                                                                     d.individuals[pairs[i].second],
+                                                                     chromidx,
+                                                                     params.rare_masks[chromidx],
+                                                                     AlleleSites(),
+                                                                     impl);
+            mismatches += (res.sites != reference[i].sites) || (res.states != reference[i].states);
+        }
+        double t = seconds_since(start);
+        std::cout << sitekernel::name(impl) << ": " << t << "s ";
+        std::cout << "(" << list_time / t << "x), " << mismatches << " mismatched pairs\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Microbenchmark for Viterbi decoding: compares GenotypeHMM::viterbi against
+// the previous implementation, which kept a full copy of the best path for
+// every state, on simulated pairs with adios' own transition and emission
+// matrices.
+//
+// Usage: bench_viterbi [observation lengths...]
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "adios.hpp"
+#include "HiddenMarkov.hpp"
+
+typedef std::chrono::steady_clock Clock;
+using Linalg::Matrix;
+using Linalg::Vector;
+
+static double seconds_since(const Clock::time_point& start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The path-copying decoder that GenotypeHMM::viterbi used to be
+static std::vector<int> reference_viterbi(const std::vector<int>& observations,
+                                          const std::vector<Matrix*>& emission_matrices,
+                                          const Matrix& transition_matrix)
+{
+    using std::log;
+    int nobs = observations.size();
+    int nstates = transition_matrix.nrow;
+
+    Linalg::Vector log_probs(nstates);
+
+    Linalg::Vector starts(nstates);
+    for (size_t i = 0; i < starts.size; ++i) { starts.set(i, i); }
+
+    std::vector<int> outp(nobs);
+
+    Matrix ln_transition_matrix = transition_matrix.apply(&log);
+
+    Matrix paths = Linalg::Matrix(nstates, nobs + 1);
+    paths = 0;
+    paths.set_column(0, starts);
+
+    for (int obsidx = 0; obsidx < nobs; ++obsidx) {
+        auto obs = observations[obsidx];
+
+        Linalg::Vector new_log_probs(nstates);
+        for (int state = 0; state < nstates; ++state) {
+            Linalg::Vector temp_prob(nstates);
+
+            temp_prob = (log_probs +
+                         log(emission_matrices[obsidx]->get(obs, state)) +
+                         ln_transition_matrix.col_view(state));
+
+            auto best = temp_prob.argmax();
+            auto best_path = paths.row_view(best);
+            paths.set_row(state, best_path);
+            paths.set(state, obsidx + 1, state);
+            new_log_probs.data[state] = temp_prob.get(best);
+        }
+        log_probs = new_log_probs;
+    }
+
+    int best_final_state = log_probs.argmax();
+    Linalg::Vector hidden_states = paths.get_row(best_final_state);
+    for (size_t i = 1; i < hidden_states.size; ++i) {
+        outp[i-1] = (int)hidden_states.get(i);
+    }
+    return outp;
+}
+
+int main(int argc, char** argv) {
+    std::vector<long> lengths;
+    for (int i = 1; i < argc; ++i) { lengths.push_back(atol(argv[i])); }
+    if (lengths.empty()) { lengths = {100, 1000, 10000, 50000}; }
+
+    // Emission matrices for a spread of rare frequencies
+    Matrix single_error = adios::unphased_genotype_error_matrix(0.001);
+    Matrix err = Linalg::kronecker_product(single_error, single_error);
+    std::vector<double> levels;
+    std::vector<Matrix> mats;
+    for (double q = 0.001; q < 0.05; q += 0.001) {
+        levels.push_back(q);
+        mats.push_back(Linalg::matrix_product(err, adios::unphased_emission_matrix(q)));
+    }
+    adios::EmissionTable table(levels, err);
+    Matrix transition = adios::unphased_transition_matrix(4, 3);
+
+    // Informative observations are mostly opposite homozygotes and rare
+    // variants carried by one individual, with runs of sharing (IBD)
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick_matrix(0, mats.size() - 1);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    const int unshared[] = {1, 2, 3, 5, 6, 7};
+    const int shared[] = {4, 8};
+
+    for (long nobs : lengths) {
+        std::vector<int> obs(nobs);
+        std::vector<Matrix*> emissions(nobs);
+        std::vector<uint32_t> codes(nobs);
+        bool ibd = false;
+        for (long i = 0; i < nobs; ++i) {
+            if (unif(rng) < 0.002) { ibd = !ibd; }
+            obs[i] = ibd ? shared[rng() % 2] : unshared[rng() % 6];
+            int m = pick_matrix(rng);
+            emissions[i] = &mats[m];
+            codes[i] = m;
+        }
+
+        // Keep the total work per length roughly constant, but the old
+        // decoder is quadratic so it gets fewer repetitions
+        long reps = std::max(1L, 2000000L / nobs);
+        long ref_reps = std::max(1L, std::min(reps, 200000000L / (nobs * nobs)));
+
+        GenotypeHMM hmm(obs, codes, table.probs.data(), adios::EmissionTable::NOBS,
+                        transition, table.ln_probs.data());
+
+        std::vector<int> ref;
+        auto start = Clock::now();
+        for (long r = 0; r < ref_reps; ++r) { ref = reference_viterbi(obs, emissions, transition); }
+        double ref_time = seconds_since(start) / ref_reps;
+
+        std::vector<int> res;
+        start = Clock::now();
+        for (long r = 0; r < reps; ++r) { res = hmm.viterbi(); }
+        double new_time = seconds_since(start) / reps;
+
+        size_t differences = 0;
+        for (long i = 0; i < nobs; ++i) { differences += ref[i] != res[i]; }
+
+        std::cout << nobs << " observations: ";
+        std::cout << "path copying " << ref_time * 1e6 << "us, ";
+        std::cout << "backpointers " << new_time * 1e6 << "us ";
+        std::cout << "(" << ref_time / new_time << "x), ";
+        std::cout << differences << " differing states\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include "bgzf.hpp"
+
+#ifdef HAVE_ZLIB
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+// Fixed part of a block header: gzip magic, CM, FLG, MTIME, XFL, OS, XLEN
+static const size_t BLOCK_HEADER_SIZE = 12;
+// CRC32 and ISIZE
+static const size_t BLOCK_TRAILER_SIZE = 8;
+// Blocks inflated by one job. Blocks hold at most 64KB, so a job is at most
+// 4MB of text.
+static const size_t BLOCKS_PER_JOB = 64;
+
+static inline uint32_t le16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+
+static inline uint32_t le32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline bool is_block_header(const unsigned char* h)
+{
+    return h[0] == 31 && h[1] == 139 && h[2] == 8 && (h[3] & 4);
+}
+
+// Total size of a block from the BC subfield of its extra field, or 0 if
+// there isn't one
+static size_t block_size(const unsigned char* extra, size_t xlen)
+{
+    size_t pos = 0;
+    while (pos + 4 <= xlen) {
+        size_t slen = le16(extra + pos + 2);
+        if (extra[pos] == 'B' && extra[pos + 1] == 'C' && slen == 2 && pos + 6 <= xlen) {
+            return le16(extra + pos + 4) + 1;
+        }
+        pos += 4 + slen;
+    }
+    return 0;
+}
+
+// Appends the next whole block in f to raw. Returns false at the end of
+// the file.
+static bool read_block(FILE* f, std::string& raw)
+{
+    unsigned char h[BLOCK_HEADER_SIZE];
+    size_t n = fread(h, 1, sizeof(h), f);
+    if (n == 0 && feof(f)) { return false; }
+    if (n != sizeof(h)) { throw std::runtime_error("Truncated BGZF block"); }
+    if (!is_block_header(h)) { throw std::runtime_error("Not a BGZF block"); }
+
+    size_t xlen = le16(h + 10);
+    size_t start = raw.size();
+    raw.append((const char*)h, sizeof(h));
+    raw.resize(start + sizeof(h) + xlen);
+    if (fread(&raw[start + sizeof(h)], 1, xlen, f) != xlen) {
+        throw std::runtime_error("Truncated BGZF block");
+    }
+
+    size_t bsize = block_size((const unsigned char*)raw.data() + start + sizeof(h), xlen);
+    if (bsize < sizeof(h) + xlen + BLOCK_TRAILER_SIZE) {
+        throw std::runtime_error("Not a BGZF block");
+    }
+
+    size_t rest = bsize - sizeof(h) - xlen;
+    raw.resize(start + bsize);
+    if (fread(&raw[start + bsize - rest], 1, rest, f) != rest) {
+        throw std::runtime_error("Truncated BGZF block");
+    }
+    return true;
+}
+
+// Inflates a run of whole blocks from read_block onto the end of out.
+// Returns where the last block starts in out.
+static size_t inflate_blocks(const std::string& raw, std::string& out)
+{
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = Z_NULL;
+    zs.avail_in = 0;
+    if (inflateInit2(&zs, -15) != Z_OK) { throw std::runtime_error("Couldn't initialize zlib"); }
+
+    const unsigned char* p = (const unsigned char*)raw.data();
+    const unsigned char* end = p + raw.size();
+    size_t last_block = out.size();
+    try {
+        while (p < end) {
+            size_t xlen = le16(p + 10);
+            size_t bsize = block_size(p + BLOCK_HEADER_SIZE, xlen);
+            const unsigned char* trailer = p + bsize - BLOCK_TRAILER_SIZE;
+            uint32_t crc = le32(trailer);
+            uint32_t isize = le32(trailer + 4);
+
+            size_t offset = out.size();
+            last_block = offset;
+            out.resize(offset + isize);
+            Bytef* dest = (Bytef*)&out[0] + offset;
+
+            inflateReset(&zs);
+            zs.next_in = (Bytef*)p + BLOCK_HEADER_SIZE + xlen;
+            zs.avail_in = trailer - zs.next_in;
+            zs.next_out = dest;
+            zs.avail_out = isize;
+            int res = inflate(&zs, Z_FINISH);
+            if (res != Z_STREAM_END || zs.total_out != isize) {
+                throw std::runtime_error("Corrupt BGZF block");
+            }
+            if (crc32(crc32(0L, Z_NULL, 0), dest, isize) != crc) {
+                throw std::runtime_error("BGZF block failed CRC check");
+            }
+            p += bsize;
+        }
+    } catch (...) {
+        inflateEnd(&zs);
+        throw;
+    }
+    inflateEnd(&zs);
+    return last_block;
+}
+
+BGZFFile::BGZFFile(int n)
+    : f(NULL), raw_eof(false), nthreads(n), ranged(false), range_idx(0), in_range(false),
+      bufpos(0), stopping(false) {}
+
+BGZFFile::~BGZFFile(void)
+{
+    stop();
+    if (f) { fclose(f); }
+}
+
+bool BGZFFile::is_bgzf(const std::string& filename)
+{
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp) { return false; }
+
+    unsigned char h[BLOCK_HEADER_SIZE];
+    bool ok = fread(h, 1, sizeof(h), fp) == sizeof(h) && is_block_header(h);
+    if (ok) {
+        size_t xlen = le16(h + 10);
+        std::vector<unsigned char> extra(xlen);
+        ok = fread(extra.data(), 1, xlen, fp) == xlen && block_size(extra.data(), xlen) > 0;
+    }
+    fclose(fp);
+    return ok;
+}
+
+void BGZFFile::openfile(const std::string& fn, bool write)
+{
+    if (write) { throw std::invalid_argument("BGZF files are read only: " + fn); }
+
+    filename = fn;
+    f = fopen(filename.c_str(), "rb");
+    if (!f) { throw std::invalid_argument("Couldn't open file: " + filename); }
+
+    raw_eof = false;
+    range_idx = 0;
+    in_range = false;
+    buf.clear();
+    bufpos = 0;
+    stopping = false;
+    if (nthreads > 1) {
+        for (int i = 0; i < nthreads; ++i) {
+            workers.push_back(std::thread(&BGZFFile::work, this));
+        }
+    }
+}
+
+void BGZFFile::closefile(void)
+{
+    stop();
+    if (!f) { return; }
+    int r = fclose(f);
+    f = NULL;
+    if (r != 0) { throw std::runtime_error("Couldn't close file: " + filename); }
+}
+
+bool BGZFFile::eof(void)
+{
+    while (bufpos == buf.size()) {
+        if (!read_chunk(buf)) { return true; }
+        bufpos = 0;
+    }
+    return false;
+}
+
+bool BGZFFile::good(void) { return !eof(); }
+
+std::string BGZFFile::getline(void)
+{
+    std::string line;
+    while (true) {
+        const char* start = buf.data() + bufpos;
+        size_t avail = buf.size() - bufpos;
+        const char* nl = (const char*)memchr(start, '\n', avail);
+        if (nl) {
+            line.append(start, nl - start);
+            bufpos += nl - start + 1;
+            return line;
+        }
+
+        line.append(start, avail);
+        bufpos = buf.size();
+        if (!read_chunk(buf)) { return line; }
+        bufpos = 0;
+    }
+}
+
+void BGZFFile::set_ranges(const std::vector<std::pair<uint64_t, uint64_t> >& r)
+{
+    ranged = true;
+    ranges = r;
+}
+
+size_t BGZFFile::read(char* out, size_t n)
+{
+    size_t got = 0;
+    while (got < n) {
+        if (bufpos == buf.size()) {
+            if (!read_chunk(buf)) { break; }
+            bufpos = 0;
+            continue;
+        }
+        size_t take = std::min(n - got, buf.size() - bufpos);
+        memcpy(out + got, buf.data() + bufpos, take);
+        got += take;
+        bufpos += take;
+    }
+    return got;
+}
+
+bool BGZFFile::read_blocks(Job& job)
+{
+    job.raw.clear();
+    job.skip = 0;
+    job.trim = false;
+    job.keep = 0;
+
+    for (size_t i = 0; !raw_eof && i < BLOCKS_PER_JOB; ++i) {
+        if (!ranged) {
+            if (!read_block(f, job.raw)) { raw_eof = true; }
+            continue;
+        }
+
+        if (range_idx == ranges.size()) {
+            raw_eof = true;
+            break;
+        }
+
+        uint64_t begin = ranges[range_idx].first;
+        uint64_t end = ranges[range_idx].second;
+        if (!in_range) {
+            // A job's trimming only covers one range
+            if (!job.raw.empty()) { break; }
+            if (fseeko(f, begin >> 16, SEEK_SET)) {
+                throw std::runtime_error("Couldn't seek in " + filename);
+            }
+            job.skip = begin & 0xffff;
+            in_range = true;
+        }
+
+        uint64_t here = ftello(f);
+        uint64_t end_block = end >> 16;
+        size_t end_offset = end & 0xffff;
+        if (here > end_block || (here == end_block && end_offset == 0)) {
+            in_range = false;
+            range_idx++;
+            if (!job.raw.empty()) { break; }
+            continue;
+        }
+
+        if (!read_block(f, job.raw)) {
+            raw_eof = true;
+            break;
+        }
+        if (here == end_block) {
+            job.trim = true;
+            job.keep = end_offset;
+            in_range = false;
+            range_idx++;
+            break;
+        }
+    }
+    return !job.raw.empty();
+}
+
+void BGZFFile::inflate_job(Job& job)
+{
+    job.out.clear();
+    size_t last_block = inflate_blocks(job.raw, job.out);
+    if (job.trim && last_block + job.keep < job.out.size()) {
+        job.out.resize(last_block + job.keep);
+    }
+    job.out.erase(0, std::min(job.skip, job.out.size()));
+}
+
+bool BGZFFile::read_chunk(std::string& out)
+{
+    if (workers.empty()) {
+        Job job;
+        if (!read_blocks(job)) { return false; }
+        job.out.swap(out);
+        inflate_job(job);
+        out.swap(job.out);
+        return true;
+    }
+
+    fill_pipeline();
+    if (inflight.empty()) { return false; }
+
+    std::shared_ptr<Job> job = inflight.front();
+    inflight.pop_front();
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        job_done.wait(lock, [&job]() { return job->done; });
+    }
+    if (!job->error.empty()) { throw std::runtime_error(job->error + ": " + filename); }
+
+    out.swap(job->out);
+    fill_pipeline();
+    return true;
+}
+
+// Keep two jobs per thread queued or inflating
+void BGZFFile::fill_pipeline(void)
+{
+    while (inflight.size() < 2 * workers.size()) {
+        std::shared_ptr<Job> job(new Job);
+        job->done = false;
+        if (!read_blocks(*job)) { break; }
+
+        inflight.push_back(job);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            todo.push_back(job);
+        }
+        work_ready.notify_one();
+    }
+}
+
+void BGZFFile::work(void)
+{
+    while (true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            work_ready.wait(lock, [this]() { return stopping || !todo.empty(); });
+            if (stopping) { return; }
+            job = todo.front();
+            todo.pop_front();
+        }
+
+        try {
+            inflate_job(*job);
+        } catch (const std::exception& e) {
+            job->error = e.what();
+        }
+        std::string().swap(job->raw);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            job->done = true;
+        }
+        job_done.notify_all();
+    }
+}
+
+void BGZFFile::stop(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (std::thread& t : workers) { t.join(); }
+    workers.clear();
+    todo.clear();
+    inflight.clear();
+}
+
+#endif
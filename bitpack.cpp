@@ -0,0 +1,30 @@
+#include "bitpack.hpp"
+
+namespace bitpack {
+
+    PackedSites pack(const vector<int>& sites, size_t nbits) {
+        PackedSites outp(nwords(nbits), 0);
+        for (int s : sites) { set(outp, s); }
+        return outp;
+    }
+
+    vector<int> unpack(const PackedSites& bits) {
+        vector<int> outp;
+        outp.reserve(count(bits));
+        for (size_t w = 0; w < bits.size(); ++w) {
+            uint64_t word = bits[w];
+            while (word) {
+                outp.push_back(64 * w + ctz(word));
+                word &= word - 1;
+            }
+        }
+        return outp;
+    }
+
+    size_t count(const PackedSites& bits) {
+        size_t tot = 0;
+        for (uint64_t w : bits) { tot += popcount(w); }
+        return tot;
+    }
+
+}
@@ -2,14 +2,28 @@
 
 namespace combinatorics {
 
+uint128 nCk_exact(long n, long k) {
+    if (k < 0 || k > n) return 0;
+    if (k > n - k) k = n - k;
+
+    // After step i, out is C(n - k + i, i), so each division is exact.
+    uint128 out = 1;
+    for (long i = 1; i <= k; ++i) {
+        out = out * (uint128)(n - k + i) / (uint128)i;
+    }
+    return out;
+}
+
 long nCk(long n, long k) {
-    double out = 1;
-    while (k > 0) {
-        out *= n/((double)k); // int division will give wrong answers
-        --n;
-        --k;
-    } 
-    return (long)out; // result is always an int
+    return (long)nCk_exact(n, k);
+}
+
+uint64_t isqrt(uint128 x) {
+    // Floating point gets us within a few units, then fix it up exactly
+    uint64_t r = (uint64_t)sqrtl((long double)x);
+    while ((uint128)r * r > x) r--;
+    while ((uint128)(r + 1) * (r + 1) <= x) r++;
+    return r;
 }
 
 long largestV(long a, long b, long x) {
@@ -19,7 +33,23 @@ long largestV(long a, long b, long x) {
     return v;
 }
 
+pair<long, long> pair_at_index(long idx, long n) {
+    // Same construction as combination_at_index: count back from the last
+    // pair, find the largest v with C(v, 2) <= x, then the remainder gives
+    // the second item.
+    uint128 x = nCk_exact(n, 2) - idx - 1;
+    long v = (1 + isqrt(1 + 8 * x)) / 2;
+    while ((uint128)v * (v - 1) / 2 > x) v--;
+    long rem = x - (uint128)v * (v - 1) / 2;
+    return std::make_pair(n - 1 - v, n - 1 - rem);
+}
+
 std::vector<long> combination_at_index(long i, long n, long k) {
+    if (k == 2) {
+        pair<long, long> pr = pair_at_index(i, n);
+        return {pr.first, pr.second};
+    }
+
     std::vector<long> pos(k);    
 
     long a = n;
@@ -38,4 +68,29 @@ std::vector<long> combination_at_index(long i, long n, long k) {
     return pos;
 }
 
-}
\ No newline at end of file
+long PairBlock::npairs(void) const {
+    long n = 0;
+    for (long i = i_start; i < i_stop; ++i) {
+        long first = j_start > i ? j_start : i + 1;
+        if (first < j_stop) n += j_stop - first;
+    }
+    return n;
+}
+
+std::vector<PairBlock> pair_blocks(long n, long blocksize) {
+    std::vector<PairBlock> blocks;
+    if (blocksize < 1) blocksize = 1;
+
+    for (long i = 0; i < n; i += blocksize) {
+        long i_stop = (i + blocksize < n) ? i + blocksize : n;
+        for (long j = i; j < n; j += blocksize) {
+            long j_stop = (j + blocksize < n) ? j + blocksize : n;
+            PairBlock b = {i, i_stop, j, j_stop};
+            if (b.npairs() > 0) blocks.push_back(b);
+        }
+    }
+
+    return blocks;
+}
+
+}
@@ -0,0 +1,333 @@
+#include "datacache.hpp"
+
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace datacache {
+
+static const char MAGIC[8] = {'A', 'D', 'I', 'O', 'S', 'A', 'D', 'B'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const size_t HEADER_SIZE = 32;
+
+// Where an array sits in the file
+struct ArrayRef {
+    uint64_t offset;
+    uint64_t count;
+};
+
+template <typename T>
+static inline void put(std::string& buf, const T& v) {
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+static inline void put_string(std::string& buf, const std::string& s) {
+    put(buf, (uint32_t)s.size());
+    buf.append(s);
+}
+
+// Appends arrays to a file, keeping track of where each one went
+class Writer {
+public:
+    Writer(const std::string& fn) : filename(fn), pos(0) {
+        f = fopen(filename.c_str(), "wb");
+        if (!f) { throw std::runtime_error("Couldn't open file for writing: " + filename); }
+    }
+
+    ~Writer(void) {
+        if (f) { fclose(f); }
+    }
+
+    void write(const void* p, size_t n) {
+        if (n && fwrite(p, 1, n, f) != n) { fail(); }
+        pos += n;
+    }
+
+    template <typename T> ArrayRef array(const std::vector<T>& v) {
+        static const char zeros[8] = {0};
+        write(zeros, (8 - pos % 8) % 8);
+        ArrayRef r = {pos, v.size()};
+        write(v.data(), v.size() * sizeof(T));
+        return r;
+    }
+
+    void rewind(void) {
+        if (fseek(f, 0, SEEK_SET)) { fail(); }
+    }
+
+    void close(void) {
+        int err = fclose(f);
+        f = NULL;
+        if (err) { fail(); }
+    }
+
+    uint64_t tell(void) const { return pos; }
+
+private:
+    Writer(const Writer&);
+    Writer& operator=(const Writer&);
+
+    FILE* f;
+    std::string filename;
+    uint64_t pos;
+
+    void fail(void) { throw std::runtime_error("Error writing file: " + filename); }
+};
+
+static inline void put_ref(std::string& buf, const ArrayRef& r) {
+    put(buf, r.offset);
+    put(buf, r.count);
+}
+
+static std::string header(uint64_t directory_offset, uint64_t file_size)
+{
+    std::string buf(MAGIC, sizeof(MAGIC));
+    put(buf, VERSION);
+    put(buf, BYTE_ORDER_MARK);
+    put(buf, directory_offset);
+    put(buf, file_size);
+    return buf;
+}
+
+void save(const std::string& filename, const Dataset& data, const Source& source)
+{
+    std::string tmpname = filename + ".tmp";
+    try {
+        Writer w(tmpname);
+        w.write(header(0, 0).data(), HEADER_SIZE);
+
+        std::string dir;
+        put_string(dir, source.filename);
+        put(dir, (uint8_t)source.params.drop_singletons);
+        put(dir, (uint8_t)source.params.drop_monomorphs);
+        put(dir, (uint8_t)source.params.empirical_freqs);
+        put_string(dir, source.params.freq_field);
+
+        put(dir, (uint32_t)data.nchrom());
+        for (const auto& c : data.chromosomes) {
+            put_string(dir, c->label);
+            put_ref(dir, w.array(c->positions));
+            put_ref(dir, w.array(c->frequencies));
+
+            // Variant labels, end to end, and where each one starts
+            std::vector<char> labels;
+            std::vector<uint64_t> starts(1, 0);
+            for (const Variant& v : c->variants) {
+                labels.insert(labels.end(), v.label.begin(), v.label.end());
+                starts.push_back(labels.size());
+            }
+            put_ref(dir, w.array(starts));
+            put_ref(dir, w.array(labels));
+
+            put(dir, (uint64_t)c->malformed_genotypes);
+            put(dir, (uint32_t)c->exclusions.size());
+            for (const auto& kv : c->exclusions) {
+                put_string(dir, kv.first);
+                put(dir, (uint64_t)kv.second);
+            }
+        }
+
+        put(dir, (uint64_t)data.ninds());
+        for (const Individual& ind : data.individuals) {
+            put_string(dir, ind.label);
+            for (const Genotypes& g : ind.chromosomes) {
+                put_ref(dir, w.array(g.hapa));
+                put_ref(dir, w.array(g.hapb));
+                put_ref(dir, w.array(g.missing));
+            }
+        }
+
+        uint64_t directory_offset = w.tell();
+        w.write(dir.data(), dir.size());
+        uint64_t file_size = w.tell();
+
+        w.rewind();
+        w.write(header(directory_offset, file_size).data(), HEADER_SIZE);
+        w.close();
+    } catch (...) {
+        remove(tmpname.c_str());
+        throw;
+    }
+
+    if (rename(tmpname.c_str(), filename.c_str())) {
+        remove(tmpname.c_str());
+        throw std::runtime_error("Couldn't write file: " + filename);
+    }
+}
+
+// A read-only mapping of a whole file
+class MappedFile {
+public:
+    const char* data;
+    size_t size;
+
+    MappedFile(const std::string& filename) : data(NULL), size(0) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) { throw std::invalid_argument("Couldn't open file: " + filename); }
+
+        struct stat st;
+        if (fstat(fd, &st) || st.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("Not an adios cache file: " + filename);
+        }
+        size = st.st_size;
+
+        void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) { throw std::runtime_error("Couldn't map file: " + filename); }
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(p);
+    }
+
+    ~MappedFile(void) {
+        munmap(const_cast<char*>(data), size);
+    }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+// Reads the directory, and checks that the arrays it points to are inside
+// the array section before copying them out
+class Cursor {
+public:
+    Cursor(const MappedFile& m, uint64_t begin, const std::string& fn)
+        : file(m), filename(fn), pos(begin), arrays_end(begin) {}
+
+    template <typename T> T get(void) {
+        T v;
+        need(sizeof(T));
+        memcpy(&v, file.data + pos, sizeof(T));
+        pos += sizeof(T);
+        return v;
+    }
+
+    std::string get_string(void) {
+        uint32_t len = get<uint32_t>();
+        need(len);
+        std::string s(file.data + pos, len);
+        pos += len;
+        return s;
+    }
+
+    template <typename T> void get_array(std::vector<T>& out) {
+        uint64_t offset = get<uint64_t>();
+        uint64_t count = get<uint64_t>();
+        if (offset < HEADER_SIZE || offset > arrays_end || offset % 8 ||
+            count > (arrays_end - offset) / sizeof(T)) {
+            corrupt();
+        }
+        const T* first = reinterpret_cast<const T*>(file.data + offset);
+        out.assign(first, first + count);
+    }
+
+    void corrupt(void) { throw std::runtime_error("Corrupt cache file: " + filename); }
+
+private:
+    const MappedFile& file;
+    const std::string& filename;
+    uint64_t pos;
+    uint64_t arrays_end;
+
+    void need(size_t n) {
+        if (file.size - pos < n) { corrupt(); }
+    }
+};
+
+// Genotype lists are sorted marker indices
+static void check_sites(const AlleleSites& sites, size_t nmark, Cursor& c)
+{
+    if (!sites.empty() && (sites.front() < 0 || (size_t)sites.back() >= nmark)) { c.corrupt(); }
+}
+
+Dataset load(const std::string& filename, Source& source)
+{
+    MappedFile m(filename);
+
+    if (m.size < HEADER_SIZE || memcmp(m.data, MAGIC, sizeof(MAGIC))) {
+        throw std::runtime_error("Not an adios cache file: " + filename);
+    }
+    uint32_t version, byte_order;
+    uint64_t directory_offset, file_size;
+    memcpy(&version, m.data + 8, sizeof(version));
+    memcpy(&byte_order, m.data + 12, sizeof(byte_order));
+    memcpy(&directory_offset, m.data + 16, sizeof(directory_offset));
+    memcpy(&file_size, m.data + 24, sizeof(file_size));
+    if (version != VERSION || byte_order != BYTE_ORDER_MARK) {
+        throw std::runtime_error("Unsupported cache file version: " + filename);
+    }
+    if (file_size != m.size || directory_offset < HEADER_SIZE || directory_offset > file_size) {
+        throw std::runtime_error("Corrupt cache file: " + filename);
+    }
+
+    Cursor c(m, directory_offset, filename);
+    source.filename = c.get_string();
+    source.params.drop_singletons = c.get<uint8_t>();
+    source.params.drop_monomorphs = c.get<uint8_t>();
+    source.params.empirical_freqs = c.get<uint8_t>();
+    source.params.freq_field = c.get_string();
+
+    Dataset data;
+    uint32_t nchrom = c.get<uint32_t>();
+    for (uint32_t chromidx = 0; chromidx < nchrom; ++chromidx) {
+        data.add_chromosome(c.get_string());
+        ChromInfo& info = *data.chromosomes.back();
+        c.get_array(info.positions);
+        c.get_array(info.frequencies);
+
+        std::vector<uint64_t> starts;
+        std::vector<char> labels;
+        c.get_array(starts);
+        c.get_array(labels);
+        size_t nmark = info.positions.size();
+        if (info.frequencies.size() != nmark || starts.size() != nmark + 1 ||
+            starts.back() != labels.size()) {
+            c.corrupt();
+        }
+
+        info.variants.reserve(nmark);
+        for (size_t i = 0; i < nmark; ++i) {
+            if (starts[i] > starts[i + 1]) { c.corrupt(); }
+            std::string label(labels.data() + starts[i], starts[i + 1] - starts[i]);
+            info.variants.push_back(Variant(label, info.positions[i], info.frequencies[i]));
+        }
+
+        info.malformed_genotypes = c.get<uint64_t>();
+        uint32_t nexcl = c.get<uint32_t>();
+        for (uint32_t i = 0; i < nexcl; ++i) {
+            std::string reason = c.get_string();
+            info.exclusions[reason] = c.get<uint64_t>();
+        }
+    }
+
+    uint64_t ninds = c.get<uint64_t>();
+    // Each individual takes at least a label length and three array refs
+    // per chromosome, so a corrupt count can't make us allocate wildly
+    if (ninds > (m.size - directory_offset) / (4 + 48 * (uint64_t)nchrom)) { c.corrupt(); }
+    data.individuals.reserve(ninds);
+    for (uint64_t i = 0; i < ninds; ++i) {
+        data.add_individual(c.get_string());
+        Individual& ind = data.individuals.back();
+        ind.get_empty_chromosomes(data);
+        for (uint32_t chromidx = 0; chromidx < nchrom; ++chromidx) {
+            Genotypes& g = ind.chromosomes[chromidx];
+            size_t nmark = g.info->nmark();
+            c.get_array(g.hapa);
+            c.get_array(g.hapb);
+            c.get_array(g.missing);
+            check_sites(g.hapa, nmark, c);
+            check_sites(g.hapb, nmark, c);
+            check_sites(g.missing, nmark, c);
+        }
+    }
+
+    data.finalize();
+    return data;
+}
+
+}
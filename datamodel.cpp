@@ -16,6 +16,18 @@ void ChromInfo::add_variant(const std::string& lab, int bp, double maf) {
     variants.push_back(v);
 }
 
+void ChromInfo::encode_frequencies(void) {
+    freq_levels = frequencies;
+    std::sort(freq_levels.begin(), freq_levels.end());
+    freq_levels.erase(std::unique(freq_levels.begin(), freq_levels.end()), freq_levels.end());
+
+    freq_codes.resize(frequencies.size());
+    for (size_t i = 0; i < frequencies.size(); ++i) {
+        auto it = std::lower_bound(freq_levels.begin(), freq_levels.end(), frequencies[i]);
+        freq_codes[i] = it - freq_levels.begin();
+    }
+}
+
 size_t ChromInfo::nmark(void) const {
     return positions.size();
 }
@@ -28,10 +40,12 @@ int ChromInfo::size(void) const {
 
 ChromInfo::ChromInfo(void) {
     label.assign("");
+    malformed_genotypes = 0;
 }
 
 ChromInfo::ChromInfo(const std::string& lab) {
     label.assign(lab);
+    malformed_genotypes = 0;
 }
 
 
@@ -72,6 +86,14 @@ void Genotypes::finalize(void) {
     hma = has_minor_allele();
 }
 
+void Genotypes::pack(void) {
+    size_t nmark = info->nmark();
+    packed_a = bitpack::pack(hapa, nmark);
+    packed_b = bitpack::pack(hapb, nmark);
+    packed_missing = bitpack::pack(missing, nmark);
+    packed = true;
+}
+
 std::vector<int> Genotypes::dosages(void) {
     std::vector<int> outp(info->nmark());
 
@@ -83,6 +105,7 @@ std::vector<int> Genotypes::dosages(void) {
 }
 Genotypes::Genotypes(shared_ptr<ChromInfo> c) {
     info = c;
+    packed = false;
 }
 
 // Individual
@@ -119,6 +142,10 @@ void Individual::finalize(void) {
     }
 }
 
+void Individual::pack(void) {
+    for (auto& gt : chromosomes) { gt.pack(); }
+}
+
 // Dataset
 
 size_t Dataset::ninds(void) const {
@@ -169,6 +196,7 @@ void Dataset::round_frequencies(unsigned int places) {
             c->frequencies[i] = round(c->frequencies[i], places);
         }
     }
+    encode_frequencies();
 }
 
 void Dataset::floor_frequencies(double floor) {
@@ -178,21 +206,127 @@ void Dataset::floor_frequencies(double floor) {
             c->frequencies[i] = fq < floor ? floor : fq;
         }
     }
+    encode_frequencies();
+}
+
+void Dataset::encode_frequencies(void) {
+    for (auto c : chromosomes) { c->encode_frequencies(); }
 }
 
 void Dataset::finalize(void) {
     for (Individual& ind : individuals) {
         ind.finalize();
     }
+    encode_frequencies();
+    if (!carriers.empty()) { index_carriers(carrier_thresh, carrier_budget); }
+}
+
+void Dataset::pack(void) {
+    for (Individual& ind : individuals) {
+        ind.pack();
+    }
+}
+
+void Dataset::index_carriers(double rare_thresh, size_t max_bytes) {
+    carrier_thresh = rare_thresh;
+    carrier_budget = max_bytes;
+    carriers.clear();
+
+    size_t used = 0;
+    for (size_t chridx = 0; chridx < nchrom(); ++chridx) {
+        const ChromInfo& c = *chromosomes[chridx];
+        AlleleSites rares;
+        for (size_t markidx = 0; markidx < c.nmark(); ++markidx) {
+            if (c.frequencies[markidx] < rare_thresh) { rares.push_back(markidx); }
+        }
+
+        size_t left = used < max_bytes ? max_bytes - used : 0;
+        carriers.push_back(carrier_index(*this, chridx, rares, left));
+        used += carriers.back().bytes();
+    }
+}
+
+Dataset::Dataset(void) {
+    carrier_thresh = 0;
+    carrier_budget = 0;
 }
 
 void Dataset::subset(std::set<std::string> indlabs) {
     std::vector<Individual> newinds; 
+    std::vector<int> newidx(individuals.size(), -1);
 
     for (int i = 0; i < individuals.size(); ++i) {
-        if (indlabs.count(individuals[i].label) != 0) newinds.push_back(individuals[i]); 
+        if (indlabs.count(individuals[i].label) != 0) {
+            newidx[i] = newinds.size();
+            newinds.push_back(individuals[i]); 
+        }
     }
     individuals = newinds;
+
+    // Carriers are stored by individual index, which has just changed.
+    // Individuals keep their order, so carriers stay sorted.
+    for (CarrierIndex& c : carriers) {
+        size_t kept = 0;
+        for (size_t k = 0; k < c.nsites(); ++k) {
+            uint32_t first = c.offsets[k];
+            c.offsets[k] = kept;
+            for (uint32_t x = first; x < c.offsets[k + 1]; ++x) {
+                int i = newidx[c.carriers[x]];
+                if (i >= 0) { c.carriers[kept++] = i; }
+            }
+        }
+        if (!c.offsets.empty()) { c.offsets.back() = kept; }
+        c.carriers.resize(kept);
+    }
+}
+
+// CarrierIndex
+
+CarrierIndex::CarrierIndex(void) {
+    built = false;
+}
+
+size_t CarrierIndex::bytes(void) const {
+    return sizeof(int) * (sites.size() + carriers.size()) + sizeof(uint32_t) * offsets.size();
+}
+
+CarrierIndex carrier_index(const Dataset& d, size_t chromidx, const AlleleSites& sites,
+                           size_t max_bytes) {
+    CarrierIndex index;
+    size_t nsites = sites.size();
+    size_t nmark = d.chromosomes[chromidx]->nmark();
+
+    // Where each marker is in the site list, if it's there
+    std::vector<int> rank(nmark, -1);
+    for (size_t k = 0; k < nsites; ++k) { rank[sites[k]] = k; }
+
+    // Count carriers first, so the budget can be checked before anything
+    // big is allocated
+    std::vector<uint32_t> counts(nsites + 1, 0);
+    for (const Individual& ind : d.individuals) {
+        for (int m : ind.chromosomes[chromidx].hma) {
+            if (rank[m] >= 0) { counts[rank[m] + 1]++; }
+        }
+    }
+    for (size_t k = 0; k < nsites; ++k) { counts[k + 1] += counts[k]; }
+
+    size_t needed = sizeof(int) * (nsites + counts.back()) + sizeof(uint32_t) * counts.size();
+    if (needed > max_bytes) { return index; }
+
+    index.sites = sites;
+    index.offsets = counts;
+    index.carriers.resize(counts.back());
+
+    // Individuals are visited in order, so each site's carriers come out
+    // sorted
+    for (size_t indidx = 0; indidx < d.ninds(); ++indidx) {
+        for (int m : d.individuals[indidx].chromosomes[chromidx].hma) {
+            if (rank[m] >= 0) { index.carriers[counts[rank[m]]++] = indidx; }
+        }
+    }
+
+    index.built = true;
+    return index;
 }
 
 void copy_genospan(const Individual& from, int hapfrom, 
@@ -251,6 +385,9 @@ void copy_genospan(const Individual& from, int hapfrom,
     } else {
         to.chromosomes[chromidx].hapa = newchrom;
     }
+
+    // Keep the packed copy in sync with the new haplotype
+    if (to.chromosomes[chromidx].packed) { to.chromosomes[chromidx].pack(); }
 }
 
 AlleleSites errored_chromosome(AlleleSites& c, int nmark, double error_rate) {
@@ -275,6 +412,7 @@ void add_error(Individual& ind, double error_rate) {
         int nmark = gt.info->nmark();
         gt.hapa = errored_chromosome(gt.hapa, nmark, error_rate);
         gt.hapb = errored_chromosome(gt.hapb, nmark, error_rate);
+        if (gt.packed) { gt.pack(); }
 
     }
 }
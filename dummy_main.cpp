@@ -10,6 +10,7 @@
 #include "adios.hpp"
 #include "datamodel.hpp"
 #include "vcf.hpp"
+#include "datacache.hpp"
 #include "ArgumentParser.hpp"
 #include "utility.hpp"
 #include "setops.hpp"
@@ -125,6 +126,8 @@ int main(int argc, char** argv) {
     vector<CommandLineArgument> arginfo = {
         //                  Argument      action       default        nargs   help
         CommandLineArgument{"vcf",        "store",     {""},          1,     "Input VCF"},
+        CommandLineArgument{"save_cache", "store",     {"-"},         1,     "Save the input to a binary cache file (.adb)"},
+        CommandLineArgument{"load_cache", "store",     {"-"},         1,     "Read the input from a binary cache file instead"},
         CommandLineArgument{"out",        "store",     {""},          1,     "Output VCF"},
         CommandLineArgument{"synthetics", "store",     {""},          1,     "Number of synthetic individuals"},
         CommandLineArgument{"prefix",     "store",     {"SYNTH"},     1,     "Prefix for synthetics"},
@@ -159,7 +162,11 @@ int main(int argc, char** argv) {
     }
 
 
-    std::cout << "Input file: " << args["vcf"][0] << '\n';
+    if (args["load_cache"][0] != "-") {
+        std::cout << "Input cache: " << args["load_cache"][0] << '\n';
+    } else {
+        std::cout << "Input file: " << args["vcf"][0] << '\n';
+    }
     std::cout << "Output prefix: " << args["out"][0] << '\n';
     std::cout << "Synthetic individuals: " << args["synthetics"][0] << '\n';
     std::cout << "Synthetic segments: " << args["nseg"][0] << '\n';
@@ -174,12 +181,31 @@ int main(int argc, char** argv) {
     VCFParams vcfp = {false, false, true, "AF"};
 
     Dataset data;
-    try {
-        data = read_vcf(args["vcf"][0], vcfp);
-    } catch (const std::exception& e) {
-        std::cout << "Could not process file: " << args["vcf"][0] << ": ";
-        std::cout << e.what() << '\n';
-        return 1;
+    datacache::Source source = {args["vcf"][0], vcfp};
+    if (args["load_cache"][0] != "-") {
+        try {
+            data = datacache::load(args["load_cache"][0], source);
+        } catch (const std::exception& e) {
+            std::cout << "Could not load cache: " << e.what() << '\n';
+            return 1;
+        }
+    } else {
+        try {
+            data = read_vcf(args["vcf"][0], vcfp);
+        } catch (const std::exception& e) {
+            std::cout << "Could not process file: " << args["vcf"][0] << ": ";
+            std::cout << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    if (args["save_cache"][0] != "-") {
+        try {
+            datacache::save(args["save_cache"][0], data, source);
+        } catch (const std::exception& e) {
+            std::cout << "Could not save cache: " << e.what() << '\n';
+            return 1;
+        }
     }
 
     std::cout << data.ninds() << " individuals\n";
@@ -189,6 +215,9 @@ int main(int argc, char** argv) {
         for (auto& kv : c->exclusions) {
             std::cout << "Excluded: " << kv.second << " " << kv.first << "\n";
         }
+        if (c->malformed_genotypes) {
+            std::cout << "Malformed genotypes marked missing: " << c->malformed_genotypes << "\n";
+        }
     }
 
     int chunksize = std::stod(args["chunksize"][0]);
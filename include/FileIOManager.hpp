@@ -11,8 +11,10 @@
 #include <fstream>
 
 #include <errno.h>
+#include <memory>
 
 #include "config.h"
+#include "stringops.hpp"
 
 #ifdef HAVE_ZLIB
 #include "zlib.h"
@@ -28,6 +30,10 @@ public:
     virtual bool good(void) = 0;
     virtual bool eof(void) = 0;
     virtual std::string getline(void) = 0;
+
+    // Reads up to n bytes into out. Returns how many were read, which is
+    // less than n only at the end of the file.
+    virtual size_t read(char* out, size_t n) = 0;
     virtual ~FileObject(void) {};
 
 };
@@ -45,6 +51,7 @@ public:
     bool good(void);
     bool eof(void);
     std::string getline(void);
+    size_t read(char* out, size_t n);
 };
 
 
@@ -63,12 +70,54 @@ public:
     bool good(void);
     bool eof(void);
     std::string getline(void);
+    size_t read(char* out, size_t n);
 
 };
 
 
 #endif
 
+// Splits a file into lines, reading it in large blocks and finding line
+// ends with memchr. Lines come back as spans into the reader's buffer,
+// without their '\n', and stay valid until the next call to getline. An
+// uncompressed regular file is mapped into memory instead of being read,
+// so its lines are never copied at all.
+class LineReader
+{
+public:
+    static const size_t BLOCK_SIZE = 4 << 20;
+
+    // Reads the rest of an open file
+    LineReader(FileObject* source);
+
+    // Maps filename if it can, otherwise reads it
+    LineReader(const std::string& filename);
+    ~LineReader(void);
+
+    // Returns false when there are no more lines
+    bool getline(stringops::StringSpan& line);
+
+private:
+    LineReader(const LineReader&);
+    LineReader& operator=(const LineReader&);
+
+    FileObject* source;
+    std::unique_ptr<UncompressedFile> owned;
+    bool source_eof;
+
+    // Either the mapped file, or the first buf_len bytes of buf. The next
+    // line starts at pos, and there's no newline in [pos, scanned).
+    const char* mapped;
+    size_t mapped_size;
+    std::unique_ptr<char[]> buf;
+    size_t buf_size;
+    size_t buf_len;
+    size_t pos;
+    size_t scanned;
+
+    void fill(void);
+};
+
 class DelimitedFileWriter : public UncompressedFile
 {
 private:
@@ -80,6 +129,9 @@ public:
     DelimitedFileWriter(const std::string& fn, char delimiter);
     void writetoks(const std::vector<std::string>& toks);
     void writeline(const std::string& line);
+
+    // Write preformatted text as is
+    void writeblock(const std::string& text);
 };
 
 class Logstream {
@@ -1,27 +1,155 @@
+#ifndef HIDDENMARKOV_HPP
+#define HIDDENMARKOV_HPP
+
 #include <vector>
 #include <cmath>
 #include <numeric>
 #include <iostream>
+#include <stdint.h>
 
 #include "Linalg.hpp"
 using Linalg::Matrix;
 using Linalg::Vector;
+// Emission probabilities come from a table of row-major nsymbols x nstates
+// matrices laid end to end. Observation i is emitted according to matrix
+// emission_codes[i], so looking one up is a single indexed load.
+//
+// The model doesn't own any of its inputs: observations, codes, tables and
+// the transition matrix have to outlive it. Constructing one allocates
+// nothing.
 class GenotypeHMM
 {
 public:
     int nstates;
-    std::vector<int> observations;
-    std::vector<Matrix*> emission_matrices;
-    Matrix transition_matrix;
+    size_t nsymbols;
+    size_t nobs;
+    const int* observations;
+    const uint32_t* emission_codes;
+    const double* emissions;       // The emission table
+    const double* log_emissions;   // Optional (may be NULL), natural log of the table
+    const Matrix& transition_matrix;
 
+    GenotypeHMM(const int* obs,
+                const uint32_t* codes,
+                size_t nobs,
+                const double* emission_table,
+                size_t nsymbols,
+                const Matrix& transition,
+                const double* log_emission_table=NULL);
     GenotypeHMM(const std::vector<int>& obs,
-                const std::vector<Matrix*>& emission,
-                const Matrix& transition);
+                const std::vector<uint32_t>& codes,
+                const double* emission_table,
+                size_t nsymbols,
+                const Matrix& transition,
+                const double* log_emission_table=NULL);
+
+    // Emission probabilities of symbol obs for each state, at observation i
+    inline const double* emission_row(size_t i, int obs) const {
+        return emissions + (emission_codes[i] * nsymbols + obs) * nstates;
+    }
+    inline const double* log_emission_row(size_t i, int obs) const {
+        return log_emissions + (emission_codes[i] * nsymbols + obs) * nstates;
+    }
+
     inline std::vector<int> decode(bool use_posteriori)
     {
         return use_posteriori ? viterbi() : forwards_backwards();
     }
     std::vector<int> viterbi(void) const;
     std::vector<int> forwards_backwards(void) const;
+
+    // Posterior decoding for any number of states, on Linalg objects
+    std::vector<int> forwards_backwards_generic(void) const;
+
+    // Normalized forward and backward messages at every observation, kept
+    // so parts of the sequence can be decoded again later. fw[i * nstates + s]
+    // covers observations [0, i] and bw[i * nstates + s] covers (i, nobs).
+    // With max_product the sums over states become maxima, as in Viterbi.
+    void messages(bool max_product, std::vector<double>& fw, std::vector<double>& bw) const;
+
+    // Decode the observations on their own, as part of a longer sequence.
+    // entry is the forward message for the observation just before them
+    // and exit the backward message for the last of them (both as from
+    // messages()). NULL means the sequence starts or ends here.
+    std::vector<int> decode_window(bool max_product, const double* entry, const double* exit) const;
+
+    // Posterior decoding with the state count fixed at compile time.
+    // Only the forward probabilities are stored; the backward pass picks
+    // the most probable state as it goes.
+    template <size_t NS> std::vector<int> forwards_backwards_fixed(void) const;
 };
 
+template <size_t NS>
+std::vector<int> GenotypeHMM::forwards_backwards_fixed(void) const
+{
+    std::vector<int> outp(nobs);
+    if (!nobs) { return outp; }
+
+    double trans[NS][NS];
+    for (size_t i = 0; i < NS; ++i) {
+        for (size_t j = 0; j < NS; ++j) { trans[i][j] = transition_matrix.get(i, j); }
+    }
+
+    // fw[obsidx * NS + state] is the normalized forward probability after
+    // seeing observations [0, obsidx]
+    static thread_local std::vector<double> fwbuf;
+    fwbuf.resize(nobs * NS);
+    double* fw = fwbuf.data();
+
+    double prev[NS];
+    for (size_t i = 0; i < NS; ++i) { prev[i] = 1.0 / NS; }
+
+    for (size_t obsidx = 0; obsidx < nobs; ++obsidx) {
+        const double* d = emission_row(obsidx, observations[obsidx]);
+        double* cur = fw + obsidx * NS;
+
+        double total = 0.0;
+        for (size_t j = 0; j < NS; ++j) {
+            double v = 0.0;
+            for (size_t i = 0; i < NS; ++i) { v += trans[i][j] * prev[i]; }
+            cur[j] = d[j] * v;
+            total += cur[j];
+        }
+        for (size_t j = 0; j < NS; ++j) {
+            cur[j] /= total;
+            prev[j] = cur[j];
+        }
+    }
+
+    // Backwards, deciding each observation as soon as its backward
+    // probabilities are known. Ties go to the lowest numbered state.
+    double bw[NS];
+    for (size_t i = 0; i < NS; ++i) { bw[i] = 1.0; }
+
+    for (size_t obsidx = nobs; obsidx-- > 0; ) {
+        const double* cur = fw + obsidx * NS;
+        size_t best = 0;
+        double best_p = cur[0] * bw[0];
+        for (size_t i = 1; i < NS; ++i) {
+            double p = cur[i] * bw[i];
+            if (p > best_p) {
+                best = i;
+                best_p = p;
+            }
+        }
+        outp[obsidx] = best;
+
+        if (!obsidx) { break; }
+
+        const double* d = emission_row(obsidx, observations[obsidx]);
+        double v[NS];
+        for (size_t j = 0; j < NS; ++j) { v[j] = d[j] * bw[j]; }
+
+        double total = 0.0;
+        for (size_t i = 0; i < NS; ++i) {
+            bw[i] = 0.0;
+            for (size_t j = 0; j < NS; ++j) { bw[i] += trans[i][j] * v[j]; }
+            total += bw[i];
+        }
+        for (size_t i = 0; i < NS; ++i) { bw[i] /= total; }
+    }
+
+    return outp;
+}
+
+#endif
@@ -21,6 +21,12 @@
 #include "datamodel.hpp"
 #include "utility.hpp"
 #include "FileIOManager.hpp"
+#include "sitekernel.hpp"
+#include "segmentwriter.hpp"
+#include "segmentfile.hpp"
+#include "workstealing.hpp"
+#include "batchhmm.hpp"
+#include "prefilter.hpp"
 // using AlleleSites;
 
 namespace adios {
@@ -35,6 +41,7 @@ struct adios_sites {
     std::vector<int> states;
     std::vector<int> sites;
     Chromptr info; 
+    int chromidx;
 };
 
 struct Indpair {
@@ -42,6 +49,45 @@ struct Indpair {
     Individual ind2;
 };
 
+// HMM emission probabilities for every frequency level on a chromosome
+// (see ChromInfo::freq_levels), stored contiguously as
+// [level][observation][state]. Logs are kept alongside: natural logs for
+// Viterbi decoding, base 10 for LOD scores.
+struct EmissionTable {
+    enum { NOBS = 9, NSTATES = 2, STRIDE = NOBS * NSTATES };
+
+    std::vector<double> probs;
+    std::vector<double> ln_probs;
+    std::vector<double> log10_probs;
+
+    EmissionTable(void) {}
+    EmissionTable(const std::vector<double>& levels, const Matrix& error_mat);
+
+    inline size_t nlevels(void) const { return probs.size() / STRIDE; }
+    inline double get(uint32_t code, int obs, int state) const {
+        return probs[code * STRIDE + obs * NSTATES + state];
+    }
+    inline double get_log10(uint32_t code, int obs, int state) const {
+        return log10_probs[code * STRIDE + obs * NSTATES + state];
+    }
+};
+
+// How adios() hands pair blocks out to threads
+enum Schedule {
+    SCHEDULE_CHROMOSOME,    // A parallel loop per chromosome, one after another
+    SCHEDULE_GLOBAL,        // One loop over the blocks of every chromosome
+    SCHEDULE_STEAL          // Per chromosome, with a WorkStealingScheduler
+};
+
+// How adios() decodes pairs
+enum Engine {
+    ENGINE_PAIR,            // One pair at a time with GenotypeHMM
+    ENGINE_BATCH            // batchhmm::LANES pairs at a time with batchhmm::BatchDecoder
+};
+
+// How each thread spent its time, for each chromosome
+typedef std::vector<std::vector<ThreadLoad>> ChromosomeLoads;
+
 // Parameters for ADIOS.
 struct adios_parameters {
     double rare_thresh;                             // Rare variant frequency threshold 
@@ -49,6 +95,7 @@ struct adios_parameters {
     Matrix unphased_error_mat;                      // Matrix of genotyping error probabilities
     Matrix unphased_transition_mat;                 // HMM transition matrix
     std::vector<std::vector<int>> rare_sites;       // The set of sites with rare variation
+    std::vector<PackedSites> rare_masks;            // rare_sites as bitsets, for packed genotypes
     int gamma_;                                     // Probability to enter IBD (10^(-gamma))
     int rho;                                        // Probability of exitiing IBD (10^(-rho))
     int min_length;                                 // Minimum segment length of to consider
@@ -56,9 +103,17 @@ struct adios_parameters {
     double min_lod;                                 // Minimum allowed quality score
     void get_rare_sites(Dataset& data);             // Get the rare sites
     void calculate_emission_mats(const Dataset& d); // Precompute emission matrices
-    std::map<double, Matrix> emission_mats;         // Precomputed emission matrices indexed by frequency
+    std::vector<EmissionTable> emission_tables;     // Precomputed emissions for each chromosome
     bool viterbi;                                   // Use MAP decoding
     bool finemap_ends;                              // Use all available genotypes around segment ends
+    bool packed;                                    // Use bit-packed genotypes
+    size_t output_buffer;                           // Memory ceiling for buffered output (bytes)
+    bool binary_output;                             // Write segments in the indexed binary format
+    Schedule schedule;                              // How pair blocks are scheduled
+    Engine engine;                                  // How pairs are decoded
+    bool prefilter;                                 // Skip pairs sharing fewer than min_mark rare variants
+    int prefilter_window;                           // Window the rare variants have to share (bp, 0 for none)
+    size_t carrier_memory;                          // Memory ceiling for the carrier index (bytes)
 };
 
 
@@ -86,15 +141,17 @@ public:
     }
 
     Segment(const std::string& a, const std::string& b, ValueRun& run, Chromptr c,
-            std::vector<int>& obs, std::vector<Matrix*>& emissions,
-            std::vector<int>& adiossites, const adios_parameters& params);
+            const std::vector<int>& obs, const std::vector<uint32_t>& emission_codes,
+            const EmissionTable& emissions,
+            const std::vector<int>& adiossites, const adios_parameters& params);
 
     // Trim segment back to last shared rare variant
-    void trim(std::vector<int>& observations);
+    void trim(const std::vector<int>& observations);
 
     // Calculate the lod score
-    double calculate_lod(std::vector<int>& observations,
-                         std::vector<Matrix*>& emissions,
+    double calculate_lod(const std::vector<int>& observations,
+                         const std::vector<uint32_t>& emission_codes,
+                         const EmissionTable& emissions,
                          const adios::adios_parameters& params) const;
     
     // Does this segment pass the filters we set?
@@ -103,6 +160,8 @@ public:
     // Output line
     std::vector<std::string> record(void) const;
     std::string record_string(void) const;
+    void append_record(std::string& buf, char delim) const;
+    segfile::Record binary_record(uint32_t ind1idx, uint32_t ind2idx, uint32_t chromidx) const;
 
 };
 
@@ -122,7 +181,7 @@ adios_parameters params_from_args(std::map<std::string, std::vector<std::string>
 inline bool is_shared_rv(int obs) { return ((obs >= 4) && (obs != 6)); }
 
 // Creates the transition matrix for the HMM 
-Matrix unphased_transition_matrix(unsigned int l10gamma, unsigned int l10rho);
+Matrix unphased_transition_matrix(int l10gamma, int l10rho);
 
 // A matrix describing the probability of a having a genotype
 // given the observed genotype using an allele miscall error rate (eps)
@@ -138,11 +197,33 @@ adios_sites find_informative_sites_unphased(const Individual& ind1,
                                             const AlleleSites& rares,
                                             const AlleleSites& requests=AlleleSites());
 
- 
-// Perform adios on the entire dataset d using parameters `params`
-void adios(Dataset& d, const adios_parameters& params, DelimitedFileWriter& out);
-
-// Perform adios on a pair of individuals on one chromosome
+// As above, but a word at a time over bit-packed genotypes (see Genotypes::pack).
+// The SIMD implementation is picked at runtime unless impl says otherwise.
+adios_sites find_informative_sites_unphased_packed(const Individual& ind1,
+                                                   const Individual& ind2,
+                                                   int chromidx,
+                                                   const PackedSites& rares,
+                                                   const AlleleSites& requests=AlleleSites(),
+                                                   sitekernel::Implementation impl=sitekernel::KERNEL_AUTO);
+
+
+// Number of individuals on each side of a pair tile, chosen so a tile's
+// genotypes for chromosome chridx fit in the L2 cache
+long pair_block_size(const Dataset& d, size_t chridx);
+
+// Perform adios on the entire dataset d using parameters `params`. If
+// loads is given and the schedule runs chromosomes one at a time, it gets
+// each thread's busy and idle time on each chromosome.
+void adios(Dataset& d, const adios_parameters& params, DelimitedFileWriter& out,
+           ChromosomeLoads* loads=NULL);
+
+// Decode one pair's informative sites and collect the segments that pass
+// the filters
+adios_result run_adios_pair_unphased(const adios_sites& useful,
+                                     const adios_parameters& params);
+
+// Perform adios on a pair of individuals on one chromosome. With params.finemap_ends,
+// segment ends are then refined with the genotypes around them.
 adios_result adios_pair_unphased(const Individual& ind1, const Individual& ind2,
                          int chromidx,
                          const adios_parameters& params);
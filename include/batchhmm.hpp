@@ -0,0 +1,66 @@
+#ifndef BATCHHMM_HPP
+#define BATCHHMM_HPP
+
+#include <vector>
+#include <stdint.h>
+
+#include "Linalg.hpp"
+
+// Decoding the two state IBD model for several pairs at once. One pair's
+// forward-backward step is a handful of multiplies on two states, which
+// can't fill a vector register, so instead each register lane holds a
+// different pair. The pairs' emission probabilities are laid out
+// structure-of-arrays, observation by observation and lane by lane, padded
+// to the longest sequence, and every step is a short loop over lanes that
+// the compiler turns into SIMD.
+//
+// Each lane does exactly the arithmetic GenotypeHMM does for one pair, so
+// the decoded states are the same.
+namespace batchhmm {
+
+// Sequences decoded together
+const size_t LANES = 8;
+
+// One pair's observations, as given to GenotypeHMM
+struct Sequence {
+    const int* observations;
+    const uint32_t* emission_codes;
+    size_t nobs;
+};
+
+class BatchDecoder {
+public:
+    // The emission tables are laid out as for GenotypeHMM. The log table
+    // (natural log) is only used for Viterbi decoding and is worked out
+    // from the other if it's NULL. Throws std::invalid_argument if the
+    // model doesn't have two states.
+    BatchDecoder(const double* emission_table, const double* log_emission_table,
+                 size_t nsymbols, const Linalg::Matrix& transition);
+
+    // Decode up to LANES sequences into states[0..n), with posterior
+    // decoding or (if use_posteriori) Viterbi, like GenotypeHMM::decode.
+    void decode(const Sequence* seqs, size_t n, bool use_posteriori,
+                std::vector<int>* states);
+
+private:
+    const double* emissions;
+    const double* log_emissions;
+    size_t nsymbols;
+    double trans[2][2];
+    double ln_trans[2][2];
+
+    // Scratch, reused from batch to batch. Element [t * LANES + lane].
+    std::vector<double> e0, e1;     // Emissions for each state
+    std::vector<double> fw0, fw1;   // Forward probabilities
+    std::vector<uint8_t> path;      // Decoded states, or Viterbi backpointers
+    size_t nsteps;
+    size_t len[LANES];
+
+    void load(const Sequence* seqs, size_t n, bool logs);
+    void forwards_backwards(void);
+    void viterbi(void);
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef BCF_HPP
+#define BCF_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "datamodel.hpp"
+#include "stringops.hpp"
+#include "vcf.hpp"
+
+// Native reading of BCF2 (binary VCF, as written by bcftools), without
+// htslib. A BCF file is BGZF compressed: "BCF\2\2", the text VCF header,
+// then records whose CHROM, FILTER, INFO and FORMAT keys are indices into
+// dictionaries defined by the header. Each record is a block of shared
+// fields followed by a block of per-sample fields, stored one FORMAT key
+// at a time as typed arrays. Variants are filtered the same way as text
+// VCF, and GT arrays are decoded straight into minor allele lists.
+
+// The dictionaries a BCF header defines
+struct BCFHeader {
+    std::vector<std::string> contigs;
+    std::vector<std::string> keys;      // FILTER, INFO and FORMAT IDs, PASS first
+    std::vector<std::string> samples;
+    int gt_key;                         // Index of GT in keys, -1 if there isn't one
+
+    BCFHeader(const std::string& text);
+
+    // Index of a FILTER/INFO/FORMAT ID in keys, -1 if it isn't defined
+    int key(const std::string& id) const;
+
+private:
+    std::map<std::string, int> key_index;
+};
+
+// One BCF record, decoded in place. The two blocks have to outlive it.
+class BCFRecordView {
+public:
+    typedef stringops::StringSpan Span;
+
+    Span chrom;
+    int pos;        // 1-based, as in text VCF
+    Span label;
+
+    BCFRecordView(const BCFHeader& header,
+                  const char* shared, size_t shared_len,
+                  const char* indiv, size_t indiv_len);
+
+    void get_minor_alleles(VCFRecordGenotypeContainer& container) const;
+
+    // Returns the first value of an INFO field, otherwise 0.0
+    double get_info_freq(const std::string& info_field) const;
+    // The same, for the INFO field with index key in the header's keys
+    double get_info_freq(int key) const;
+    int nalleles(void) const;
+    bool is_snv(void) const;
+
+private:
+    const BCFHeader& header;
+    int n_allele;
+    int n_info;
+    int n_fmt;
+    int n_sample;
+    const char* alleles;    // First typed allele string
+    const char* info;       // First INFO key
+    const char* shared_end;
+    const char* indiv;
+    const char* indiv_end;
+};
+
+// Reads a BCF file into the same Dataset read_vcf would make from its text
+// equivalent. Decompression runs on nthreads threads. Variants outside
+// region are skipped without decoding their genotypes.
+Dataset read_bcf(const std::string& filename, const VCFParams& fileparams, int nthreads=1,
+                 const VCFRegion& region=VCFRegion());
+
+#endif
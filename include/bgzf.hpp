@@ -0,0 +1,105 @@
+#ifndef BGZF_HPP
+#define BGZF_HPP
+
+#include "FileIOManager.hpp"
+
+#ifdef HAVE_ZLIB
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// Reader for BGZF files (the blocked gzip written by bgzip and htslib).
+// A BGZF file is a series of gzip members of at most 64KB each, and every
+// member records its own compressed size, so blocks can be found without
+// inflating anything and then inflated independently. Blocks are read in
+// groups, the groups are inflated on a pool of threads, and the
+// decompressed chunks are handed out in file order.
+//
+// Plain gzip files aren't BGZF; check with is_bgzf and use GZFile for them.
+class BGZFFile : public FileObject
+{
+public:
+    BGZFFile(int nthreads=1);
+    ~BGZFFile(void);
+
+    void openfile(const std::string& filename, bool write);
+    void closefile(void);
+    bool good(void);
+    bool eof(void);
+    std::string getline(void);
+
+    // Reads up to n decompressed bytes into out. Returns how many were
+    // read, which is less than n only at the end of the file.
+    size_t read(char* out, size_t n);
+
+    // Replaces out with the next decompressed chunk, in file order. Chunks
+    // don't respect line boundaries. Returns false at the end of the file.
+    bool read_chunk(std::string& out);
+
+    // Restrict reading to these runs of the file, given as pairs of
+    // virtual offsets (block offset << 16 | offset into the block) in file
+    // order and not overlapping, e.g. from a tabix index. Call before
+    // openfile.
+    void set_ranges(const std::vector<std::pair<uint64_t, uint64_t> >& ranges);
+
+    // Does the file start with a BGZF block?
+    static bool is_bgzf(const std::string& filename);
+
+private:
+    BGZFFile(const BGZFFile&);
+    BGZFFile& operator=(const BGZFFile&);
+
+    // A group of consecutive compressed blocks and what they inflate to
+    struct Job {
+        std::string raw;
+        std::string out;
+        std::string error;
+        bool done;
+
+        // Trimming for jobs at the ends of a range: bytes to drop from the
+        // start of the first block, and whether to cut the last block at
+        // keep bytes
+        size_t skip;
+        bool trim;
+        size_t keep;
+    };
+
+    FILE* f;
+    std::string filename;
+    bool raw_eof;
+    int nthreads;
+
+    bool ranged;
+    std::vector<std::pair<uint64_t, uint64_t> > ranges;
+    size_t range_idx;
+    bool in_range;
+
+    // Decompressed data not yet handed out by getline
+    std::string buf;
+    size_t bufpos;
+
+    std::mutex mtx;
+    std::condition_variable work_ready;
+    std::condition_variable job_done;
+    std::deque<std::shared_ptr<Job> > todo;
+    std::deque<std::shared_ptr<Job> > inflight;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    bool read_blocks(Job& job);
+    static void inflate_job(Job& job);
+    void fill_pipeline(void);
+    void work(void);
+    void stop(void);
+};
+
+#endif
+
+#endif
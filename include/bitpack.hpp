@@ -0,0 +1,29 @@
+#ifndef BITPACK_HPP
+#define BITPACK_HPP
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// Dense bit-packed marker sets: bit (i % 64) of word (i / 64) is set when
+// marker i is in the set. Bits past the last marker are always zero.
+typedef std::vector<uint64_t> PackedSites;
+
+namespace bitpack {
+    using std::vector;
+
+    inline size_t nwords(size_t nbits) { return (nbits + 63) / 64; }
+    inline int popcount(uint64_t w) { return __builtin_popcountll(w); }
+    inline int ctz(uint64_t w) { return __builtin_ctzll(w); }
+    inline bool test(const PackedSites& p, size_t i) { return (p[i >> 6] >> (i & 63)) & 1; }
+    inline void set(PackedSites& p, size_t i) { p[i >> 6] |= (uint64_t)1 << (i & 63); }
+
+    // Convert between sorted marker index lists and packed bitsets
+    PackedSites pack(const vector<int>& sites, size_t nbits);
+    vector<int> unpack(const PackedSites& bits);
+
+    // Number of set bits in the whole set
+    size_t count(const PackedSites& bits);
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <utility>
+#include <iterator>
+#include <stdint.h>
 #include <math.h>
 
 
@@ -10,23 +12,103 @@ namespace combinatorics
 {
 using std::pair;
 
+// GCC/clang extension; __extension__ keeps -pedantic quiet
+__extension__ typedef unsigned __int128 uint128;
+
+// Binomial coefficients, computed exactly in integer arithmetic
+uint128 nCk_exact(long n, long k);
 long nCk(long n, long k);
 
+// Integer square root: the largest r with r*r <= x
+uint64_t isqrt(uint128 x);
+
+// The ith k-combination of n items in lexicographic order.
+// k == 2 is decoded in closed form, otherwise this is O(n).
 std::vector<long> combination_at_index(long i, long n, long k);
 
+// Closed form decoding and encoding of the lexicographic pair index
+pair<long, long> pair_at_index(long idx, long n);
+inline long index_of_pair(long i, long j, long n) {
+    return i * n - i * (i + 1) / 2 + (j - i - 1);
+}
+
+// The pairs with lexicographic index in [first, last) of n items. Iterating
+// yields consecutive pairs incrementally; only the first one is decoded.
+class PairRange {
+public:
+    class iterator : public std::iterator<std::forward_iterator_tag, pair<long, long>> {
+    public:
+        iterator(long idx, long n) : idx_(idx), n_(n) {
+            if (idx < nCk(n, 2)) cur_ = pair_at_index(idx, n);
+        }
+        inline const pair<long, long>& operator*(void) const { return cur_; }
+        inline const pair<long, long>* operator->(void) const { return &cur_; }
+        inline iterator& operator++(void) {
+            ++idx_;
+            if (++cur_.second == n_) {
+                ++cur_.first;
+                cur_.second = cur_.first + 1;
+            }
+            return *this;
+        }
+        inline bool operator==(const iterator& o) const { return idx_ == o.idx_; }
+        inline bool operator!=(const iterator& o) const { return idx_ != o.idx_; }
+        inline long index(void) const { return idx_; }
+
+    private:
+        long idx_;
+        long n_;
+        pair<long, long> cur_;
+    };
+
+    PairRange(long n) : n_(n), first_(0), last_(nCk(n, 2)) {}
+    PairRange(long n, long first, long last) : n_(n), first_(first), last_(last) {}
+
+    inline iterator begin(void) const { return iterator(first_, n_); }
+    inline iterator end(void) const { return iterator(last_, n_); }
+    inline long size(void) const { return last_ - first_; }
+
+private:
+    long n_;
+    long first_;
+    long last_;
+};
+
+// A tile of the pair matrix: the pairs (i, j) with i < j, i in
+// [i_start, i_stop) and j in [j_start, j_stop). Tiles on the diagonal
+// hold the upper triangle of their square.
+struct PairBlock {
+    long i_start;
+    long i_stop;
+    long j_start;
+    long j_stop;
+
+    long npairs(void) const;
+
+    // Calls f(i, j) for every pair in the block, walking rows so the
+    // column individuals are reused while they're cache-hot.
+    template <typename F>
+    void for_each_pair(F f) const {
+        for (long i = i_start; i < i_stop; ++i) {
+            for (long j = (j_start > i ? j_start : i + 1); j < j_stop; ++j) {
+                f(i, j);
+            }
+        }
+    }
+};
+
+// Tile all pairs of n items into square blocks of (at most) blocksize
+// items on a side. Every pair appears in exactly one block.
+std::vector<PairBlock> pair_blocks(long n, long blocksize);
+
 template <typename T>
 std::vector<pair<T, T>> pair_combinations(const std::vector<T>& v)
 {
-    int n = v.size();
-    std::vector<pair<T, T>> pairs(nCk(n, 2));
+    std::vector<pair<T, T>> pairs;
+    pairs.reserve(nCk(v.size(), 2));
 
-    int index = 0;
-
-    for (int i = 0; i < n; ++i) {
-        for (int j = i + 1; j < n; ++j) {
-            pairs[index] = std::make_pair(v[i], v[j]);
-            index++;
-        }
+    for (auto& pr : PairRange(v.size())) {
+        pairs.push_back(std::make_pair(v[pr.first], v[pr.second]));
     }
 
     return pairs;
@@ -0,0 +1,46 @@
+#ifndef DATACACHE_HPP
+#define DATACACHE_HPP
+
+#include <string>
+#include <stdint.h>
+
+#include "datamodel.hpp"
+#include "vcf.hpp"
+
+// Binary Dataset cache (.adb), so runs over the same callset don't have
+// to parse the VCF every time. The layout is
+//
+//   header:    "ADIOSADB", uint32 version, uint32 byte order mark,
+//              uint64 offset of the directory, uint64 file size
+//   arrays:    every marker position (int32), frequency (double), variant
+//              label and genotype list (int32 marker indices), each
+//              starting on an 8 byte boundary
+//   directory: what the data was read with, chromosome labels,
+//              exclusions and malformed genotype counts, individual
+//              labels, and the offset and length of each array
+//
+// Integers and doubles are stored in host byte order and arrays are laid
+// out exactly as they sit in memory, so loading maps the file and copies
+// each array into place without parsing anything.
+namespace datacache {
+
+const uint32_t VERSION = 2;
+
+// Where a cached Dataset came from
+struct Source {
+    std::string filename;
+    VCFParams params;
+};
+
+// Write data to filename. The file is written under a temporary name and
+// renamed into place when it's complete.
+void save(const std::string& filename, const Dataset& data, const Source& source);
+
+// Read a Dataset back out of a cache, finalized and ready to use, and
+// what it was read from into source. Throws std::runtime_error if the
+// file isn't a cache this build can read.
+Dataset load(const std::string& filename, Source& source);
+
+}
+
+#endif
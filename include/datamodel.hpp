@@ -10,9 +10,11 @@
 #include <algorithm>
 #include <iterator>
 #include <iostream>
+#include <stdint.h>
 
 #include "utility.hpp"
 #include "setops.hpp"
+#include "bitpack.hpp"
 
 using std::shared_ptr;
 // #define protected public
@@ -47,12 +49,20 @@ public:
     std::vector<Variant> variants;
     std::string label;
     std::map<std::string, size_t> exclusions;
+    size_t malformed_genotypes;     // Genotypes marked missing because they couldn't be read
     void add_variant(const std::string& lab, int bp, double maf);
     size_t nmark(void) const;
     int size(void) const;
     std::vector<int> positions;
     std::vector<double> frequencies;
 
+    // The distinct values in frequencies, sorted, and the index of each
+    // marker's frequency in that list. Kept up to date by Dataset whenever
+    // it changes frequencies.
+    std::vector<double> freq_levels;
+    std::vector<uint32_t> freq_codes;
+    void encode_frequencies(void);
+
 
     ChromInfo(void);
     ChromInfo(const std::string& lab);
@@ -70,6 +80,13 @@ public:
     AlleleSites hzm;
     AlleleSites hma;
 
+    // Dense bit-packed copies of hapa, hapb and missing. Only filled in
+    // when pack() has been called, otherwise empty.
+    bool packed;
+    PackedSites packed_a;
+    PackedSites packed_b;
+    PackedSites packed_missing;
+
     shared_ptr<ChromInfo> info;
 
     std::vector<int> todense(int haplotype);
@@ -79,6 +96,7 @@ public:
     AlleleSites homozygous_minor(void) const;
     AlleleSites has_minor_allele(void) const;
     void finalize(void);
+    void pack(void);
 
     std::vector<int> dosages(void);
     
@@ -97,6 +115,7 @@ public:
     void set_allele(int chromidx, int markidx, int hapidx, int allele);
     int get_minor_allele_count(int chromidx, int markidx);
     void finalize(void);
+    void pack(void);
 
     Individual(void);
     Individual(const std::string& lab);
@@ -104,11 +123,41 @@ public:
     Individual(const Individual& ind);
 };
 
+// Who carries the minor allele at each rare marker of a chromosome,
+// stored CSR style: the carriers of indexed marker sites[k] are
+// carriers[offsets[k]] to carriers[offsets[k + 1] - 1], as individual
+// indices in increasing order. An index that would have gone over its
+// memory budget isn't built, and has built set to false.
+class CarrierIndex
+{
+public:
+    bool built;
+    std::vector<int> sites;             // Marker index of each indexed site, sorted
+    std::vector<uint32_t> offsets;
+    std::vector<int> carriers;
+
+    inline size_t nsites(void) const { return sites.size(); }
+    inline const int* begin(size_t k) const { return carriers.data() + offsets[k]; }
+    inline const int* end(size_t k) const { return carriers.data() + offsets[k + 1]; }
+
+    // Memory held by the index
+    size_t bytes(void) const;
+
+    CarrierIndex(void);
+};
+
 class Dataset
 {
 public:
     std::vector<Individual> individuals;
     std::vector<shared_ptr<ChromInfo>> chromosomes;
+
+    // Carrier index for each chromosome, of the markers with frequency
+    // below carrier_thresh. Empty unless index_carriers() has been called,
+    // after which finalize() and subset() keep it up to date.
+    std::vector<CarrierIndex> carriers;
+    double carrier_thresh;
+    size_t carrier_budget;
     
     // Number of individuals
     size_t ninds(void) const;
@@ -125,11 +174,28 @@ public:
     void add_chromosome(const std::string& label);
     void round_frequencies(unsigned int places);
     void floor_frequencies(double floor);
+    void encode_frequencies(void);
     void subset(std::set<std::string> indlabs);
     void finalize(void);
 
+    // Build the bit-packed genotype representation for every individual
+    void pack(void);
+
+    // Build the carrier index of every chromosome for the markers with
+    // frequency below rare_thresh, using at most max_bytes between them.
+    // Chromosomes are indexed in order, and any that don't fit in what's
+    // left of the budget aren't built.
+    void index_carriers(double rare_thresh, size_t max_bytes);
+
+    Dataset(void);
 };
 
+// Build the carrier index of the given markers (sorted) on chromosome
+// chromidx, from each individual's minor allele sites. If it would take
+// more than max_bytes, nothing is allocated and the index isn't built.
+CarrierIndex carrier_index(const Dataset& d, size_t chromidx, const AlleleSites& sites,
+                           size_t max_bytes=SIZE_MAX);
+
 void copy_genospan(const Individual& from, int hapfrom, Individual& to, int hapto, 
     int chromidx, const chromspan& cs);
 
@@ -0,0 +1,64 @@
+#ifndef MPSCQUEUE_HPP
+#define MPSCQUEUE_HPP
+
+#include <atomic>
+
+// Lock-free intrusive multi-producer, single-consumer queue (after Dmitry
+// Vyukov's design). Any number of threads may push(); only one thread may
+// pop(). T must be default constructible and have a member
+// `std::atomic<T*> next` for the queue to use. Pushed nodes are owned by the
+// queue until popped.
+template <typename T>
+class MPSCQueue {
+public:
+    MPSCQueue(void) : head_(&stub_), tail_(&stub_) {
+        stub_.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    void push(T* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        T* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // Returns the oldest node, or NULL if the queue is empty. May also
+    // return NULL while a push is halfway done; the node shows up on a
+    // later call.
+    T* pop(void) {
+        T* tail = tail_;
+        T* next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &stub_) {
+            if (next == nullptr) { return nullptr; }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+
+        T* head = head_.load(std::memory_order_acquire);
+        if (tail != head) { return nullptr; }
+
+        push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    MPSCQueue(const MPSCQueue&);
+    MPSCQueue& operator=(const MPSCQueue&);
+
+    std::atomic<T*> head_;
+    T* tail_;
+    T stub_;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef PREFILTER_HPP
+#define PREFILTER_HPP
+
+#include <vector>
+#include <stdint.h>
+
+#include "combinatorics.hpp"
+#include "datamodel.hpp"
+
+// Skipping pairs that can't have a segment worth reporting. A segment
+// only counts rare variants both individuals carry towards min_mark, so
+// a pair that doesn't co-carry at least min_mark rare variants on a
+// chromosome can't have one there, and doesn't need its informative sites
+// found or its HMM run.
+//
+// Co-carried variants are counted a block of pairs at a time from the
+// chromosome's CarrierIndex, so the work goes as the number of carrier
+// pairs at each site rather than the number of pairs in the block.
+namespace prefilter {
+
+// Which pairs of a block co-carry enough of the index's variants (the
+// index has to be built). With a window (in bp), the variants have to
+// fall within two consecutive windows of that size, which is only a
+// heuristic: a long segment with its rare variants spread thinly can be
+// missed. Without one the whole chromosome counts and nothing is missed.
+class PairFilter {
+public:
+    PairFilter(const CarrierIndex& index, const ChromInfo& chrom,
+               const combinatorics::PairBlock& block, int threshold, int window=0);
+
+    inline bool passes(long i, long j) const {
+        return passed[(i - block.i_start) * ncols + (j - block.j_start)];
+    }
+
+    // Number of pairs in the block that pass
+    long npassed(void) const;
+
+private:
+    combinatorics::PairBlock block;
+    long ncols;
+    std::vector<uint8_t> passed;
+};
+
+}
+
+#endif
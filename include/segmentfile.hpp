@@ -0,0 +1,110 @@
+#ifndef SEGMENTFILE_HPP
+#define SEGMENTFILE_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "FileIOManager.hpp"
+
+// Compact binary segment output (.ibdb). The layout is
+//
+//   header:  "ADIOSSEG", uint32 version, uint32 record size
+//   records: fixed size Records, in output order
+//   footer:  individual labels, chromosome table, block table
+//   trailer: uint64 offset of the footer, "ADIOSIDX"
+//
+// Integers are stored in host byte order. Strings are a uint32 length
+// followed by the bytes. Records come out in pair-block order (see
+// combinatorics::PairBlock), so each block's segments are contiguous and
+// the block table says where they are. A reader wanting one chromosome or
+// one individual can seek straight to the blocks that can contain it.
+namespace segfile {
+
+const uint32_t VERSION = 1;
+
+// One segment. Individuals and chromosomes are indices into the footer's
+// label tables.
+struct Record {
+    uint32_t ind1;
+    uint32_t ind2;
+    uint32_t chrom;
+    int32_t start;      // Position of the first marker
+    int32_t stop;       // Position of the last marker
+    int32_t state;
+    uint32_t nmark;
+    uint32_t nrare;
+    uint32_t nerr;
+    float lod;
+};
+
+// A tile of pairs: individuals [i_start, i_stop) against [j_start, j_stop)
+// on one chromosome, and the records it produced.
+struct BlockEntry {
+    uint32_t chrom;
+    uint32_t i_start;
+    uint32_t i_stop;
+    uint32_t j_start;
+    uint32_t j_stop;
+    uint64_t first_record;
+    uint64_t nrecords;
+
+    inline bool contains(uint32_t ind) const {
+        return (ind >= i_start && ind < i_stop) || (ind >= j_start && ind < j_stop);
+    }
+};
+
+struct ChromEntry {
+    std::string label;
+    uint64_t first_record;
+    uint64_t nrecords;
+};
+
+struct Index {
+    std::vector<std::string> individuals;
+    std::vector<ChromEntry> chromosomes;
+    std::vector<BlockEntry> blocks;
+
+    // Fill in chromosome record ranges from the blocks, which must be in
+    // file order
+    void summarize_chromosomes(void);
+};
+
+// Serialized pieces of a file
+std::string header(void);
+std::string footer(const Index& idx);
+void append(std::string& buf, const Record& r);
+
+// Random access to a .ibdb file
+class Reader {
+public:
+    Index index;
+    uint64_t nrecords;
+
+    Reader(const std::string& filename);
+    ~Reader(void);
+
+    // Read count records starting at record first
+    std::vector<Record> read(uint64_t first, uint64_t count);
+
+private:
+    Reader(const Reader&);
+    Reader& operator=(const Reader&);
+
+    FILE* f;
+    std::string filename;
+};
+
+// Column names of the tab delimited output
+std::vector<std::string> text_header(void);
+
+// Render a record the same way as the tab delimited output
+std::vector<std::string> tokens(const Record& r, const Index& idx);
+
+// Write a whole .ibdb file out as tab delimited text, header line included
+void convert(const std::string& filename, DelimitedFileWriter& out);
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SEGMENTWRITER_HPP
+#define SEGMENTWRITER_HPP
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <stdexcept>
+
+#include "mpscqueue.hpp"
+#include "FileIOManager.hpp"
+
+namespace adios {
+
+// Formatted output from one unit of work (e.g. a block of pairs), filled in
+// by a worker thread and handed to a SegmentWriter.
+struct SegmentBatch {
+    long sequence;                      // Position of this batch in the output
+    size_t chromidx;                    // Chromosome the batch came from
+    long npairs;                        // Number of pairs computed for it
+    long nsegments;                     // Number of segment records in it
+    unsigned long markers_used;         // Informative markers over those pairs
+    long nskipped;                      // Pairs the pre-filter kept from the HMM
+    std::string text;                   // Formatted (text or binary) output records
+    std::atomic<SegmentBatch*> next;    // Used by the queue
+
+    SegmentBatch(void) : sequence(0), chromidx(0), npairs(0), nsegments(0), markers_used(0), nskipped(0), next(nullptr) {}
+    inline size_t bytes(void) const { return sizeof(SegmentBatch) + text.capacity(); }
+};
+
+// Streams SegmentBatches to a file from a dedicated writer thread. Worker
+// threads submit() batches through a lock-free queue, so they never wait on
+// file IO. Batches are written in sequence order, which must run 0, 1, 2...
+// with no gaps, so output doesn't depend on thread timing. If more than
+// memory_limit bytes of output are waiting, submit() blocks until the
+// writer catches up, except for the batch the writer needs next. That
+// can't deadlock as long as no thread sits on an unsubmitted batch while
+// submitting a later one, and the lowest unfinished batch is always being
+// worked on or next in line (true of handing out work in sequence order,
+// as an OpenMP dynamic schedule does, and of WorkStealingScheduler).
+class SegmentWriter {
+public:
+    typedef std::function<void(const SegmentBatch&)> Callback;
+
+    // on_write is called from the writer thread after each batch is written
+    SegmentWriter(DelimitedFileWriter& out, size_t memory_limit,
+                  Callback on_write=Callback());
+    ~SegmentWriter(void);
+
+    // Queue a batch for writing. The writer takes ownership of it.
+    void submit(SegmentBatch* batch);
+
+    // Write everything outstanding and stop the writer thread. All
+    // submit() calls must have returned.
+    void finish(void);
+
+    inline size_t peak_buffered(void) const { return peak_buffered_.load(); }
+
+private:
+    SegmentWriter(const SegmentWriter&);
+    SegmentWriter& operator=(const SegmentWriter&);
+
+    void run(void);
+    void write_ready(void);
+
+    DelimitedFileWriter& out_;
+    size_t memory_limit_;
+    Callback on_write_;
+
+    MPSCQueue<SegmentBatch> queue_;
+    std::map<long, SegmentBatch*> pending_;    // Writer thread only
+
+    std::atomic<long> next_sequence_;
+    std::atomic<size_t> buffered_;
+    std::atomic<size_t> peak_buffered_;
+    std::atomic<bool> finishing_;
+    std::atomic<bool> failed_;
+    std::string error_;
+
+    std::thread thread_;
+};
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SITEKERNEL_HPP
+#define SITEKERNEL_HPP
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// Classification of informative sites for a pair of individuals directly
+// from bit-packed genotypes. Each site is given the state 3*s1+s2, where s1
+// and s2 are the minor allele counts of the two individuals. A site is kept
+// if it is an opposite homozygote (states 2 and 6), a shared rare variant,
+// or requested (and someone carries the minor allele), and is not missing
+// in either individual.
+namespace sitekernel {
+
+// Word arrays for one pair on one chromosome. All arrays have nwords
+// entries, except requested which may be NULL.
+struct PackedPair {
+    const uint64_t* a;        // Individual 1, haplotype A
+    const uint64_t* b;        // Individual 1, haplotype B
+    const uint64_t* c;        // Individual 2, haplotype A
+    const uint64_t* d;        // Individual 2, haplotype B
+    const uint64_t* missing1;
+    const uint64_t* missing2;
+    const uint64_t* rare;
+    const uint64_t* requested;
+    size_t nwords;
+};
+
+enum Implementation {
+    KERNEL_AUTO,
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+};
+
+// The fastest implementation supported by the running CPU
+Implementation best_available(void);
+bool is_available(Implementation impl);
+const char* name(Implementation impl);
+
+// Appends the informative sites (marker indices) and their states. 
+// Returns the number of sites found.
+size_t classify(const PackedPair& p,
+                std::vector<int>& sites,
+                std::vector<int>& states,
+                Implementation impl=KERNEL_AUTO);
+
+// out[i] = table[index[i]] for i < n, with SIMD gathers where available.
+// Picks up per-marker values (e.g. emission codes) at a pair's informative
+// sites.
+void gather(const uint32_t* table, const int* index, size_t n, uint32_t* out,
+            Implementation impl=KERNEL_AUTO);
+
+// The informative-site mask for a single word, shared by every
+// implementation for the tail words and for emitting states.
+inline uint64_t informative_mask(uint64_t a, uint64_t b, uint64_t c, uint64_t d,
+                                 uint64_t miss, uint64_t rare, uint64_t requ)
+{
+    const uint64_t carrier1 = a | b;
+    const uint64_t carrier2 = c | d;
+    const uint64_t opposite = (~carrier1 & c & d) | (a & b & ~carrier2);
+    const uint64_t shared = carrier1 & carrier2 & rare;
+    const uint64_t requested = requ & (carrier1 | carrier2);
+    return (opposite | shared | requested) & ~miss;
+}
+
+}
+
+#endif
@@ -7,11 +7,34 @@
 #include <stdexcept>
 #include <iostream>
 #include <memory>
+#include <string.h>
 
 
 
 namespace stringops {
     using std::string;
+
+    // A non-owning view of part of a string, standing in for C++17's
+    // string_view. Whatever buffer it points into has to outlive it.
+    struct StringSpan {
+        const char* data;
+        size_t size;
+
+        StringSpan(void) : data(NULL), size(0) {}
+        StringSpan(const char* d, size_t n) : data(d), size(n) {}
+
+        inline bool empty(void) const { return size == 0; }
+        inline string str(void) const { return string(data, size); }
+        inline const char* end(void) const { return data + size; }
+        inline bool operator==(const string& s) const {
+            return s.size() == size && !memcmp(s.data(), data, size);
+        }
+        inline bool operator!=(const string& s) const { return !(*this == s); }
+        inline size_t count(char c) const {
+            return std::count(data, data + size, c);
+        }
+    };
+
     bool endswith(const string& s, const string& suffix);
     string join(const std::vector<string>& v, const string& delim);
     std::vector<string> split(const string& s, const char* delim, int nsplit=-1);
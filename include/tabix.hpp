@@ -0,0 +1,63 @@
+#ifndef TABIX_HPP
+#define TABIX_HPP
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// Reading tabix (.tbi) and CSI (.csi) indexes of bgzipped files, the way
+// htslib writes them. Both split each chromosome into a hierarchy of bins
+// and record, for each bin, the runs of the file ("chunks") holding the
+// records that fall in it, so a region query turns into a short list of
+// places to seek to.
+namespace tabix {
+
+// A run of a BGZF file between two virtual offsets. A virtual offset is
+// the file offset of a block shifted left 16 bits, plus an offset into
+// the block's decompressed data.
+typedef std::pair<uint64_t, uint64_t> Chunk;
+
+// Looks for filename.csi, then filename.tbi. Returns an empty string if
+// neither exists.
+std::string find_index(const std::string& filename);
+
+// Bins overlapping [beg, end) (0-based, half open) in a binning scheme
+// with the smallest bins 2^min_shift wide and depth levels below the root
+std::vector<uint32_t> reg2bins(int64_t beg, int64_t end, int min_shift, int depth);
+
+class Index {
+public:
+    // Loads a .tbi or .csi file. Throws std::runtime_error if it isn't one.
+    Index(const std::string& filename);
+
+    bool has_chrom(const std::string& chrom) const;
+
+    // Chunks holding every record on chrom that overlaps positions
+    // [start, end] (1-based, inclusive), sorted and with overlaps merged.
+    // They can also hold records outside the region.
+    std::vector<Chunk> query(const std::string& chrom, int start, int end) const;
+
+private:
+    struct Bin {
+        uint64_t loffset;           // CSI only: no record overlapping the bin starts earlier
+        std::vector<Chunk> chunks;
+    };
+
+    struct Reference {
+        std::map<uint32_t, Bin> bins;
+        std::vector<uint64_t> linear;   // tbi only: first record in each 2^min_shift window
+    };
+
+    int min_shift;
+    int depth;
+    std::map<std::string, size_t> names;
+    std::vector<Reference> refs;
+
+    uint64_t min_offset(const Reference& ref, int64_t beg) const;
+};
+
+}
+
+#endif
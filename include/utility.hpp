@@ -56,6 +56,9 @@ inline int randint(int lo, int hi) {
 std::vector<ValueRun> runs_gte(const std::vector<int>& v, int thresh);
 std::vector<ValueRun> runs_gte_classic(std::vector<int>& sequence, int minval, int minlength);
 
+// Size of the L2 cache in bytes (or a conservative guess if unknown)
+size_t l2_cache_size(void);
+
 std::string current_time_string(void);
 std::string print_elapsed(const timeval& t);
 
@@ -19,6 +19,8 @@
 #include "stringops.hpp"
 #include "datamodel.hpp"
 #include "FileIOManager.hpp"
+#include "bgzf.hpp"
+#include "vcfinfo.hpp"
 
 
 // Receives variant calls from VCFRecord
@@ -26,6 +28,9 @@ struct VCFRecordGenotypeContainer {
     size_t ninds; 
     std::vector<size_t> missing;
     std::vector<size_t> alts;
+
+    // Genotypes that couldn't be decoded (and were marked missing)
+    size_t malformed;
     VCFRecordGenotypeContainer(size_t n);
 
     // Set minor alleles to major and vice-versa. Ignores missing sites.
@@ -35,11 +40,19 @@ struct VCFRecordGenotypeContainer {
     double allele_frequency(void) const;
     inline bool monomorphic(void) const { return alts.size() == 0; }
     inline bool singleton(void) const { return alts.size() == 1; }
-    inline void clear(void) { missing.clear(); alts.clear(); }
+    inline void clear(void) { missing.clear(); alts.clear(); malformed = 0; }
 
 
 };
 
+enum GTCall { GT_CALLED, GT_MISSING, GT_MALFORMED };
+
+// Decodes the text GT field [gt, end): whether each haplotype carries a
+// non-reference allele. Takes phased or unphased diploid calls with any
+// number of digits per allele, and haploid calls, which count as
+// homozygous. A '.' anywhere makes the call missing.
+GTCall decode_gt(const char* gt, const char* end, bool& alt_a, bool& alt_b);
+
 struct VCFParams {
     bool drop_singletons;
     bool drop_monomorphs;
@@ -70,13 +83,163 @@ public:
     
     // Returns the frequency specified from an INFO field, otherwise 0.0;
     double get_info_freq(const std::string& info_field);
-    inline int nalleles(void) const;
-    inline bool is_snv(void) const;
+    int nalleles(void) const;
+    bool is_snv(void) const;
+};
+
+
+// A VCF data line parsed in place. Every field is a span into the line,
+// which has to outlive the record, so nothing is copied. Genotypes are
+// decoded straight out of the line by get_minor_alleles. Gives the same
+// results as VCFRecord.
+class VCFRecordView {
+public:
+    typedef stringops::StringSpan Span;
+
+    Span chrom;
+    int pos;
+    Span label;
+    Span ref;
+    Span alt;
+    Span infostr;
+    Span format;
+    Span data;      // All the sample columns
+
+    VCFRecordView(const char* line, size_t len);
+    void get_minor_alleles(VCFRecordGenotypeContainer& container) const;
+
+    // Returns the frequency specified from an INFO field, otherwise 0.0;
+    double get_info_freq(const std::string& info_field) const;
+    inline double get_info_freq(const VCFInfoKey& key) const {
+        return key.number(infostr.data, infostr.size);
+    }
+    int nalleles(void) const;
+    bool is_snv(void) const;
+
+private:
+    // Index of GT among the FORMAT fields
+    int gt_index(void) const;
+};
+
+
+// Variants at positions [start, end] (1-based, inclusive) on one
+// chromosome. The default region is the whole file.
+struct VCFRegion {
+    std::string chrom;
+    int start;
+    int end;
+
+    VCFRegion(void);
+
+    // Parses "chrom", "chrom:start-end", "chrom:start-" or "chrom:pos".
+    // Throws std::invalid_argument if it can't.
+    VCFRegion(const std::string& spec);
+
+    inline bool whole_file(void) const { return chrom.empty(); }
+
+    bool contains(const std::string& chrom, int pos) const;
+
+    // Does a raw VCF line fall in the region? Only looks at the first two
+    // fields.
+    bool contains_line(const std::string& line) const;
+    bool contains_line(const char* line, size_t len) const;
 };
 
+// One variant, parsed and filtered but not yet added to a Dataset.
+// Parsing doesn't depend on any other variant, so it can be done in any
+// order; merging (VCFMerger) has to be done in file order.
+struct VCFParsedLine {
+    std::string chrom;
+    std::string label;
+    int pos;
+    const char* exclusion;      // Why the marker was dropped, or NULL if kept
+    size_t malformed;           // Genotypes that couldn't be decoded
+    double freq;
+    std::vector<size_t> missing;
+    std::vector<size_t> alts;
+};
 
+// Applies the loading filters to a record and collects its minor alleles.
+// Record is anything with VCFRecordView's interface (chrom, label, pos,
+// is_snv, nalleles, get_minor_alleles, get_info_freq), so text and BCF
+// input are filtered identically. freq_key is fileparams.freq_field,
+// looked up once per file in whatever form Record::get_info_freq takes:
+// a VCFInfoKey for text, an index into the header for BCF.
+template <typename Record, typename InfoKey>
+void parse_record(const Record& rec, const VCFParams& fileparams, const InfoKey& freq_key,
+                  VCFRecordGenotypeContainer& con, VCFParsedLine& out)
+{
+    con.clear();
+
+    out.chrom.assign(rec.chrom.data, rec.chrom.size);
+    out.label.assign(rec.label.data, rec.label.size);
+    out.pos = rec.pos;
+    out.exclusion = NULL;
+    out.malformed = 0;
+    out.freq = 0.0;
+    out.missing.clear();
+    out.alts.clear();
+
+    if (!rec.is_snv()) {
+        out.exclusion = "Non-SNV";
+        return;
+    }
+
+    if (rec.nalleles() > 2) {
+        out.exclusion = "Non-diallelic";
+        return;
+    }
+
+    rec.get_minor_alleles(con);
+    out.malformed = con.malformed;
+
+    if (fileparams.drop_monomorphs && con.monomorphic()) {
+        out.exclusion = "Monomorphic";
+        return;
+    }
+
+    if (fileparams.drop_singletons && con.singleton()) {
+        out.exclusion = "Singleton";
+        return;
+    }
+
+    double fq = fileparams.empirical_freqs ?
+                con.allele_frequency() :
+                rec.get_info_freq(freq_key);
+
+    if (fq > 0.5) {
+        con.invert();
+        fq = 1 - fq;
+    }
+
+    out.freq = fq;
+    out.missing = con.missing;
+    out.alts = con.alts;
+}
+
+// Adds parsed variants to a Dataset, in file order
+class VCFMerger {
+public:
+    VCFMerger(Dataset& d) : data(d), chromidx(-1), markidx(0) {}
+    void add(const VCFParsedLine& rec);
+
+private:
+    Dataset& data;
+    std::string last_chromid;
+    int chromidx;
+    int markidx;
+};
 
-Dataset read_vcf(const std::string& filename, const VCFParams& fileparams);
+// Reads a VCF file (or a BCF file, if the name ends in .bcf; see bcf.hpp).
+// With nthreads > 1, lines are parsed on that many
+// threads while they are read; the result is the same either way.
+//
+// Only variants in region are loaded. If the file is bgzipped and has a
+// tabix or CSI index, only the parts of the file the index points to are
+// read; otherwise lines outside the region are skipped before their
+// genotypes are parsed.
+Dataset read_vcf(const std::string& filename, const VCFParams& fileparams, int nthreads=1,
+                 const VCFRegion& region=VCFRegion());
 void write_vcf(const Dataset& d, const std::string& fn);
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef VCFINFO_HPP
+#define VCFINFO_HPP
+
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stringops.hpp"
+
+// Looking up one INFO key in the INFO column of many records. The key is
+// set up once, and each lookup scans the column in place: a token is only
+// compared against the key if its first byte matches, and the scan skips
+// to the next ';' otherwise. Nothing is copied or allocated.
+//
+// Header only, so small tools (see support/) can use it without linking
+// the rest of adios.
+class VCFInfoKey {
+public:
+    typedef stringops::StringSpan Span;
+
+    VCFInfoKey(const std::string& k) : key(k) {}
+
+    inline const std::string& name(void) const { return key; }
+
+    // Finds the key in an INFO column ("K=V;FLAG;..."). On success value
+    // is what follows "K=", up to the next ';' or '=', which is empty for
+    // a flag.
+    inline bool find(const char* info, size_t len, Span& value) const {
+        const size_t klen = key.size();
+        if (!klen) { return false; }
+        const char first = key[0];
+
+        const char* p = info;
+        const char* end = info + len;
+        while (p < end) {
+            if (*p == first && (size_t)(end - p) >= klen && !memcmp(p, key.data(), klen)) {
+                const char* after = p + klen;
+                if (after == end || *after == ';') {
+                    value = Span(after, 0);
+                    return true;
+                }
+                if (*after == '=') {
+                    const char* v = after + 1;
+                    const char* vend = v;
+                    while (vend != end && *vend != ';' && *vend != '=') { vend++; }
+                    value = Span(v, vend - v);
+                    return true;
+                }
+            }
+            const char* semi = static_cast<const char*>(memchr(p, ';', end - p));
+            if (!semi) { break; }
+            p = semi + 1;
+        }
+        return false;
+    }
+
+    // The key's value as a number, read the way atof would (so the first
+    // of a list of values). 0.0 if the key is missing or a flag.
+    inline double number(const char* info, size_t len) const {
+        Span value;
+        if (!find(info, len, value) || value.empty()) { return 0.0; }
+
+        // atof needs a terminated string; a number can't be this long
+        char buf[64];
+        size_t n = value.size < sizeof(buf) - 1 ? value.size : sizeof(buf) - 1;
+        memcpy(buf, value.data, n);
+        buf[n] = '\0';
+        return atof(buf);
+    }
+
+private:
+    std::string key;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef WORKSTEALING_HPP
+#define WORKSTEALING_HPP
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace adios {
+
+// How one thread spent its time on a set of tasks
+struct ThreadLoad {
+    double busy;        // Seconds spent running tasks
+    double idle;        // Seconds spent looking for work or waiting for the others
+    long tasks;         // Number of tasks run
+    long stolen;        // Number of tasks taken from other threads
+
+    ThreadLoad(void) : busy(0), idle(0), tasks(0), stolen(0) {}
+};
+
+// Hands out tasks 0..ntasks-1 to a fixed set of threads, for work whose
+// cost varies a lot from task to task (e.g. pair blocks, where a block of
+// relatives can take far longer than one of unrelated pairs).
+//
+// Each thread starts with a contiguous range of the tasks in its own
+// deque. It claims chunks from the front of it, sized from how long its
+// recent tasks took, so cheap tasks don't cost a lock each and expensive
+// ones don't get hoarded. A thread that runs out steals the back half of
+// another thread's range.
+//
+// Every thread runs the tasks in its deque in increasing order, and only
+// steals once it has nothing of its own left, so the lowest task not yet
+// finished is always either running or next up for its owner.
+// SegmentWriter relies on that to make progress under backpressure.
+class WorkStealingScheduler {
+public:
+    WorkStealingScheduler(long ntasks, int nthreads);
+
+    // The next task for thread tid. Returns false once every task has
+    // been handed out.
+    bool next(int tid, long& task);
+
+    // Report that tid's last task took the given time
+    void done(int tid, double seconds);
+
+    // Per thread statistics, with idle time worked out from the wall
+    // clock time the tasks took as a whole
+    std::vector<ThreadLoad> loads(double elapsed) const;
+
+private:
+    WorkStealingScheduler(const WorkStealingScheduler&);
+    WorkStealingScheduler& operator=(const WorkStealingScheduler&);
+
+    struct Worker {
+        std::mutex mtx;
+        long lo;                // Tasks [lo, hi) are in the deque
+        long hi;
+
+        // Owner only
+        long chunk_next;        // Claimed tasks [chunk_next, chunk_end)
+        long chunk_end;
+        double mean_seconds;    // Moving average of task time
+        ThreadLoad load;
+
+        char pad[64];           // Keep workers off each other's cache lines
+
+        Worker(void) : lo(0), hi(0), chunk_next(0), chunk_end(0), mean_seconds(0) {}
+    };
+
+    long claim(Worker& w);
+    bool steal(int tid);
+
+    std::vector<Worker> workers_;
+    std::atomic<long> unclaimed_;
+};
+
+}
+
+#endif
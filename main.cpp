@@ -22,6 +22,7 @@
 #endif
 
 #include "vcf.hpp"
+#include "datacache.hpp"
 #include "adios.hpp"
 #include "ArgumentParser.hpp"
 #include "datamodel.hpp"
@@ -52,8 +53,12 @@ int main(int argc, char** argv) {
     ArgumentParser parser;
     std::vector<CommandLineArgument> arginfo = {
         //                  Argument           Action       Default               narg  help string
-        CommandLineArgument{"vcf",               "store",     {""},               1,    "VCF input file"},
+        CommandLineArgument{"vcf",               "store",     {"-"},              1,    "VCF input file"},
         CommandLineArgument{"vcf_freq",          "store",     {"-"},              1,    "VCF INFO field containing allele frequency"},
+        CommandLineArgument{"region",            "store",     {"-"},              1,    "Only load variants in region chrom:start-end"},
+        CommandLineArgument{"chrom",             "store",     {"-"},              1,    "Only load variants on this chromosome"},
+        CommandLineArgument{"save_cache",        "store",     {"-"},              1,    "Save the loaded dataset to a binary cache file (.adb)"},
+        CommandLineArgument{"load_cache",        "store",     {"-"},              1,    "Load the dataset from a binary cache file instead of a VCF"},
         CommandLineArgument{"include",           "store",     {"-"},              1,    "Subset of individuals to include"},
         CommandLineArgument{"out",               "store",     {"-"},              1,    "Output file prefix"},
         CommandLineArgument{"keep_singletons",   "store_yes", {"NO"},             0,    "Include singleton variants from dataset"},
@@ -66,10 +71,19 @@ int main(int argc, char** argv) {
         CommandLineArgument{"err",               "store",     {"0.001"},          1,    "Allele error rate"},
         CommandLineArgument{"transition",        "store",     {"4", "3"},         2,    "IBD entrance/exit penalty: P(Transition) = 10^(-x))"},
         CommandLineArgument{"threads",           "store",     {"1"},              1,    OMP_AVAILABLE ? "Number of threads" : "SUPPRESS"},
+        CommandLineArgument{"schedule",          "store",     {"chromosome"},     1,    OMP_AVAILABLE ? "Thread scheduling: chromosome, global or steal" : "SUPPRESS"},
+        CommandLineArgument{"engine",            "store",     {"pair"},           1,    "HMM engine: pair, or batch to decode several pairs at once"},
+        CommandLineArgument{"prefilter",         "store_yes", {"NO"},             0,    "Skip pairs sharing fewer than --minmark rare variants on a chromosome"},
+        CommandLineArgument{"prefilter_window",  "store",     {"0"},              1,    "Only count rare variants shared within windows this long (Mb), 0 for whole chromosomes"},
+        CommandLineArgument{"carrier_memory",    "store",     {"1024"},           1,    "Memory limit for the index of rare variant carriers (MB)"},
         CommandLineArgument{"help",              "store_yes", {"NO"},             0,    "Display this help message"   },
         CommandLineArgument{"version",           "store_yes", {"NO"},             0,    "Print version information"   },
         CommandLineArgument{"fine_ends",         "store_yes", {"NO"},             0,    "Fine-map segment ends with all available genotypes"},
-        CommandLineArgument{"viterbi",           "store_yes", {"NO"},             0,    "Use maximum a posteriori decoding"}
+        CommandLineArgument{"viterbi",           "store_yes", {"NO"},             0,    "Use maximum a posteriori decoding"},
+        CommandLineArgument{"packed",            "store_yes", {"NO"},             0,    "Store genotypes as bit-packed matrices"},
+        CommandLineArgument{"output_buffer",     "store",     {"256"},            1,    "Memory limit for output waiting to be written (MB)"},
+        CommandLineArgument{"binary",            "store_yes", {"NO"},             0,    "Write segments in indexed binary format (.ibdb)"},
+        CommandLineArgument{"convert",           "store",     {"-"},              1,    "Convert a binary segment file to text and exit"}
 
     };
     for (auto argi : arginfo) { parser.add_argument(argi); }
@@ -92,8 +106,29 @@ int main(int argc, char** argv) {
         return 0;
     }
 
+    // Converting binary output doesn't need anything else
+    if (parser.args["convert"][0].compare("-") != 0) {
+        std::string outprefix = parser.args["out"][0];
+        std::string output_filename = !(outprefix.compare("-")) ? "-" : (outprefix + ".ibd");
+        try {
+            DelimitedFileWriter output(output_filename, '\t');
+            segfile::convert(parser.args["convert"][0], output);
+            output.closefile();
+        } catch (const std::exception& e) {
+            std::cerr << "Could not convert " << parser.args["convert"][0] << ": " << e.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
     std::vector<std::string> errors = parser.validate_args();
 
+    bool has_vcf = parser.args["vcf"][0].compare("-") != 0;
+    bool has_cache = parser.args["load_cache"][0].compare("-") != 0;
+    if (has_vcf == has_cache) {
+        errors.push_back("Exactly one of --vcf and --load_cache is required");
+    }
+
     if (!errors.empty()) {
         for (auto e : errors) {
             std::cerr << e << '\n';
@@ -119,6 +154,7 @@ int main(int argc, char** argv) {
 
 
     bool empirical_freqs = !(args["vcf_freq"][0].compare("-"));
+    bool save_cache = args["save_cache"][0].compare("-") != 0;
 
     log << "adios v0.8\n";
     log << "Started at " << sprog_start << "\n";
@@ -142,10 +178,20 @@ int main(int argc, char** argv) {
 #endif
 
 
-    adios::adios_parameters params = adios::params_from_args(args);
+    adios::adios_parameters params;
+    try {
+        params = adios::params_from_args(args);
+    } catch (const std::invalid_argument& e) {
+        log << e.what() << '\n';
+        return 64;
+    }
 
-    log << "VCF file: " << args["vcf"][0] << '\n';
-    log << "Frequencies: " << (empirical_freqs ? std::string("Calculated from dataset") : args["vcf_freq"][0]) << '\n';
+    if (has_cache) {
+        log << "Dataset cache: " << args["load_cache"][0] << '\n';
+    } else {
+        log << "VCF file: " << args["vcf"][0] << '\n';
+        log << "Frequencies: " << (empirical_freqs ? std::string("Calculated from dataset") : args["vcf_freq"][0]) << '\n';
+    }
     log << "Rare frequency threshold: " << params.rare_thresh << '\n';
     log << "Transition costs: " << params.gamma_ << " (IBD entry), " << params.rho << " (IBD exit)\n";
     log << "Minimum segment LOD: " << params.min_lod << '\n';
@@ -153,9 +199,26 @@ int main(int argc, char** argv) {
     log << "Minimum markers to declare IBD: " << params.min_mark << '\n';
     log << "Genotype error rate: " << params.err_rate << '\n';
     log << "Decoding: " << (params.viterbi ? "MAP" : "ML") << '\n';
+    log << "HMM engine: " << (params.engine == adios::ENGINE_BATCH ? "batched" : "one pair at a time") << '\n';
+    if (params.prefilter) {
+        log << "Pair pre-filter: at least " << params.min_mark << " shared rare variants";
+        if (params.prefilter_window) { log << " within " << bp_formatter(params.prefilter_window) << " windows"; }
+        log << '\n';
+    }
+    log << "Output format: " << (params.binary_output ? "binary" : "text") << '\n';
+    log << "Genotype storage: " << (params.packed ? "bit-packed" : "sparse") << '\n';
+    if (params.packed) {
+        log << "Site classification kernel: " << sitekernel::name(sitekernel::KERNEL_AUTO) << '\n';
+    }
 
 #ifdef HAVE_OPENMP
     log << "Threads: " << nthreads << '\n';
+    log << "Scheduling: ";
+    switch (params.schedule) {
+        case adios::SCHEDULE_GLOBAL: log << "global\n"; break;
+        case adios::SCHEDULE_STEAL: log << "per chromosome, work stealing\n"; break;
+        default: log << "per chromosome\n"; break;
+    }
 #endif
 
     log << '\n';
@@ -167,19 +230,83 @@ int main(int argc, char** argv) {
                      };
 
 
+    bool has_region = args["region"][0].compare("-") != 0;
+    bool has_chrom = args["chrom"][0].compare("-") != 0;
+    if (has_region && has_chrom) {
+        log << "--region and --chrom can't be used together\n";
+        return 64;
+    }
+    if (has_cache && (has_region || has_chrom)) {
+        log << "--region and --chrom can't be used with --load_cache\n";
+        return 64;
+    }
+
+    VCFRegion region;
+    if (has_chrom) {
+        region.chrom = args["chrom"][0];
+        log << "Chromosome: " << region.chrom << '\n';
+    }
+    if (has_region) {
+        try {
+            region = VCFRegion(args["region"][0]);
+        } catch (const std::invalid_argument& e) {
+            log << e.what() << '\n';
+            return 64;
+        }
+        log << "Region: " << args["region"][0] << '\n';
+    }
+
     auto start = std::chrono::steady_clock::now();
     
     Dataset data;
-    try {
-        data = read_vcf(args["vcf"][0], vcfp);
-    } catch (const std::exception& e) {
-        log << "Could not process file: " << args["vcf"][0] << ": ";
-        log << e.what() << '\n';
-        return 1;
+    datacache::Source source = {args["vcf"][0], vcfp};
+    if (has_cache) {
+        // The cache holds the data as it was read, so the frequency
+        // handling it was read with carries over
+        try {
+            data = datacache::load(args["load_cache"][0], source);
+        } catch (const std::exception& e) {
+            log << "Could not load cache: " << e.what() << '\n';
+            return 1;
+        }
+        empirical_freqs = source.params.empirical_freqs;
+        log << "Cache built from: " << source.filename << '\n';
+        log << "Frequencies: " << (empirical_freqs ? std::string("Calculated from dataset") : source.params.freq_field) << "\n\n";
+    } else {
+        try {
+            data = read_vcf(args["vcf"][0], vcfp, nthreads, region);
+        } catch (const std::exception& e) {
+            log << "Could not process file: " << args["vcf"][0] << ": ";
+            log << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    if (save_cache) {
+        try {
+            datacache::save(args["save_cache"][0], data, source);
+        } catch (const std::exception& e) {
+            log << "Could not save cache: " << e.what() << '\n';
+            return 1;
+        }
+        log << "Saved dataset cache: " << args["save_cache"][0] << '\n';
     }
 
     params.get_rare_sites(data);
 
+    // Who carries each rare variant, for the pre-filter. It's built for
+    // the sites get_rare_sites just picked, before frequencies are rounded.
+    if (params.prefilter) {
+        data.index_carriers(params.rare_thresh, params.carrier_memory);
+        size_t nindexed = 0, bytes = 0;
+        for (const CarrierIndex& c : data.carriers) {
+            nindexed += c.built;
+            bytes += c.bytes();
+        }
+        log << "Indexed rare variant carriers on " << nindexed << " of " << data.nchrom();
+        log << " chromosomes (" << sfloat(bytes / double(1 << 20), 1) << "MB)\n";
+    }
+
     // If we calculated the data we can round them to a sensible place too.
     if (empirical_freqs) {
         data.round_frequencies(4);
@@ -211,6 +338,10 @@ int main(int argc, char** argv) {
             log << '\n';
         }
 
+        if (c->malformed_genotypes) {
+            log << c->malformed_genotypes << " malformed genotypes marked missing\n";
+        }
+
         log << '\n';
     }
 
@@ -220,10 +351,10 @@ int main(int argc, char** argv) {
     // Extract the subset individuals if provided
     if (args["include"][0].compare("-") != 0) {
         std::set<std::string> includelabs;
-        UncompressedFile incf(args["include"][0]);
-        while (incf.good()) {
-            std::string indlab = incf.getline();
-            includelabs.insert(indlab);
+        LineReader incf(args["include"][0]);
+        stringops::StringSpan indlab;
+        while (incf.getline(indlab)) {
+            includelabs.insert(indlab.str());
         }
 
         data.subset(includelabs);
@@ -231,10 +362,30 @@ int main(int argc, char** argv) {
 
     log << "Retained " << data.ninds() << " individuals\n";
 
+    if (params.packed) { data.pack(); }
+
     std::string output_filename = !(args["out"][0].compare("-")) ? 
-                                   "-" : (args["out"][0] + ".ibd");  
+                                   "-" : (args["out"][0] + (params.binary_output ? ".ibdb" : ".ibd"));
     DelimitedFileWriter output(output_filename, '\t');
-    adios::adios(data, params, output);
+    adios::ChromosomeLoads loads;
+    adios::adios(data, params, output, &loads);
+
+#ifdef HAVE_OPENMP
+    // How evenly the work was spread, as busy/idle seconds for each thread
+    if (nthreads > 1 && !loads.empty()) {
+        log << "\nThread load (busy/idle seconds and blocks run by each thread)\n";
+        for (size_t chridx = 0; chridx < loads.size(); ++chridx) {
+            log << "Chromosome " << data.chromosomes[chridx]->label << ':';
+            for (size_t t = 0; t < loads[chridx].size(); ++t) {
+                const adios::ThreadLoad& l = loads[chridx][t];
+                log << "  [" << t << "] " << sfloat(l.busy, 2) << '/' << sfloat(l.idle, 2);
+                log << "s " << l.tasks;
+                if (l.stolen) { log << " (" << l.stolen << " stolen)"; }
+            }
+            log << '\n';
+        }
+    }
+#endif
 
     log << "\nCompleted at " << current_time_string() << '\n';
     
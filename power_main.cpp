@@ -18,6 +18,7 @@
 #endif
 
 #include "vcf.hpp"
+#include "datacache.hpp"
 #include "adios.hpp"
 #include "power.hpp"
 #include "ArgumentParser.hpp"
@@ -40,7 +41,9 @@ int main(int argc, char** argv) {
     ArgumentParser parser;
     std::vector<CommandLineArgument> arginfo = {
         //                  Argument           Action       Default               narg  help string
-        CommandLineArgument{"vcf",               "store",     {""},               1,    "VCF input file"},
+        CommandLineArgument{"vcf",               "store",     {"-"},              1,    "VCF input file"},
+        CommandLineArgument{"save_cache",        "store",     {"-"},              1,    "Save the loaded dataset to a binary cache file (.adb)"},
+        CommandLineArgument{"load_cache",        "store",     {"-"},              1,    "Load the dataset from a binary cache file instead of a VCF"},
         CommandLineArgument{"vcf_freq",          "store",     {"-"},              1,    "VCF INFO field containing allele frequency"},
         CommandLineArgument{"out",               "store",     {"-"},              1,    "Output file prefix"},
         CommandLineArgument{"keep_singletons",   "store_yes", {"NO"},             0,    "Include singleton variants from dataset"},
@@ -84,6 +87,12 @@ int main(int argc, char** argv) {
 
     std::vector<std::string> errors = parser.validate_args();
 
+    bool has_vcf = parser.args["vcf"][0].compare("-") != 0;
+    bool has_cache = parser.args["load_cache"][0].compare("-") != 0;
+    if (has_vcf == has_cache) {
+        errors.push_back("Exactly one of --vcf and --load_cache is required");
+    }
+
     if (!errors.empty()) {
         for (auto e : errors) {
             std::cerr << e << '\n';
@@ -106,6 +115,7 @@ int main(int argc, char** argv) {
     int nthreads = atoi(args["threads"][0].c_str());
 
     bool empirical_freqs = !(args["vcf_freq"][0].compare("-"));
+    bool save_cache = args["save_cache"][0].compare("-") != 0;
 
     log << "adios_power v0.1\n\n";
 
@@ -136,8 +146,12 @@ int main(int argc, char** argv) {
 
     adios::adios_parameters params = adios::params_from_args(args);
 
-    log << "VCF file: " << args["vcf"][0] << '\n';
-    log << "Frequencies: " << (empirical_freqs ? std::string("Calculated from dataset") : args["vcf_freq"][0]) << '\n';
+    if (has_cache) {
+        log << "Dataset cache: " << args["load_cache"][0] << '\n';
+    } else {
+        log << "VCF file: " << args["vcf"][0] << '\n';
+        log << "Frequencies: " << (empirical_freqs ? std::string("Calculated from dataset") : args["vcf_freq"][0]) << '\n';
+    }
     log << "Rare frequency threshold: " << params.rare_thresh << '\n';
     log << "Transition costs: " << params.gamma_ << " (IBD entry), " << params.rho << " (IBD exit)\n";
     log << "Minimum segment LOD: " << params.min_lod << '\n';
@@ -163,12 +177,35 @@ int main(int argc, char** argv) {
     auto start = std::chrono::steady_clock::now();
     
     Dataset data;
-    try {
-        data = read_vcf(args["vcf"][0], vcfp);
-    } catch (const std::exception& e) {
-        log << "Could not process file: " << args["vcf"][0] << ": ";
-        log << e.what() << '\n';
-        return 1;
+    datacache::Source source = {args["vcf"][0], vcfp};
+    if (has_cache) {
+        try {
+            data = datacache::load(args["load_cache"][0], source);
+        } catch (const std::exception& e) {
+            log << "Could not load cache: " << e.what() << '\n';
+            return 1;
+        }
+        empirical_freqs = source.params.empirical_freqs;
+        log << "Cache built from: " << source.filename << '\n';
+        log << "Frequencies: " << (empirical_freqs ? std::string("Calculated from dataset") : source.params.freq_field) << "\n\n";
+    } else {
+        try {
+            data = read_vcf(args["vcf"][0], vcfp, nthreads);
+        } catch (const std::exception& e) {
+            log << "Could not process file: " << args["vcf"][0] << ": ";
+            log << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    if (save_cache) {
+        try {
+            datacache::save(args["save_cache"][0], data, source);
+        } catch (const std::exception& e) {
+            log << "Could not save cache: " << e.what() << '\n';
+            return 1;
+        }
+        log << "Saved dataset cache: " << args["save_cache"][0] << '\n';
     }
 
     params.get_rare_sites(data);
@@ -204,6 +241,10 @@ int main(int argc, char** argv) {
             log << '\n';
         }
 
+        if (c->malformed_genotypes) {
+            log << c->malformed_genotypes << " malformed genotypes marked missing\n";
+        }
+
         log << '\n';
     }
 
@@ -0,0 +1,74 @@
+#include "prefilter.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace prefilter {
+
+PairFilter::PairFilter(const CarrierIndex& index, const ChromInfo& chrom,
+                       const combinatorics::PairBlock& b, int threshold, int window)
+    : block(b), ncols(b.j_stop - b.j_start)
+{
+    long nrows = block.i_stop - block.i_start;
+    passed.assign(nrows * ncols, threshold <= 0);
+    if (threshold <= 0) { return; }
+
+    // Counts for the current window and the one before it, and the pairs
+    // each has touched, so moving on to the next window only costs as
+    // much as the pairs that had co-carried variants in it.
+    const uint16_t saturated = std::numeric_limits<uint16_t>::max();
+    std::vector<uint16_t> current(nrows * ncols, 0), previous(nrows * ncols, 0);
+    std::vector<long> touched_current, touched_previous;
+    long current_window = -1;
+
+    auto close_window = [&](void) {
+        for (long p : touched_current) {
+            if ((int)current[p] + previous[p] >= threshold) { passed[p] = 1; }
+        }
+        for (long p : touched_previous) { previous[p] = 0; }
+        touched_previous.clear();
+        for (long p : touched_current) {
+            previous[p] = current[p];
+            current[p] = 0;
+        }
+        touched_previous.swap(touched_current);
+    };
+
+    for (size_t k = 0; k < index.nsites(); ++k) {
+        long w = window > 0 ? chrom.positions[index.sites[k]] / window : 0;
+        if (w != current_window) {
+            // Windows more than one apart don't count together
+            if (w > current_window + 1) { close_window(); }
+            close_window();
+            current_window = w;
+        }
+
+        const int* first = index.begin(k);
+        const int* last = index.end(k);
+        const int* rows = std::lower_bound(first, last, (int)block.i_start);
+        const int* rows_end = std::lower_bound(rows, last, (int)block.i_stop);
+        const int* cols = std::lower_bound(first, last, (int)block.j_start);
+        const int* cols_end = std::lower_bound(cols, last, (int)block.j_stop);
+
+        for (const int* a = rows; a != rows_end; ++a) {
+            // Only pairs with i < j are in the block
+            const int* c = std::upper_bound(cols, cols_end, *a);
+            long base = (*a - block.i_start) * ncols - block.j_start;
+            for (; c != cols_end; ++c) {
+                long p = base + *c;
+                if (!current[p]) { touched_current.push_back(p); }
+                if (current[p] != saturated) { current[p]++; }
+            }
+        }
+    }
+    close_window();
+}
+
+long PairFilter::npassed(void) const
+{
+    long n = 0;
+    block.for_each_pair([&](long i, long j) { n += passes(i, j); });
+    return n;
+}
+
+}
@@ -0,0 +1,254 @@
+#include "segmentfile.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+#include "utility.hpp"
+
+namespace segfile {
+
+static_assert(sizeof(Record) == 40, "segfile::Record must not be padded");
+
+static const char HEADER_MAGIC[8] = {'A', 'D', 'I', 'O', 'S', 'S', 'E', 'G'};
+static const char TRAILER_MAGIC[8] = {'A', 'D', 'I', 'O', 'S', 'I', 'D', 'X'};
+static const size_t HEADER_SIZE = 16;
+static const size_t TRAILER_SIZE = 16;
+
+template <typename T>
+static inline void put(std::string& buf, const T& v) {
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+static inline void put_string(std::string& buf, const std::string& s) {
+    put(buf, (uint32_t)s.size());
+    buf.append(s);
+}
+
+// Reads fixed size values back out of a serialized footer
+class Cursor {
+public:
+    Cursor(const std::string& b) : buf(b), pos(0) {}
+
+    template <typename T> T get(void) {
+        T v;
+        need(sizeof(T));
+        memcpy(&v, buf.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return v;
+    }
+
+    std::string get_string(void) {
+        uint32_t len = get<uint32_t>();
+        need(len);
+        std::string s = buf.substr(pos, len);
+        pos += len;
+        return s;
+    }
+
+private:
+    const std::string& buf;
+    size_t pos;
+
+    void need(size_t n) {
+        if (buf.size() - pos < n) { throw std::runtime_error("Truncated segment file index"); }
+    }
+};
+
+void Index::summarize_chromosomes(void)
+{
+    for (ChromEntry& c : chromosomes) {
+        c.first_record = 0;
+        c.nrecords = 0;
+    }
+    std::vector<bool> seen(chromosomes.size(), false);
+    for (const BlockEntry& b : blocks) {
+        ChromEntry& c = chromosomes.at(b.chrom);
+        if (!seen[b.chrom]) {
+            c.first_record = b.first_record;
+            seen[b.chrom] = true;
+        }
+        c.nrecords += b.nrecords;
+    }
+}
+
+std::string header(void)
+{
+    std::string buf(HEADER_MAGIC, sizeof(HEADER_MAGIC));
+    put(buf, VERSION);
+    put(buf, (uint32_t)sizeof(Record));
+    return buf;
+}
+
+void append(std::string& buf, const Record& r)
+{
+    put(buf, r);
+}
+
+std::string footer(const Index& idx)
+{
+    std::string buf;
+
+    put(buf, (uint32_t)idx.individuals.size());
+    for (const std::string& label : idx.individuals) { put_string(buf, label); }
+
+    put(buf, (uint32_t)idx.chromosomes.size());
+    for (const ChromEntry& c : idx.chromosomes) {
+        put_string(buf, c.label);
+        put(buf, c.first_record);
+        put(buf, c.nrecords);
+    }
+
+    put(buf, (uint64_t)idx.blocks.size());
+    for (const BlockEntry& b : idx.blocks) {
+        put(buf, b.chrom);
+        put(buf, b.i_start);
+        put(buf, b.i_stop);
+        put(buf, b.j_start);
+        put(buf, b.j_stop);
+        put(buf, b.first_record);
+        put(buf, b.nrecords);
+    }
+
+    // The footer starts right after the last record
+    uint64_t records_end = 0;
+    for (const BlockEntry& b : idx.blocks) { records_end += b.nrecords; }
+    uint64_t footer_offset = HEADER_SIZE + records_end * sizeof(Record);
+
+    put(buf, footer_offset);
+    buf.append(TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+    return buf;
+}
+
+Reader::Reader(const std::string& fn) : nrecords(0), f(NULL), filename(fn)
+{
+    f = fopen(filename.c_str(), "rb");
+    if (!f) { throw std::invalid_argument("Couldn't open file: " + filename); }
+
+    char magic[8];
+    uint32_t version = 0;
+    uint32_t record_size = 0;
+    bool ok = (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) &&
+              (fread(&version, sizeof(version), 1, f) == 1) &&
+              (fread(&record_size, sizeof(record_size), 1, f) == 1);
+    if (!ok || memcmp(magic, HEADER_MAGIC, sizeof(magic))) {
+        fclose(f);
+        throw std::runtime_error("Not an adios segment file: " + filename);
+    }
+    if (version != VERSION || record_size != sizeof(Record)) {
+        fclose(f);
+        throw std::runtime_error("Unsupported segment file version: " + filename);
+    }
+
+    uint64_t footer_offset = 0;
+    ok = (fseeko(f, -(off_t)TRAILER_SIZE, SEEK_END) == 0) &&
+         (fread(&footer_offset, sizeof(footer_offset), 1, f) == 1) &&
+         (fread(magic, 1, sizeof(magic), f) == sizeof(magic));
+    off_t file_end = ftello(f);
+    if (!ok || memcmp(magic, TRAILER_MAGIC, sizeof(magic)) ||
+        footer_offset < HEADER_SIZE || footer_offset + TRAILER_SIZE > (uint64_t)file_end ||
+        (footer_offset - HEADER_SIZE) % sizeof(Record)) {
+        fclose(f);
+        throw std::runtime_error("Segment file has no index (incomplete?): " + filename);
+    }
+    nrecords = (footer_offset - HEADER_SIZE) / sizeof(Record);
+
+    std::string buf(file_end - TRAILER_SIZE - footer_offset, '\0');
+    if (fseeko(f, footer_offset, SEEK_SET) || fread(&buf[0], 1, buf.size(), f) != buf.size()) {
+        fclose(f);
+        throw std::runtime_error("Couldn't read segment file index: " + filename);
+    }
+
+    Cursor c(buf);
+    uint32_t ninds = c.get<uint32_t>();
+    for (uint32_t i = 0; i < ninds; ++i) { index.individuals.push_back(c.get_string()); }
+
+    uint32_t nchrom = c.get<uint32_t>();
+    for (uint32_t i = 0; i < nchrom; ++i) {
+        ChromEntry e;
+        e.label = c.get_string();
+        e.first_record = c.get<uint64_t>();
+        e.nrecords = c.get<uint64_t>();
+        index.chromosomes.push_back(e);
+    }
+
+    uint64_t nblocks = c.get<uint64_t>();
+    for (uint64_t i = 0; i < nblocks; ++i) {
+        BlockEntry b;
+        b.chrom = c.get<uint32_t>();
+        b.i_start = c.get<uint32_t>();
+        b.i_stop = c.get<uint32_t>();
+        b.j_start = c.get<uint32_t>();
+        b.j_stop = c.get<uint32_t>();
+        b.first_record = c.get<uint64_t>();
+        b.nrecords = c.get<uint64_t>();
+        index.blocks.push_back(b);
+    }
+}
+
+Reader::~Reader(void)
+{
+    if (f) { fclose(f); }
+}
+
+std::vector<Record> Reader::read(uint64_t first, uint64_t count)
+{
+    if (first > nrecords || count > nrecords - first) {
+        throw std::out_of_range("Segment record out of range");
+    }
+
+    std::vector<Record> records(count);
+    if (!count) { return records; }
+
+    off_t offset = HEADER_SIZE + first * sizeof(Record);
+    if (fseeko(f, offset, SEEK_SET) ||
+        fread(records.data(), sizeof(Record), count, f) != count) {
+        throw std::runtime_error("Couldn't read segments from " + filename);
+    }
+    return records;
+}
+
+std::vector<std::string> text_header(void)
+{
+    std::vector<std::string> header = {
+        "IND_1", "IND_2", "CHROM", "START", "END", "LENGTH",
+        "STATE", "NMARK", "NRARE", "NERR", "LOD"
+    };
+    return header;
+}
+
+std::vector<std::string> tokens(const Record& r, const Index& idx)
+{
+    using std::to_string;
+
+    std::vector<std::string> s = {
+        idx.individuals.at(r.ind1),
+        idx.individuals.at(r.ind2),
+        idx.chromosomes.at(r.chrom).label,
+        to_string(r.start),
+        to_string(r.stop),
+        bp_formatter(r.stop - r.start),
+        to_string(r.state),
+        to_string(r.nmark),
+        to_string(r.nrare),
+        to_string(r.nerr),
+        sfloat(r.lod, 2)
+    };
+    return s;
+}
+
+void convert(const std::string& filename, DelimitedFileWriter& out)
+{
+    Reader reader(filename);
+    out.writetoks(text_header());
+
+    const uint64_t chunk = 1 << 16;
+    for (uint64_t first = 0; first < reader.nrecords; first += chunk) {
+        uint64_t count = std::min(chunk, reader.nrecords - first);
+        for (const Record& r : reader.read(first, count)) {
+            out.writetoks(tokens(r, reader.index));
+        }
+    }
+}
+
+}
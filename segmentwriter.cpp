@@ -0,0 +1,121 @@
+#include "segmentwriter.hpp"
+
+#include <chrono>
+
+namespace adios {
+
+// Back off from 1us up to 1ms while waiting on the other side
+static inline void backoff(int& rounds) {
+    if (rounds < 10) {
+        std::this_thread::yield();
+    } else {
+        int us = 1 << std::min(rounds - 10, 10);
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+    rounds++;
+}
+
+SegmentWriter::SegmentWriter(DelimitedFileWriter& out, size_t memory_limit, Callback on_write)
+    : out_(out), memory_limit_(memory_limit), on_write_(on_write),
+      next_sequence_(0), buffered_(0), peak_buffered_(0),
+      finishing_(false), failed_(false)
+{
+    thread_ = std::thread(&SegmentWriter::run, this);
+}
+
+SegmentWriter::~SegmentWriter(void)
+{
+    if (thread_.joinable()) {
+        finishing_.store(true);
+        thread_.join();
+    }
+    for (auto& kv : pending_) { delete kv.second; }
+}
+
+void SegmentWriter::submit(SegmentBatch* batch)
+{
+    const size_t sz = batch->bytes();
+
+    // Backpressure. The batch the writer is waiting on always gets through,
+    // otherwise everyone could end up waiting on each other.
+    int rounds = 0;
+    while (buffered_.load(std::memory_order_acquire) + sz > memory_limit_ &&
+           batch->sequence != next_sequence_.load(std::memory_order_acquire) &&
+           !failed_.load(std::memory_order_relaxed)) {
+        backoff(rounds);
+    }
+
+    size_t now = buffered_.fetch_add(sz) + sz;
+    size_t peak = peak_buffered_.load(std::memory_order_relaxed);
+    while (now > peak && !peak_buffered_.compare_exchange_weak(peak, now)) {}
+
+    queue_.push(batch);
+}
+
+void SegmentWriter::write_ready(void)
+{
+    auto it = pending_.begin();
+    while (it != pending_.end() && it->first == next_sequence_.load(std::memory_order_relaxed)) {
+        SegmentBatch* batch = it->second;
+
+        if (!failed_.load(std::memory_order_relaxed)) {
+            try {
+                if (!batch->text.empty()) { out_.writeblock(batch->text); }
+                if (on_write_) { on_write_(*batch); }
+            } catch (const std::exception& e) {
+                // Keep draining so workers don't block forever, and report
+                // the problem from finish()
+                error_ = e.what();
+                failed_.store(true);
+            }
+        }
+
+        buffered_.fetch_sub(batch->bytes(), std::memory_order_release);
+        next_sequence_.fetch_add(1, std::memory_order_release);
+        delete batch;
+        it = pending_.erase(it);
+    }
+}
+
+void SegmentWriter::run(void)
+{
+    int rounds = 0;
+    while (true) {
+        SegmentBatch* batch = queue_.pop();
+        if (batch) {
+            pending_[batch->sequence] = batch;
+            write_ready();
+            rounds = 0;
+            continue;
+        }
+
+        // Only stop once finish() has been called and the queue is empty.
+        // Producers are done by then, so an empty pop means empty.
+        if (finishing_.load(std::memory_order_acquire)) {
+            batch = queue_.pop();
+            if (!batch) break;
+            pending_[batch->sequence] = batch;
+            write_ready();
+            continue;
+        }
+
+        backoff(rounds);
+    }
+}
+
+void SegmentWriter::finish(void)
+{
+    if (!thread_.joinable()) return;
+
+    finishing_.store(true, std::memory_order_release);
+    thread_.join();
+
+    if (!pending_.empty()) {
+        throw std::logic_error("SegmentWriter: batch sequence has gaps");
+    }
+    if (failed_.load()) {
+        throw std::runtime_error(error_);
+    }
+}
+
+}
@@ -0,0 +1,260 @@
+#include "sitekernel.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SITEKERNEL_X86 1
+#include <immintrin.h>
+#else
+#define SITEKERNEL_X86 0
+#endif
+
+namespace sitekernel {
+
+// Emit the kept bits of one word, in marker order.
+static inline void emit_word(const PackedPair& p, size_t w, uint64_t keep,
+                             std::vector<int>& sites, std::vector<int>& states)
+{
+    const uint64_t a = p.a[w], b = p.b[w], c = p.c[w], d = p.d[w];
+    while (keep) {
+        const int bit = __builtin_ctzll(keep);
+        const int s1 = ((a >> bit) & 1) + ((b >> bit) & 1);
+        const int s2 = ((c >> bit) & 1) + ((d >> bit) & 1);
+        sites.push_back(64 * w + bit);
+        states.push_back(3 * s1 + s2);
+        keep &= keep - 1;
+    }
+}
+
+static inline uint64_t scalar_mask(const PackedPair& p, size_t w)
+{
+    return informative_mask(p.a[w], p.b[w], p.c[w], p.d[w],
+                            p.missing1[w] | p.missing2[w],
+                            p.rare[w],
+                            p.requested ? p.requested[w] : 0);
+}
+
+static void classify_scalar(const PackedPair& p, size_t from,
+                            std::vector<int>& sites, std::vector<int>& states)
+{
+    for (size_t w = from; w < p.nwords; ++w) {
+        uint64_t keep = scalar_mask(p, w);
+        if (keep) { emit_word(p, w, keep, sites, states); }
+    }
+}
+
+static void gather_scalar(const uint32_t* table, const int* index, size_t from, size_t n, uint32_t* out)
+{
+    for (size_t i = from; i < n; ++i) { out[i] = table[index[i]]; }
+}
+
+#if SITEKERNEL_X86
+
+__attribute__((target("avx2")))
+static void gather_avx2(const uint32_t* table, const int* index, size_t n, uint32_t* out)
+{
+    const size_t lanes = 8;
+    const size_t nvec = n / lanes;
+    for (size_t v = 0; v < nvec; ++v) {
+        const __m256i idx = _mm256_loadu_si256((const __m256i*)(index + v * lanes));
+        const __m256i vals = _mm256_i32gather_epi32((const int*)table, idx, 4);
+        _mm256_storeu_si256((__m256i*)(out + v * lanes), vals);
+    }
+    gather_scalar(table, index, nvec * lanes, n, out);
+}
+
+__attribute__((target("avx512f")))
+static void gather_avx512(const uint32_t* table, const int* index, size_t n, uint32_t* out)
+{
+    const size_t lanes = 16;
+    const size_t nvec = n / lanes;
+    for (size_t v = 0; v < nvec; ++v) {
+        const __m512i idx = _mm512_loadu_si512((const void*)(index + v * lanes));
+        // Masked, with every lane on and a zero source, since GCC's
+        // unmasked intrinsic trips -Wmaybe-uninitialized
+        const __m512i vals = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), (__mmask16)0xFFFF,
+                                                         idx, (const void*)table, 4);
+        _mm512_storeu_si512((void*)(out + v * lanes), vals);
+    }
+    gather_scalar(table, index, nvec * lanes, n, out);
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const PackedPair& p,
+                          std::vector<int>& sites, std::vector<int>& states)
+{
+    const size_t lanes = 4;
+    const size_t nvec = p.nwords / lanes;
+    const __m256i zero = _mm256_setzero_si256();
+    alignas(32) uint64_t keep[lanes];
+
+    for (size_t v = 0; v < nvec; ++v) {
+        const size_t w = v * lanes;
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(p.a + w));
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(p.b + w));
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(p.c + w));
+        const __m256i d = _mm256_loadu_si256((const __m256i*)(p.d + w));
+        const __m256i miss = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i*)(p.missing1 + w)),
+            _mm256_loadu_si256((const __m256i*)(p.missing2 + w)));
+        const __m256i rare = _mm256_loadu_si256((const __m256i*)(p.rare + w));
+        const __m256i requ = p.requested ? 
+            _mm256_loadu_si256((const __m256i*)(p.requested + w)) : zero;
+
+        const __m256i carrier1 = _mm256_or_si256(a, b);
+        const __m256i carrier2 = _mm256_or_si256(c, d);
+
+        // andnot(x, y) is ~x & y
+        const __m256i opposite = _mm256_or_si256(
+            _mm256_andnot_si256(carrier1, _mm256_and_si256(c, d)),
+            _mm256_andnot_si256(carrier2, _mm256_and_si256(a, b)));
+        const __m256i shared = _mm256_and_si256(_mm256_and_si256(carrier1, carrier2), rare);
+        const __m256i requested = _mm256_and_si256(requ, _mm256_or_si256(carrier1, carrier2));
+        const __m256i k = _mm256_andnot_si256(miss,
+            _mm256_or_si256(opposite, _mm256_or_si256(shared, requested)));
+
+        // Almost all words have nothing informative, skip them in one test
+        if (_mm256_testz_si256(k, k)) { continue; }
+
+        _mm256_store_si256((__m256i*)keep, k);
+        for (size_t l = 0; l < lanes; ++l) {
+            if (keep[l]) { emit_word(p, w + l, keep[l], sites, states); }
+        }
+    }
+
+    classify_scalar(p, nvec * lanes, sites, states);
+}
+
+__attribute__((target("avx512f")))
+static void classify_avx512(const PackedPair& p,
+                            std::vector<int>& sites, std::vector<int>& states)
+{
+    const size_t lanes = 8;
+    const size_t nvec = p.nwords / lanes;
+    const __m512i zero = _mm512_setzero_si512();
+    alignas(64) uint64_t keep[lanes];
+
+    for (size_t v = 0; v < nvec; ++v) {
+        const size_t w = v * lanes;
+        const __m512i a = _mm512_loadu_si512((const void*)(p.a + w));
+        const __m512i b = _mm512_loadu_si512((const void*)(p.b + w));
+        const __m512i c = _mm512_loadu_si512((const void*)(p.c + w));
+        const __m512i d = _mm512_loadu_si512((const void*)(p.d + w));
+        const __m512i miss = _mm512_or_si512(_mm512_loadu_si512((const void*)(p.missing1 + w)),
+                                             _mm512_loadu_si512((const void*)(p.missing2 + w)));
+        const __m512i rare = _mm512_loadu_si512((const void*)(p.rare + w));
+        const __m512i requ = p.requested ? 
+            _mm512_loadu_si512((const void*)(p.requested + w)) : zero;
+
+        // Same expression as informative_mask(). The complements are taken
+        // with ternarylogic (0x55 is ~x) rather than andnot, whose GCC
+        // intrinsic trips -Wmaybe-uninitialized.
+        const __m512i carrier1 = _mm512_or_si512(a, b);
+        const __m512i carrier2 = _mm512_or_si512(c, d);
+        const __m512i not_carrier1 = _mm512_ternarylogic_epi64(carrier1, carrier1, carrier1, 0x55);
+        const __m512i not_carrier2 = _mm512_ternarylogic_epi64(carrier2, carrier2, carrier2, 0x55);
+        const __m512i not_miss = _mm512_ternarylogic_epi64(miss, miss, miss, 0x55);
+        const __m512i opposite = _mm512_or_si512(
+            _mm512_and_si512(not_carrier1, _mm512_and_si512(c, d)),
+            _mm512_and_si512(not_carrier2, _mm512_and_si512(a, b)));
+        const __m512i shared = _mm512_and_si512(_mm512_and_si512(carrier1, carrier2), rare);
+        const __m512i requested = _mm512_and_si512(requ, _mm512_or_si512(carrier1, carrier2));
+        const __m512i k = _mm512_and_si512(not_miss,
+            _mm512_or_si512(opposite, _mm512_or_si512(shared, requested)));
+
+        const __mmask8 nonzero = _mm512_test_epi64_mask(k, k);
+        if (!nonzero) { continue; }
+
+        _mm512_store_si512((void*)keep, k);
+        for (size_t l = 0; l < lanes; ++l) {
+            if ((nonzero >> l) & 1) { emit_word(p, w + l, keep[l], sites, states); }
+        }
+    }
+
+    classify_scalar(p, nvec * lanes, sites, states);
+}
+
+#endif
+
+bool is_available(Implementation impl)
+{
+    switch (impl) {
+    case KERNEL_AUTO:
+    case KERNEL_SCALAR:
+        return true;
+#if SITEKERNEL_X86
+    case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+Implementation best_available(void)
+{
+    static const Implementation best = is_available(KERNEL_AVX512) ? KERNEL_AVX512 :
+                                       is_available(KERNEL_AVX2) ? KERNEL_AVX2 :
+                                       KERNEL_SCALAR;
+    return best;
+}
+
+const char* name(Implementation impl)
+{
+    switch (impl) {
+    case KERNEL_AUTO: return name(best_available());
+    case KERNEL_SCALAR: return "scalar";
+    case KERNEL_AVX2: return "AVX2";
+    case KERNEL_AVX512: return "AVX-512";
+    }
+    return "unknown";
+}
+
+size_t classify(const PackedPair& p,
+                std::vector<int>& sites,
+                std::vector<int>& states,
+                Implementation impl)
+{
+    size_t nstart = sites.size();
+    if (impl == KERNEL_AUTO) { impl = best_available(); }
+    if (!is_available(impl)) { impl = KERNEL_SCALAR; }
+
+    switch (impl) {
+#if SITEKERNEL_X86
+    case KERNEL_AVX512:
+        classify_avx512(p, sites, states);
+        break;
+    case KERNEL_AVX2:
+        classify_avx2(p, sites, states);
+        break;
+#endif
+    default:
+        classify_scalar(p, 0, sites, states);
+        break;
+    }
+
+    return sites.size() - nstart;
+}
+
+void gather(const uint32_t* table, const int* index, size_t n, uint32_t* out,
+            Implementation impl)
+{
+    if (impl == KERNEL_AUTO) { impl = best_available(); }
+    if (!is_available(impl)) { impl = KERNEL_SCALAR; }
+
+    switch (impl) {
+#if SITEKERNEL_X86
+    case KERNEL_AVX512:
+        gather_avx512(table, index, n, out);
+        break;
+    case KERNEL_AVX2:
+        gather_avx2(table, index, n, out);
+        break;
+#endif
+    default:
+        gather_scalar(table, index, 0, n, out);
+        break;
+    }
+}
+
+}
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "vcfinfo.hpp"
+
 int main(int argc, char** argv) {
     using std::cout; using std::endl;
     if (argc < 3) { std::cerr << "Not enough arguments" << std::endl; return 1; }
@@ -12,31 +14,26 @@ int main(int argc, char** argv) {
     std::ifstream vcffile(filename);
     if (!vcffile) { std::cerr << "Cant open file: " << filename << std::endl;  return 1; }
 
-    std::string desired = argv[2];
+    VCFInfoKey desired(argv[2]);
 
     std::string line; 
     while (std::getline(vcffile, line)) {
         if (line[0] == '#') continue;
 
-        char* origdup = strdup(line.c_str());
-        char* dup = origdup;
-
-        int tokidx = -1;
-        char* token;
-        while (tokidx != 7) {
-            token = strsep(&dup, "\t");
-            tokidx++;
+        // INFO is the eighth column
+        size_t start = 0;
+        for (int tokidx = 0; tokidx < 7 && start != std::string::npos; ++tokidx) {
+            start = line.find('\t', start);
+            if (start != std::string::npos) { start++; }
         }
-
-        while (char* subtok = strsep(&token, ";")) {
-            char* flag = strsep(&subtok, "=");
-            if (desired.compare(flag) == 0) {
-                char* val = strsep(&subtok,"=");
-                cout << val << '\n';
-                break;
-            } 
+        if (start == std::string::npos) continue;
+        size_t stop = line.find('\t', start);
+        if (stop == std::string::npos) { stop = line.size(); }
+
+        stringops::StringSpan val;
+        if (desired.find(line.data() + start, stop - start, val)) {
+            cout.write(val.data, val.size);
+            cout << '\n';
         }
-
-        free(origdup);
     }
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "tabix.hpp"
+#include "bgzf.hpp"
+
+#ifdef HAVE_ZLIB
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+
+namespace tabix {
+
+// Binning scheme of .tbi files. CSI files carry their own.
+static const int TBI_MIN_SHIFT = 14;
+static const int TBI_DEPTH = 5;
+
+// Reads little-endian values out of a decompressed index
+class Cursor {
+public:
+    Cursor(const std::string& b, const std::string& fn) : buf(b), filename(fn), pos(0) {}
+
+    template <typename T> T get(void) {
+        T v;
+        need(sizeof(T));
+        memcpy(&v, buf.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return v;
+    }
+
+    std::string get_bytes(size_t n) {
+        need(n);
+        std::string s = buf.substr(pos, n);
+        pos += n;
+        return s;
+    }
+
+    // Signed counts from the file, checked so a corrupt file can't make us
+    // allocate wildly
+    size_t get_count(void) {
+        int32_t n = get<int32_t>();
+        if (n < 0 || (size_t)n > buf.size() - pos) { corrupt(); }
+        return n;
+    }
+
+    void corrupt(void) { throw std::runtime_error("Corrupt index: " + filename); }
+
+private:
+    const std::string& buf;
+    const std::string& filename;
+    size_t pos;
+
+    void need(size_t n) {
+        if (buf.size() - pos < n) { corrupt(); }
+    }
+};
+
+static inline uint32_t bin_first(int level) { return ((1u << (3 * level)) - 1) / 7; }
+
+std::string find_index(const std::string& filename)
+{
+    const char* suffixes[] = {".csi", ".tbi"};
+    for (const char* suffix : suffixes) {
+        std::string fn = filename + suffix;
+        if (access(fn.c_str(), R_OK) == 0) { return fn; }
+    }
+    return "";
+}
+
+std::vector<uint32_t> reg2bins(int64_t beg, int64_t end, int min_shift, int depth)
+{
+    std::vector<uint32_t> bins;
+    int shift = min_shift + 3 * depth;
+    if (beg < 0) { beg = 0; }
+    if (end > (1LL << shift)) { end = 1LL << shift; }
+    if (beg >= end) { return bins; }
+
+    --end;
+    for (int level = 0; level <= depth; ++level, shift -= 3) {
+        uint32_t first = bin_first(level);
+        for (int64_t b = first + (beg >> shift); b <= first + (end >> shift); ++b) {
+            bins.push_back(b);
+        }
+    }
+    return bins;
+}
+
+Index::Index(const std::string& filename) : min_shift(TBI_MIN_SHIFT), depth(TBI_DEPTH)
+{
+    std::string buf, chunk;
+    BGZFFile f;
+    f.openfile(filename, false);
+    while (f.read_chunk(chunk)) { buf.append(chunk); }
+    f.closefile();
+
+    Cursor c(buf, filename);
+    std::string magic = c.get_bytes(4);
+    bool csi = magic == std::string("CSI\1", 4);
+    if (!csi && magic != std::string("TBI\1", 4)) {
+        throw std::runtime_error("Not a tabix or CSI index: " + filename);
+    }
+
+    size_t nref = 0;
+    if (csi) {
+        min_shift = c.get<int32_t>();
+        depth = c.get<int32_t>();
+        if (min_shift < 0 || depth < 0 || depth > 10 || min_shift + 3 * depth > 62) { c.corrupt(); }
+        // The tabix header below, sequence names and all, is stored as the
+        // CSI auxiliary data
+        size_t laux = c.get_count();
+        if (laux < 28) {
+            throw std::runtime_error("CSI index has no sequence names: " + filename);
+        }
+    } else {
+        nref = c.get_count();
+    }
+
+    // format, col_seq, col_beg, col_end, meta, skip
+    for (int i = 0; i < 6; ++i) { c.get<int32_t>(); }
+    std::string packed_names = c.get_bytes(c.get_count());
+    std::vector<std::string> labels;
+    for (size_t pos = 0; pos < packed_names.size();) {
+        size_t nul = packed_names.find('\0', pos);
+        if (nul == std::string::npos) { nul = packed_names.size(); }
+        labels.push_back(packed_names.substr(pos, nul - pos));
+        pos = nul + 1;
+    }
+
+    if (csi) { nref = c.get_count(); }
+    if (nref != labels.size()) { c.corrupt(); }
+
+    refs.resize(nref);
+    for (size_t r = 0; r < nref; ++r) {
+        names[labels[r]] = r;
+
+        size_t nbin = c.get_count();
+        for (size_t i = 0; i < nbin; ++i) {
+            uint32_t binid = c.get<uint32_t>();
+            Bin& bin = refs[r].bins[binid];
+            bin.loffset = csi ? c.get<uint64_t>() : 0;
+            size_t nchunk = c.get_count();
+            for (size_t j = 0; j < nchunk; ++j) {
+                uint64_t begin = c.get<uint64_t>();
+                uint64_t end = c.get<uint64_t>();
+                bin.chunks.push_back(Chunk(begin, end));
+            }
+        }
+
+        if (!csi) {
+            size_t nintv = c.get_count();
+            for (size_t i = 0; i < nintv; ++i) { refs[r].linear.push_back(c.get<uint64_t>()); }
+        }
+    }
+}
+
+bool Index::has_chrom(const std::string& chrom) const
+{
+    return names.count(chrom) > 0;
+}
+
+// No record overlapping beg starts before this offset
+uint64_t Index::min_offset(const Reference& ref, int64_t beg) const
+{
+    if (!ref.linear.empty()) {
+        size_t window = beg >> min_shift;
+        return ref.linear[std::min(window, ref.linear.size() - 1)];
+    }
+
+    // CSI: the smallest existing bin containing beg
+    int shift = min_shift;
+    for (int level = depth; level >= 0; --level, shift += 3) {
+        auto it = ref.bins.find(bin_first(level) + (beg >> shift));
+        if (it != ref.bins.end()) { return it->second.loffset; }
+    }
+    return 0;
+}
+
+std::vector<Chunk> Index::query(const std::string& chrom, int start, int end) const
+{
+    std::vector<Chunk> chunks;
+    auto ref_it = names.find(chrom);
+    if (ref_it == names.end() || end < start) { return chunks; }
+    const Reference& ref = refs[ref_it->second];
+
+    int64_t beg = std::max(start, 1) - 1;
+    uint64_t min_off = min_offset(ref, beg);
+
+    for (uint32_t binid : reg2bins(beg, end, min_shift, depth)) {
+        auto it = ref.bins.find(binid);
+        if (it == ref.bins.end()) { continue; }
+        for (const Chunk& ch : it->second.chunks) {
+            if (ch.second > min_off) { chunks.push_back(ch); }
+        }
+    }
+
+    std::sort(chunks.begin(), chunks.end());
+    std::vector<Chunk> merged;
+    for (const Chunk& ch : chunks) {
+        if (!merged.empty() && ch.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, ch.second);
+        } else {
+            merged.push_back(ch);
+        }
+    }
+    return merged;
+}
+
+}
+
+#endif
@@ -6,8 +6,89 @@
 #include "CppUTest/TestHarness.h"
 
 #include <iostream>
+#include <map>
+#include <stdio.h>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
 TEST_GROUP(adios) {};
 
+// A small population with known IBD: 12 individuals on two 3Mb
+// chromosomes, where 0 and 1 share a haplotype over the middle of
+// chromosome 1 and 2 and 3 share one over most of chromosome 2.
+static Dataset related_dataset(void) {
+    const int ninds = 12;
+    const int nmark = 3000;
+    uint64_t state = 12345;
+    auto uniform = [&state](void) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (state >> 11) * (1.0 / 9007199254740992.0);
+    };
+
+    Dataset d;
+    for (int i = 0; i < ninds; ++i) { d.add_individual("I" + std::to_string(i)); }
+
+    for (int chridx = 0; chridx < 2; ++chridx) {
+        d.add_chromosome(std::to_string(chridx + 1));
+        std::vector<double> freqs;
+        for (int m = 0; m < nmark; ++m) {
+            double fq = uniform() < 0.5 ? 0.002 + 0.04 * uniform() : 0.05 + 0.45 * uniform();
+            freqs.push_back(fq);
+            d.chromosomes[chridx]->add_variant("v" + std::to_string(m), 1000 * (m + 1), fq);
+        }
+
+        int src = chridx == 0 ? 0 : 2;
+        int ibd_start = chridx == 0 ? 500 : 200;
+        int ibd_stop = chridx == 0 ? 2500 : 2800;
+        for (int m = 0; m < nmark; ++m) {
+            std::vector<int> alleles(2 * ninds);
+            for (int h = 0; h < 2 * ninds; ++h) { alleles[h] = uniform() < freqs[m]; }
+            if (m >= ibd_start && m < ibd_stop) { alleles[2 * (src + 1)] = alleles[2 * src]; }
+            for (int h = 0; h < 2 * ninds; ++h) {
+                if (alleles[h]) { d.individuals[h / 2].set_allele(chridx, m, h % 2, 1); }
+            }
+        }
+    }
+
+    d.finalize();
+    return d;
+}
+
+static adios::adios_parameters test_params(Dataset& d, const std::string& schedule,
+                                           const std::string& fine_ends="NO",
+                                           const std::string& viterbi="NO") {
+    std::map<std::string, std::vector<std::string>> args = {
+        {"err", {"0.001"}}, {"transition", {"4", "3"}}, {"rare", {"0.05"}},
+        {"minlength", {"0.3"}}, {"minmark", {"4"}}, {"minlod", {"1"}},
+        {"viterbi", {viterbi}}, {"fine_ends", {fine_ends}}, {"schedule", {schedule}}
+    };
+    adios::adios_parameters params = adios::params_from_args(args);
+    params.get_rare_sites(d);
+    params.calculate_emission_mats(d);
+    return params;
+}
+
+// Runs adios() on the whole dataset and returns what it wrote
+static std::string run_adios(Dataset& d, const adios::adios_parameters& params) {
+    const char* filename = "unittests/data/tmp_adios.ibd";
+    {
+        DelimitedFileWriter out(filename, '\t');
+        adios::adios(d, params, out);
+        out.closefile();
+    }
+
+    std::string text;
+    FILE* f = fopen(filename, "rb");
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) { text.append(buf, n); }
+    fclose(f);
+    remove(filename);
+    return text;
+}
+
 TEST(adios, InformativeSites) {
     VCFParams vcfp = {false, false, false, "AF"};
 
@@ -24,13 +105,41 @@ TEST(adios, InformativeSites) {
     auto p = adios::find_informative_sites_unphased(ind1, ind2, 0, rares);
     // std::vector<int> expected_sites = {2, 6, 11, 13, 14, 15, 16, 17};
     std::vector<int> expected_sites = {2,6,10, 11, 12, 13, 14, 15, 16, 17};
-    auto observed_sites = p.second;
+    auto observed_sites = p.sites;
     CHECK(expected_sites == observed_sites);
     // std::vector<int> expected_states = {2, 6, 2, 4, 5, 6, 7, 8};
     // auto observed_states = p.first;
     // CHECK(observed_states == expected_states);
 };
 
+TEST(adios, InformativeSitesPacked) {
+    VCFParams vcfp = {false, false, false, "AF"};
+
+    Dataset d = read_vcf("unittests/data/vcf/test_informative_sites.vcf", vcfp);
+    d.pack();
+
+    std::vector<int> rares;
+    for (int i = 0; i < d.chromosomes[0]->nmark(); ++i) {
+        if (d.chromosomes[0]->frequencies[i] < 0.05) { rares.push_back(i); }
+    }
+    auto rare_mask = bitpack::pack(rares, d.chromosomes[0]->nmark());
+    std::vector<int> requests = {0, 1, 4, 9};
+
+    for (auto& ind1 : d.individuals) {
+        for (auto& ind2 : d.individuals) {
+            auto expected = adios::find_informative_sites_unphased(ind1, ind2, 0, rares);
+            auto observed = adios::find_informative_sites_unphased_packed(ind1, ind2, 0, rare_mask);
+            CHECK(expected.sites == observed.sites);
+            CHECK(expected.states == observed.states);
+
+            expected = adios::find_informative_sites_unphased(ind1, ind2, 0, rares, requests);
+            observed = adios::find_informative_sites_unphased_packed(ind1, ind2, 0, rare_mask, requests);
+            CHECK(expected.sites == observed.sites);
+            CHECK(expected.states == observed.states);
+        }
+    }
+}
+
 // TEST(adios, TransitionMatrix) {
 //     double gamma = pow(10,-4);
 //     double rho = pow(10,-2);
@@ -68,4 +177,119 @@ TEST(adios, GenotypeErrorMatrix) {
     };
     Matrix observed = adios::unphased_genotype_error_matrix(0.001);
     CHECK((expected - observed).sum() < 1e-6);
-}
\ No newline at end of file
+}
+TEST(adios, EmissionTable) {
+    Matrix single_error = adios::unphased_genotype_error_matrix(0.001);
+    Matrix err = Linalg::kronecker_product(single_error, single_error);
+    std::vector<double> levels = {0.001, 0.01, 0.2};
+    adios::EmissionTable table(levels, err);
+
+    CHECK_EQUAL(3, table.nlevels());
+    for (size_t code = 0; code < levels.size(); ++code) {
+        Matrix m = Linalg::matrix_product(err, adios::unphased_emission_matrix(levels[code]));
+        for (int obs = 0; obs < 9; ++obs) {
+            for (int state = 0; state < 2; ++state) {
+                CHECK_EQUAL(m.get(obs, state), table.get(code, obs, state));
+                DOUBLES_EQUAL(std::log10(m.get(obs, state)), table.get_log10(code, obs, state), 1e-12);
+            }
+        }
+    }
+}
+
+TEST(adios, Schedules) {
+#ifdef HAVE_OPENMP
+    int nthreads = omp_get_max_threads();
+    omp_set_num_threads(3);
+#endif
+
+    Dataset d = related_dataset();
+    std::string expected = run_adios(d, test_params(d, "chromosome"));
+    CHECK(expected.find("I0\tI1\t1\t") != std::string::npos);
+    CHECK(expected.find("I2\tI3\t2\t") != std::string::npos);
+
+    std::string observed = run_adios(d, test_params(d, "global"));
+    CHECK(expected == observed);
+
+    observed = run_adios(d, test_params(d, "steal"));
+    CHECK(expected == observed);
+
+    // Pairs the pre-filter skips can't have segments
+    adios::adios_parameters filtered = test_params(d, "chromosome");
+    filtered.prefilter = true;
+    observed = run_adios(d, filtered);
+    CHECK(expected == observed);
+
+    // Without the memory for an index nothing is filtered
+    filtered.carrier_memory = 0;
+    observed = run_adios(d, filtered);
+    CHECK(expected == observed);
+
+    adios::adios_parameters batched = test_params(d, "chromosome");
+    batched.engine = adios::ENGINE_BATCH;
+    observed = run_adios(d, batched);
+    CHECK(expected == observed);
+
+    CHECK_THROWS(std::invalid_argument, test_params(d, "nope"));
+
+#ifdef HAVE_OPENMP
+    omp_set_num_threads(nthreads);
+#endif
+}
+
+TEST(adios, FineMappedEnds) {
+    // Refining the windows around segment ends has to find the same
+    // segments as decoding the whole chromosome again with the sites in
+    // the gaps around each end added
+    Dataset d = related_dataset();
+
+    // An individual with itself is IBD end to end, so its segment ends on
+    // the last informative site. Make the chromosome's last marker common
+    // and give it the minor allele there, so the gap after that site has
+    // a genotype that the re-run leaves out.
+    int last = d.chromosomes[0]->nmark() - 1;
+    d.chromosomes[0]->frequencies[last] = 0.3;
+    d.encode_frequencies();
+    AlleleSites& hap = d.individuals[4].chromosomes[0].hapa;
+    if (hap.empty() || hap.back() != last) { hap.push_back(last); }
+    d.individuals[4].finalize();
+
+    for (const char* viterbi : {"NO", "YES"}) {
+        adios::adios_parameters params = test_params(d, "chromosome", "YES", viterbi);
+        int pairs[3][3] = {{0, 1, 0}, {2, 3, 1}, {4, 4, 0}};
+        for (auto& p : pairs) {
+            const Individual& ind1 = d.individuals[p[0]];
+            const Individual& ind2 = d.individuals[p[1]];
+            int chromidx = p[2];
+
+            auto useful = adios::find_informative_sites_unphased(ind1, ind2, chromidx,
+                                                                 params.rare_sites[chromidx]);
+            auto first = adios::run_adios_pair_unphased(useful, params);
+            CHECK(!first.segments.empty());
+
+            AlleleSites requested;
+            int last_marker = d.chromosomes[chromidx]->nmark() - 1;
+            for (const adios::Segment& seg : first.segments) {
+                int before = seg.start > 0 ? useful.sites[seg.start - 1] : 0;
+                int after = seg.stop + 1 < useful.sites.size() ? useful.sites[seg.stop + 1] : last_marker;
+                for (int m = before; m < useful.sites[seg.start]; ++m) { requested.push_back(m); }
+                for (int m = useful.sites[seg.stop]; m < after; ++m) { requested.push_back(m); }
+            }
+            auto all = adios::find_informative_sites_unphased(ind1, ind2, chromidx,
+                                                              params.rare_sites[chromidx],
+                                                              requested);
+            auto expected = adios::run_adios_pair_unphased(all, params);
+            auto observed = adios::adios_pair_unphased(ind1, ind2, chromidx, params);
+
+            CHECK_EQUAL(expected.segments.size(), observed.segments.size());
+            for (size_t i = 0; i < expected.segments.size(); ++i) {
+                const adios::Segment& a = expected.segments[i];
+                const adios::Segment& b = observed.segments[i];
+                CHECK_EQUAL(a.full_start, b.full_start);
+                CHECK_EQUAL(a.full_stop, b.full_stop);
+                CHECK_EQUAL(a.nmark, b.nmark);
+                CHECK_EQUAL(a.nrare, b.nrare);
+                DOUBLES_EQUAL(a.lod, b.lod, 1e-9);
+            }
+        }
+    }
+}
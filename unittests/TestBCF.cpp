@@ -0,0 +1,113 @@
+#include <string>
+#include <vector>
+#include "bcf.hpp"
+#include "datamodel.hpp"
+#include "vcf.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(BCF) {};
+
+static void check_same_dataset(Dataset& expected, Dataset& observed) {
+    CHECK_EQUAL(expected.ninds(), observed.ninds());
+    for (size_t i = 0; i < expected.ninds(); ++i) {
+        CHECK_EQUAL(expected.individuals[i].label, observed.individuals[i].label);
+    }
+
+    CHECK_EQUAL(expected.nchrom(), observed.nchrom());
+    for (size_t c = 0; c < expected.nchrom(); ++c) {
+        const ChromInfo& a = *expected.chromosomes[c];
+        const ChromInfo& b = *observed.chromosomes[c];
+        CHECK_EQUAL(a.label, b.label);
+        CHECK(a.positions == b.positions);
+        CHECK(a.frequencies == b.frequencies);
+        CHECK(a.exclusions == b.exclusions);
+
+        for (size_t i = 0; i < expected.ninds(); ++i) {
+            const Genotypes& x = expected.individuals[i].chromosomes[c];
+            const Genotypes& y = observed.individuals[i].chromosomes[c];
+            CHECK(x.hapa == y.hapa);
+            CHECK(x.hapb == y.hapb);
+            CHECK(x.missing == y.missing);
+        }
+    }
+}
+
+TEST(BCF, Header) {
+    std::string text = "##fileformat=VCFv4.2\n"
+                       "##contig=<ID=2>\n"
+                       "##contig=<ID=1,length=100>\n"
+                       "##INFO=<ID=AF,Number=A,Type=Float,Description=\"x\">\n"
+                       "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"x\">\n"
+                       "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"x\">\n"
+                       "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"x\",IDX=5>\n"
+                       "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tA\tB\n";
+    text.push_back('\0');
+    BCFHeader h(text);
+
+    std::vector<std::string> contigs = {"2", "1"};
+    CHECK(h.contigs == contigs);
+    CHECK_EQUAL(0, h.key("PASS"));
+    CHECK_EQUAL(1, h.key("AF"));
+    CHECK_EQUAL(2, h.key("DP"));
+    CHECK_EQUAL(5, h.gt_key);
+    CHECK_EQUAL(-1, h.key("AC"));
+    std::vector<std::string> samples = {"A", "B"};
+    CHECK(h.samples == samples);
+}
+
+TEST(BCF, MatchesVCF) {
+    // Each .bcf is its .vcf converted
+    const char* files[] = {"unittests/data/vcf/test", "unittests/data/vcf/test_bcf"};
+    std::vector<VCFParams> params = {VCFParams{false, false, false, "AF"},
+                                     VCFParams{true, true, true, "-"},
+                                     VCFParams{true, false, false, "AC"}};
+
+    for (const char* base : files) {
+        for (const VCFParams& vcfp : params) {
+            Dataset text = read_vcf(std::string(base) + ".vcf", vcfp);
+            Dataset binary = read_vcf(std::string(base) + ".bcf", vcfp, 2);
+            check_same_dataset(text, binary);
+        }
+    }
+}
+
+TEST(BCF, Genotypes) {
+    VCFParams vcfp = {false, false, false, "AF"};
+    Dataset d = read_bcf("unittests/data/vcf/test_bcf.bcf", vcfp);
+
+    CHECK_EQUAL(2, d.nchrom());
+    CHECK_EQUAL("1", d.chromosomes[0]->label);
+    std::vector<int> positions = {100, 200, 300, 400};
+    CHECK(positions == d.chromosomes[0]->positions);
+    CHECK_EQUAL(1, d.chromosomes[0]->exclusions["Non-diallelic"]);
+    CHECK_EQUAL(1, d.chromosomes[1]->exclusions["Non-SNV"]);
+
+    // Float INFO values come back as the decimal that was written
+    CHECK_EQUAL(0.25, d.chromosomes[0]->frequencies[0]);
+    CHECK_EQUAL(0.125, d.chromosomes[0]->frequencies[1]);
+    CHECK_EQUAL(0.0, d.chromosomes[0]->frequencies[3]);
+
+    // 0/1 ./. 1|1 0/0
+    CHECK_EQUAL(1, d.individuals[0].get_minor_allele_count(0, 0));
+    CHECK_EQUAL(0, d.individuals[1].get_minor_allele_count(0, 0));
+    CHECK(d.individuals[1].chromosomes[0].missing == AlleleSites({0}));
+    CHECK_EQUAL(2, d.individuals[2].get_minor_allele_count(0, 0));
+    CHECK_EQUAL(0, d.individuals[3].get_minor_allele_count(0, 0));
+
+    // Haploid genotypes count as homozygous
+    CHECK_EQUAL(2, d.individuals[0].get_minor_allele_count(0, 2));
+    CHECK(d.individuals[0].chromosomes[0].missing.empty());
+
+    // Region filtering skips chromosome 1 entirely
+    Dataset region = read_bcf("unittests/data/vcf/test_bcf.bcf", vcfp, 1, VCFRegion("2:15-45"));
+    CHECK_EQUAL(1, region.nchrom());
+    CHECK_EQUAL("2", region.chromosomes[0]->label);
+    positions = {20, 30};
+    CHECK(positions == region.chromosomes[0]->positions);
+}
+
+TEST(BCF, NotBCF) {
+    VCFParams vcfp = {false, false, false, "AF"};
+    CHECK_THROWS(std::invalid_argument, read_bcf("unittests/data/vcf/test.vcf.gz", vcfp));
+    CHECK_THROWS(std::invalid_argument, read_bcf("unittests/data/vcf/test.vcf", vcfp));
+}
@@ -0,0 +1,80 @@
+#include <string>
+#include <vector>
+#include "bgzf.hpp"
+#include "datamodel.hpp"
+#include "vcf.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(BGZF) {};
+
+// Non-empty lines, the way read_vcf sees them
+static std::vector<std::string> all_lines(FileObject& f) {
+    std::vector<std::string> lines;
+    while (f.good()) {
+        std::string line = f.getline();
+        if (!line.empty()) { lines.push_back(line); }
+    }
+    return lines;
+}
+
+TEST(BGZF, Detection) {
+    CHECK(BGZFFile::is_bgzf("unittests/data/vcf/test.vcf.gz"));
+    CHECK(!BGZFFile::is_bgzf("unittests/data/vcf/test2.vcf.gz"));
+    CHECK(!BGZFFile::is_bgzf("unittests/data/vcf/test.vcf"));
+    CHECK(!BGZFFile::is_bgzf("unittests/data/doesnt_exist"));
+}
+
+TEST(BGZF, LinesMatchUncompressed) {
+    // test.vcf.gz is cut into 10 byte blocks, so lines span many blocks
+    // and the file spans several jobs
+    UncompressedFile plain("unittests/data/vcf/test.vcf");
+    std::vector<std::string> expected = all_lines(plain);
+
+    for (int nthreads : {1, 3}) {
+        BGZFFile f(nthreads);
+        f.openfile("unittests/data/vcf/test.vcf.gz", false);
+        CHECK(all_lines(f) == expected);
+        CHECK(f.eof());
+        f.closefile();
+    }
+}
+
+TEST(BGZF, LongLine) {
+    BGZFFile f(2);
+    f.openfile("unittests/data/longline.txt.gz", false);
+    std::string expected(100000, 'a');
+    CHECK(f.getline() == expected);
+    CHECK(f.eof());
+}
+
+TEST(BGZF, ReadChunks) {
+    BGZFFile f;
+    f.openfile("unittests/data/vcf/test.vcf.gz", false);
+    std::string all, chunk;
+    while (f.read_chunk(chunk)) { all += chunk; }
+
+    UncompressedFile plain("unittests/data/vcf/test.vcf");
+    std::string expected;
+    for (const std::string& line : all_lines(plain)) { expected += line + "\n"; }
+    CHECK(all == expected);
+}
+
+TEST(BGZF, NotBGZF) {
+    BGZFFile f;
+    f.openfile("unittests/data/vcf/test2.vcf.gz", false);
+    CHECK_THROWS(std::runtime_error, f.getline());
+}
+
+TEST(BGZF, ReadVCF) {
+    VCFParams vcfp = {false, false, false, "AF"};
+    Dataset plain = read_vcf("unittests/data/vcf/test.vcf", vcfp);
+    Dataset blocked = read_vcf("unittests/data/vcf/test.vcf.gz", vcfp, 2);
+    Dataset gzipped = read_vcf("unittests/data/vcf/test2.vcf.gz", vcfp);
+    Dataset plain2 = read_vcf("unittests/data/vcf/test2.vcf", vcfp);
+
+    CHECK_EQUAL(plain.nmark(), blocked.nmark());
+    CHECK(plain.chromosomes[1]->positions == blocked.chromosomes[1]->positions);
+    CHECK(plain.chromosomes[1]->frequencies == blocked.chromosomes[1]->frequencies);
+    CHECK_EQUAL(plain2.nmark(), gzipped.nmark());
+    CHECK(plain2.chromosomes[0]->positions == gzipped.chromosomes[0]->positions);
+}
@@ -0,0 +1,65 @@
+#include <vector>
+#include <stdexcept>
+#include "Linalg.hpp"
+#include "HiddenMarkov.hpp"
+#include "batchhmm.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(BatchHMM) {};
+
+TEST(BatchHMM, MatchesGenotypeHMM) {
+    // Every lane has to decode exactly as GenotypeHMM does on its own,
+    // whatever the other lanes' lengths
+    using Linalg::Matrix;
+    Matrix T = {{0.9999, 0.0001}, {0.001, 0.999}};
+    std::vector<double> table = {0.9, 0.2, 0.1, 0.8,
+                                 0.6, 0.3, 0.4, 0.7,
+                                 0.95, 0.01, 0.05, 0.99};
+    std::vector<double> ln_table;
+    for (double p : table) { ln_table.push_back(std::log(p)); }
+
+    const size_t nseq = batchhmm::LANES + 3;
+    std::vector<std::vector<int>> obs(nseq);
+    std::vector<std::vector<uint32_t>> codes(nseq);
+    unsigned int x = 2024;
+    for (size_t k = 0; k < nseq; ++k) {
+        size_t len = k == 2 ? 0 : 50 + 97 * k;
+        for (size_t i = 0; i < len; ++i) {
+            x = x * 1103515245 + 12345;
+            bool inrun = ((i + 13 * k) / 80) % 2;
+            obs[k].push_back(((x >> 16) % 10) < (inrun ? 8u : 1u));
+            codes[k].push_back((x >> 8) % 3);
+        }
+    }
+
+    for (bool use_posteriori : {false, true}) {
+        for (const double* logs : {(const double*)NULL, (const double*)ln_table.data()}) {
+            batchhmm::BatchDecoder decoder(table.data(), logs, 2, T);
+
+            // A full batch, then a partial one
+            for (size_t first = 0; first < nseq; first += batchhmm::LANES) {
+                size_t n = std::min(batchhmm::LANES, nseq - first);
+                batchhmm::Sequence seqs[batchhmm::LANES];
+                std::vector<int> states[batchhmm::LANES];
+                for (size_t lane = 0; lane < n; ++lane) {
+                    size_t k = first + lane;
+                    seqs[lane] = batchhmm::Sequence{obs[k].data(), codes[k].data(), obs[k].size()};
+                }
+                decoder.decode(seqs, n, use_posteriori, states);
+
+                for (size_t lane = 0; lane < n; ++lane) {
+                    size_t k = first + lane;
+                    GenotypeHMM hmm(obs[k], codes[k], table.data(), 2, T, logs);
+                    CHECK(hmm.decode(use_posteriori) == states[lane]);
+                }
+            }
+        }
+    }
+}
+
+TEST(BatchHMM, TwoStatesOnly) {
+    using Linalg::Matrix;
+    Matrix T = {{0.8, 0.1, 0.1}, {0.1, 0.8, 0.1}, {0.1, 0.1, 0.8}};
+    std::vector<double> table(9, 1.0 / 3);
+    CHECK_THROWS(std::invalid_argument, batchhmm::BatchDecoder(table.data(), NULL, 3, T));
+}
@@ -23,3 +23,101 @@ TEST(Combinatorics, PairCombinations) {
     expected = make_pair(2,3);
     CHECK(expected == pairs[2]);
 }
+
+TEST(Combinatorics, PairBlocks) {
+    using combinatorics::pair_blocks;
+    using combinatorics::PairBlock;
+    using combinatorics::nCk;
+
+    const long ns[] = {2, 3, 10, 17};
+    const long blocksizes[] = {1, 3, 4, 100};
+    for (long n : ns) {
+        for (long bs : blocksizes) {
+            std::vector<std::vector<int>> seen(n, std::vector<int>(n, 0));
+            long total = 0;
+            for (const PairBlock& b : pair_blocks(n, bs)) {
+                total += b.npairs();
+                b.for_each_pair([&](long i, long j) { seen[i][j]++; });
+            }
+            CHECK_EQUAL(nCk(n, 2), total);
+
+            // Every pair i < j exactly once, nothing else
+            for (long i = 0; i < n; ++i) {
+                for (long j = 0; j < n; ++j) {
+                    CHECK_EQUAL(i < j ? 1 : 0, seen[i][j]);
+                }
+            }
+        }
+    }
+}
+
+TEST(Combinatorics, BinomialCoefficients) {
+    using combinatorics::nCk;
+    using combinatorics::nCk_exact;
+    using combinatorics::uint128;
+
+    CHECK_EQUAL(1, nCk(5, 0));
+    CHECK_EQUAL(10, nCk(5, 2));
+    CHECK_EQUAL(10, nCk(5, 3));
+    CHECK_EQUAL(0, nCk(2, 3));
+    CHECK_EQUAL(4950, nCk(100, 2));
+
+    // 500k samples, past where doubles stop being exact
+    CHECK_EQUAL(124999750000L, nCk(500000, 2));
+    CHECK(nCk_exact(4000000000L, 2) == (uint128)4000000000L * 3999999999L / 2);
+    CHECK_EQUAL(99884400L, nCk(50, 7));
+}
+
+TEST(Combinatorics, PairIndexDecoding) {
+    using namespace combinatorics;
+
+    CHECK_EQUAL(0, isqrt(0));
+    CHECK_EQUAL(3, isqrt(15));
+    CHECK_EQUAL(4, isqrt(16));
+    CHECK_EQUAL(3037000499UL, isqrt((uint128)3037000499UL * 3037000499UL + 1));
+
+    // Closed form agrees with the general k decoder and with enumeration
+    const long n = 23;
+    long idx = 0;
+    for (long i = 0; i < n; ++i) {
+        for (long j = i + 1; j < n; ++j) {
+            auto pr = pair_at_index(idx, n);
+            CHECK_EQUAL(i, pr.first);
+            CHECK_EQUAL(j, pr.second);
+            CHECK_EQUAL(idx, index_of_pair(i, j, n));
+
+            std::vector<long> expected = {i, j};
+            CHECK(combination_at_index(idx, n, 2) == expected);
+            idx++;
+        }
+    }
+
+    std::vector<long> triple = {0, 1, 2};
+    CHECK(combination_at_index(0, 5, 3) == triple);
+    triple = {2, 3, 4};
+    CHECK(combination_at_index(9, 5, 3) == triple);
+
+    // Large n, where the old floating point decoder was inexact
+    const long bign = 600000;
+    const long last = nCk(bign, 2) - 1;
+    auto pr = pair_at_index(last, bign);
+    CHECK_EQUAL(bign - 2, pr.first);
+    CHECK_EQUAL(bign - 1, pr.second);
+    pr = pair_at_index(index_of_pair(123456, 543210, bign), bign);
+    CHECK_EQUAL(123456, pr.first);
+    CHECK_EQUAL(543210, pr.second);
+}
+
+TEST(Combinatorics, PairRange) {
+    using namespace combinatorics;
+    const long n = 9;
+
+    long idx = 5;
+    for (auto& pr : PairRange(n, 5, 30)) {
+        auto expected = pair_at_index(idx, n);
+        CHECK(expected == pr);
+        idx++;
+    }
+    CHECK_EQUAL(30, idx);
+    CHECK_EQUAL(nCk(n, 2), PairRange(n).size());
+}
@@ -0,0 +1,92 @@
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdio.h>
+#include "datacache.hpp"
+#include "datamodel.hpp"
+#include "FileIOManager.hpp"
+#include "vcf.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(DataCache) {};
+
+TEST(DataCache, RoundTrip) {
+    const char* filename = "unittests/data/tmp_datacache.adb";
+    VCFParams params = {false, false, false, "AF"};
+    Dataset expected = read_vcf("unittests/data/vcf/test.vcf", params);
+    expected.chromosomes[0]->exclusions["Multiallelic"] = 2;
+
+    datacache::Source source = {"unittests/data/vcf/test.vcf", params};
+    datacache::save(filename, expected, source);
+
+    datacache::Source loaded_source = {"", {true, true, true, ""}};
+    Dataset observed = datacache::load(filename, loaded_source);
+    remove(filename);
+
+    CHECK_EQUAL(source.filename, loaded_source.filename);
+    CHECK_EQUAL(params.drop_singletons, loaded_source.params.drop_singletons);
+    CHECK_EQUAL(params.drop_monomorphs, loaded_source.params.drop_monomorphs);
+    CHECK_EQUAL(params.empirical_freqs, loaded_source.params.empirical_freqs);
+    CHECK_EQUAL(params.freq_field, loaded_source.params.freq_field);
+
+    CHECK_EQUAL(expected.ninds(), observed.ninds());
+    CHECK_EQUAL(expected.nchrom(), observed.nchrom());
+    for (size_t c = 0; c < expected.nchrom(); ++c) {
+        const ChromInfo& a = *expected.chromosomes[c];
+        const ChromInfo& b = *observed.chromosomes[c];
+        CHECK_EQUAL(a.label, b.label);
+        CHECK(a.positions == b.positions);
+        CHECK(a.frequencies == b.frequencies);
+        CHECK(a.exclusions == b.exclusions);
+        CHECK(a.freq_codes == b.freq_codes);
+        CHECK_EQUAL(a.variants.size(), b.variants.size());
+        for (size_t v = 0; v < a.variants.size(); ++v) {
+            CHECK_EQUAL(a.variants[v].label, b.variants[v].label);
+            CHECK_EQUAL(a.variants[v].position, b.variants[v].position);
+        }
+    }
+
+    for (size_t i = 0; i < expected.ninds(); ++i) {
+        CHECK_EQUAL(expected.individuals[i].label, observed.individuals[i].label);
+        for (size_t c = 0; c < expected.nchrom(); ++c) {
+            const Genotypes& x = expected.individuals[i].chromosomes[c];
+            const Genotypes& y = observed.individuals[i].chromosomes[c];
+            CHECK(x.hapa == y.hapa);
+            CHECK(x.hapb == y.hapb);
+            CHECK(x.missing == y.missing);
+            CHECK(x.het == y.het);
+            CHECK(x.hzm == y.hzm);
+            CHECK(y.info == observed.chromosomes[c]);
+        }
+    }
+}
+
+TEST(DataCache, RejectsOtherFiles) {
+    datacache::Source source;
+    CHECK_THROWS(std::runtime_error, datacache::load("unittests/data/vcf/test.vcf", source));
+    CHECK_THROWS(std::invalid_argument, datacache::load("unittests/data/nonexistent.adb", source));
+}
+
+TEST(DataCache, RejectsTruncatedFile) {
+    const char* filename = "unittests/data/tmp_truncated.adb";
+    VCFParams params = {false, false, false, "AF"};
+    Dataset data = read_vcf("unittests/data/vcf/test.vcf", params);
+    datacache::save(filename, data, datacache::Source{"test.vcf", params});
+
+    std::string contents;
+    {
+        FILE* f = fopen(filename, "rb");
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) { contents.append(buf, n); }
+        fclose(f);
+    }
+
+    FILE* f = fopen(filename, "wb");
+    fwrite(contents.data(), 1, contents.size() - 8, f);
+    fclose(f);
+
+    datacache::Source source;
+    CHECK_THROWS(std::runtime_error, datacache::load(filename, source));
+    remove(filename);
+}
@@ -85,4 +85,97 @@ TEST(DataModel, GenotypeMethods) {
     CHECK(gtc.hapa == exp_hap);
     exp_hap = {1,2};
     CHECK(gtc.hapb == exp_hap);
-};
\ No newline at end of file
+};
+
+TEST(DataModel, PackedGenotypes) {
+    VCFParams vcfp = {false, false, false, "AF"};
+
+    Dataset d = read_vcf("unittests/data/vcf/test2.vcf", vcfp);
+    d.pack();
+
+    for (auto& ind : d.individuals) {
+        auto& gt = ind.chromosomes[0];
+        CHECK(gt.packed);
+        CHECK_EQUAL(1, gt.packed_a.size());
+        CHECK(bitpack::unpack(gt.packed_a) == gt.hapa);
+        CHECK(bitpack::unpack(gt.packed_b) == gt.hapb);
+        CHECK(bitpack::unpack(gt.packed_missing) == gt.missing);
+    }
+
+    std::vector<int> sites = {0, 63, 64, 130};
+    PackedSites bits = bitpack::pack(sites, 131);
+    CHECK_EQUAL(3, bits.size());
+    CHECK_EQUAL(4, bitpack::count(bits));
+    CHECK(bitpack::test(bits, 64));
+    CHECK(!bitpack::test(bits, 65));
+    CHECK(bitpack::unpack(bits) == sites);
+}
+
+TEST(DataModel, FrequencyCodes) {
+    ChromInfo c("1");
+    c.add_variant("a", 100, 0.25);
+    c.add_variant("b", 200, 0.01);
+    c.add_variant("c", 300, 0.25);
+    c.add_variant("d", 400, 0.5);
+    c.encode_frequencies();
+
+    std::vector<double> levels = {0.01, 0.25, 0.5};
+    std::vector<uint32_t> codes = {1, 0, 1, 2};
+    CHECK(levels == c.freq_levels);
+    CHECK(codes == c.freq_codes);
+    for (size_t i = 0; i < c.nmark(); ++i) {
+        CHECK_EQUAL(c.frequencies[i], c.freq_levels[c.freq_codes[i]]);
+    }
+}
+
+TEST(DataModel, CarrierIndex) {
+    // Markers 1 and 3 of each chromosome are rare
+    Dataset d;
+    for (const char* lab : {"A", "B", "C", "D"}) { d.add_individual(lab); }
+    for (const char* lab : {"1", "2"}) {
+        d.add_chromosome(lab);
+        for (int m = 0; m < 4; ++m) {
+            d.chromosomes.back()->add_variant("v", 100 * (m + 1), m % 2 ? 0.01 : 0.3);
+        }
+    }
+    d.individuals[0].set_allele(0, 1, 0, 1);
+    d.individuals[2].set_allele(0, 1, 0, 1);
+    d.individuals[2].set_allele(0, 1, 1, 1);
+    d.individuals[3].set_allele(0, 2, 1, 1);
+    d.individuals[3].set_allele(0, 3, 0, 1);
+    d.individuals[1].set_allele(1, 3, 1, 1);
+    d.finalize();
+    CHECK(d.carriers.empty());
+
+    d.index_carriers(0.05, SIZE_MAX);
+    CHECK_EQUAL(2, d.carriers.size());
+    const CarrierIndex& c = d.carriers[0];
+    CHECK(c.built);
+    CHECK(c.sites == std::vector<int>({1, 3}));
+    CHECK(std::vector<int>(c.begin(0), c.end(0)) == std::vector<int>({0, 2}));
+    CHECK(std::vector<int>(c.begin(1), c.end(1)) == std::vector<int>({3}));
+    CHECK(std::vector<int>(d.carriers[1].begin(1), d.carriers[1].end(1)) == std::vector<int>({1}));
+
+    // Individual indices follow a subset
+    d.subset({"B", "C", "D"});
+    CHECK(std::vector<int>(c.begin(0), c.end(0)) == std::vector<int>({1}));
+    CHECK(std::vector<int>(c.begin(1), c.end(1)) == std::vector<int>({2}));
+    CHECK(c.carriers == carrier_index(d, 0, c.sites).carriers);
+    CHECK(d.carriers[1].carriers == carrier_index(d, 1, c.sites).carriers);
+
+    // Only what fits in the budget is built
+    size_t first = d.carriers[0].bytes();
+    d.index_carriers(0.05, first);
+    CHECK(d.carriers[0].built);
+    CHECK(!d.carriers[1].built);
+    CHECK_EQUAL(0, d.carriers[1].bytes());
+    d.index_carriers(0.05, first - 1);
+    CHECK(!d.carriers[0].built);
+    CHECK(d.carriers[1].built);
+
+    // Finalizing again rebuilds it
+    d.index_carriers(0.05, SIZE_MAX);
+    d.individuals[0].set_allele(1, 1, 0, 1);
+    d.finalize();
+    CHECK(std::vector<int>(d.carriers[1].begin(0), d.carriers[1].end(0)) == std::vector<int>({0}));
+}
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
 #include "FileIOManager.hpp"
 #include "CppUTest/TestHarness.h"
 
@@ -31,4 +34,60 @@
 //     std::string read = f.getline();
 //     CHECK(read.compare("a,b,c") == 0); 
 //     remove(filename);
-// }
\ No newline at end of file
+// }
+
+TEST_GROUP(LineReader) {};
+
+static std::vector<std::string> read_lines(LineReader& r) {
+    std::vector<std::string> lines;
+    stringops::StringSpan line;
+    while (r.getline(line)) { lines.push_back(line.str()); }
+    return lines;
+}
+
+TEST(LineReader, SplitsLines) {
+    std::vector<std::string> expected = {"a b c", "d e", "f"};
+
+    // Mapped
+    LineReader mapped("unittests/data/abc.txt");
+    CHECK(read_lines(mapped) == expected);
+
+    // Read in blocks
+    UncompressedFile f("unittests/data/abc.txt");
+    LineReader blocks(&f);
+    CHECK(read_lines(blocks) == expected);
+
+    CHECK_THROWS(std::invalid_argument, LineReader("unittests/data/nonexistent.txt"));
+}
+
+TEST(LineReader, LinesLongerThanABlock) {
+    const char* filename = "unittests/data/tmp_linereader.txt";
+    std::vector<std::string> expected = {"x", std::string(2 * LineReader::BLOCK_SIZE + 7, 'a'), "",
+                                         std::string(LineReader::BLOCK_SIZE - 1, 'b'), "y"};
+    {
+        DelimitedFileWriter out(filename, '\t');
+        for (const std::string& line : expected) { out.writeline(line); }
+        out.closefile();
+    }
+
+    LineReader mapped(filename);
+    CHECK(read_lines(mapped) == expected);
+
+    UncompressedFile f(filename);
+    LineReader blocks(&f);
+    CHECK(read_lines(blocks) == expected);
+    f.closefile();
+
+    remove(filename);
+}
+
+#ifdef HAVE_ZLIB
+TEST(LineReader, Compressed) {
+    GZFile f("unittests/data/longline.txt.gz");
+    LineReader r(&f);
+    stringops::StringSpan line;
+    CHECK(r.getline(line));
+    CHECK(line == std::string(100000, 'a'));
+    CHECK(!r.getline(line));
+}
+#endif
@@ -1,4 +1,5 @@
 #include <vector>
+#include <cmath>
 #include "Linalg.hpp"
 #include "HiddenMarkov.hpp"
 #include "CppUTest/TestHarness.h"
@@ -19,39 +20,53 @@ TEST(HiddenMarkov, ForwardsBackwards)
     };
 
     Matrix e = {{.99, .01}, {0.01, .99}};
-    // GenotypeHMM uses different emission tables for each observation
-    std::vector<Matrix*> evp(o.size(), &e);
+    // GenotypeHMM can use a different emission matrix for each
+    // observation, but here they all use the first (only) one
+    std::vector<uint32_t> codes(o.size(), 0);
  
-    GenotypeHMM hmmfwbw = GenotypeHMM(o, evp, t);
+    GenotypeHMM hmmfwbw = GenotypeHMM(o, codes, e.data, e.nrow, t);
     auto pred_states = hmmfwbw.decode(false);
 
     CHECK(o == pred_states);
 
 }
 
-// TEST(HiddenMarkov, Viterbi)
-// {
-//     // A quick sanity check. The hidden states should just be the observations
-//     using Linalg::Matrix;
-//     std::vector<int> o = {0, 0, 0, 1, 1, 1, 1, 0, 0, 0};
+TEST(HiddenMarkov, Viterbi)
+{
+    // A quick sanity check. The hidden states should just be the observations
+    using Linalg::Matrix;
+    std::vector<int> o = {0, 0, 0, 1, 1, 1, 1, 0, 0, 0};
     
-//     // Transition matrix
-//     Matrix t = {
-//         {.75, .25},
-//         {.25, .75}
-//     };
+    // Transition matrix
+    Matrix t = {
+        {.75, .25},
+        {.25, .75}
+    };
 
-//     Matrix e = {{.99, .01}, {0.01, .99}};
-//     // GenotypeHMM uses different emission tables for each observation
-//     std::vector<Matrix> ev = {};
-//     for (size_t i=0; i<o.size(); ++i) { ev.push_back(e); } 
+    Matrix e = {{.99, .01}, {0.01, .99}};
+    Matrix ln_e = e.apply(&std::log);
 
-//     GenotypeHMM hmmfwbw = GenotypeHMM(o, ev, t);
-//     auto pred_states = hmmfwbw.decode(true);
+    std::vector<uint32_t> codes(o.size(), 0);
 
-//     CHECK(o == pred_states);
+    GenotypeHMM hmm(o, codes, e.data, e.nrow, t);
+    CHECK(o == hmm.decode(true));
 
-// }
+    // Same answer with precomputed log emissions
+    GenotypeHMM loghmm(o, codes, e.data, e.nrow, t, ln_e.data);
+    CHECK(o == loghmm.decode(true));
+
+    // A single contrary observation isn't worth two transitions...
+    std::vector<int> o2 = {0, 0, 0, 0, 1, 0, 0, 0, 0};
+    std::vector<uint32_t> codes2(o2.size(), 0);
+    Matrix sticky = {{.999, .001}, {.001, .999}};
+    std::vector<int> expected(o2.size(), 0);
+    CHECK(expected == GenotypeHMM(o2, codes2, e.data, e.nrow, sticky).decode(true));
+
+    // ...and decoding nothing gives nothing
+    std::vector<int> none;
+    std::vector<uint32_t> nocodes;
+    CHECK(GenotypeHMM(none, nocodes, e.data, e.nrow, t).decode(true).empty());
+}
 
 TEST(HiddenMarkov, WorkedExample) {
     // From: 
@@ -67,8 +82,8 @@ TEST(HiddenMarkov, WorkedExample) {
     Matrix P = {{0.9, 0.2}, {0.1, 0.8}};
     std::vector<int> obs = {0,0,1,0,0};
 
-    std::vector<Matrix*> obsmats(obs.size(), &P);
-    GenotypeHMM hmmfwbw(obs, obsmats, T);
+    std::vector<uint32_t> codes(obs.size(), 0);
+    GenotypeHMM hmmfwbw(obs, codes, P.data, P.nrow, T);
     auto pred_states = hmmfwbw.decode(false);
 
     std::vector<int> expected = {0,0,1,0,0};
@@ -77,3 +92,71 @@ TEST(HiddenMarkov, WorkedExample) {
 
 
 }
+
+TEST(HiddenMarkov, FixedStateForwardsBackwards) {
+    // The two state specialization has to agree with the general version
+    using Linalg::Matrix;
+    Matrix T = {{0.99, 0.01}, {0.02, 0.98}};
+    // Two emission matrices, end to end
+    std::vector<double> table = {0.9, 0.2, 0.1, 0.8,
+                                 0.6, 0.3, 0.4, 0.7};
+
+    std::vector<int> obs;
+    std::vector<uint32_t> codes;
+    unsigned int x = 12345;
+    for (int i = 0; i < 2000; ++i) {
+        x = x * 1103515245 + 12345;
+        // Runs of mostly-1 observations inside mostly-0 ones
+        bool inrun = (i / 150) % 2;
+        obs.push_back(((x >> 16) % 10) < (inrun ? 8u : 2u));
+        codes.push_back((x >> 8) & 1);
+    }
+
+    GenotypeHMM hmm(obs, codes, table.data(), 2, T);
+    std::vector<int> generic = hmm.forwards_backwards_generic();
+    CHECK(generic == hmm.forwards_backwards_fixed<2>());
+    CHECK(generic == hmm.decode(false));
+
+    std::vector<int> none;
+    std::vector<uint32_t> nocodes;
+    CHECK(GenotypeHMM(none, nocodes, table.data(), 2, T).decode(false).empty());
+}
+
+TEST(HiddenMarkov, DecodeWindow) {
+    // A window decoded with the messages at its edges has to match the
+    // whole sequence decoded at once
+    using Linalg::Matrix;
+    Matrix T = {{0.99, 0.01}, {0.02, 0.98}};
+    std::vector<double> table = {0.9, 0.2, 0.1, 0.8,
+                                 0.6, 0.3, 0.4, 0.7};
+
+    std::vector<int> obs;
+    std::vector<uint32_t> codes;
+    unsigned int x = 54321;
+    for (int i = 0; i < 1000; ++i) {
+        x = x * 1103515245 + 12345;
+        bool inrun = (i / 120) % 2;
+        obs.push_back(((x >> 16) % 10) < (inrun ? 8u : 2u));
+        codes.push_back((x >> 8) & 1);
+    }
+
+    for (bool max_product : {false, true}) {
+        GenotypeHMM hmm(obs, codes, table.data(), 2, T);
+        std::vector<int> whole = hmm.decode(max_product);
+        std::vector<double> fw, bw;
+        hmm.messages(max_product, fw, bw);
+        CHECK_EQUAL(2 * obs.size(), fw.size());
+        CHECK_EQUAL(2 * obs.size(), bw.size());
+
+        // Windows in the middle and at either end
+        size_t windows[3][2] = {{100, 300}, {0, 150}, {850, 1000}};
+        for (auto& w : windows) {
+            size_t lo = w[0], hi = w[1];
+            GenotypeHMM part(obs.data() + lo, codes.data() + lo, hi - lo, table.data(), 2, T);
+            std::vector<int> decoded = part.decode_window(max_product,
+                                                          lo ? &fw[2 * (lo - 1)] : NULL,
+                                                          hi < obs.size() ? &bw[2 * (hi - 1)] : NULL);
+            CHECK(std::vector<int>(whole.begin() + lo, whole.begin() + hi) == decoded);
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "combinatorics.hpp"
+#include "datamodel.hpp"
+#include "prefilter.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(Prefilter) {};
+
+// 40 individuals with random rare variants on one chromosome of 500
+// markers 10kb apart. Every tenth marker is common.
+static Dataset prefilter_dataset(std::vector<int>& rare_sites) {
+    const int ninds = 40;
+    const int nmark = 500;
+    Dataset d;
+    for (int i = 0; i < ninds; ++i) { d.add_individual("I" + std::to_string(i)); }
+    d.add_chromosome("1");
+    for (int m = 0; m < nmark; ++m) {
+        bool rare = m % 10;
+        d.chromosomes[0]->add_variant("v" + std::to_string(m), 10000 * (m + 1), rare ? 0.01 : 0.3);
+        if (rare) { rare_sites.push_back(m); }
+    }
+
+    uint32_t x = 777;
+    for (int m = 0; m < nmark; ++m) {
+        for (int h = 0; h < 2 * ninds; ++h) {
+            x = x * 1664525 + 1013904223;
+            if ((x >> 8) % 100 < (m % 10 ? 3u : 30u)) { d.individuals[h / 2].set_allele(0, m, h % 2, 1); }
+        }
+    }
+    d.finalize();
+    return d;
+}
+
+TEST(Prefilter, PairFilter) {
+    std::vector<int> rares;
+    Dataset d = prefilter_dataset(rares);
+    CarrierIndex index = carrier_index(d, 0, rares);
+    const ChromInfo& chrom = *d.chromosomes[0];
+    const int window = 500000;
+
+    for (int threshold : {1, 3, 6}) {
+        long npassed = 0, expected_npassed = 0;
+        for (const combinatorics::PairBlock& block : combinatorics::pair_blocks(d.ninds(), 7)) {
+            prefilter::PairFilter whole(index, chrom, block, threshold);
+            prefilter::PairFilter windowed(index, chrom, block, threshold, window);
+            npassed += whole.npassed();
+
+            block.for_each_pair([&](long i, long j) {
+                // Co-carried rare variants, by brute force
+                std::vector<int> shared;
+                const AlleleSites& a = d.individuals[i].chromosomes[0].hma;
+                const AlleleSites& b = d.individuals[j].chromosomes[0].hma;
+                for (int m : a) {
+                    if (m % 10 && std::binary_search(b.begin(), b.end(), m)) { shared.push_back(m); }
+                }
+                bool expected = (int)shared.size() >= threshold;
+                CHECK_EQUAL(expected, whole.passes(i, j));
+                expected_npassed += expected;
+
+                // Any two neighbouring windows with enough between them
+                bool expected_windowed = false;
+                for (long w = 0; w * window <= chrom.positions.back(); ++w) {
+                    int n = 0;
+                    for (int m : shared) {
+                        long mw = chrom.positions[m] / window;
+                        n += (mw == w || mw == w + 1);
+                    }
+                    expected_windowed |= n >= threshold;
+                }
+                CHECK_EQUAL(expected_windowed, windowed.passes(i, j));
+            });
+        }
+        CHECK_EQUAL(expected_npassed, npassed);
+    }
+
+    // A threshold of 0 lets everything through
+    combinatorics::PairBlock block = combinatorics::pair_blocks(d.ninds(), 7)[0];
+    CHECK_EQUAL(block.npairs(), prefilter::PairFilter(index, chrom, block, 0).npassed());
+}
@@ -0,0 +1,67 @@
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "FileIOManager.hpp"
+#include "segmentfile.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(SegmentFile) {};
+
+TEST(SegmentFile, RoundTrip) {
+    using namespace segfile;
+    const char* filename = "unittests/data/tmp_segfile.ibdb";
+
+    Index idx;
+    idx.individuals = {"A", "B", "C"};
+    idx.chromosomes = {ChromEntry{"1", 0, 0}, ChromEntry{"2", 0, 0}};
+    idx.blocks = {BlockEntry{0, 0, 3, 0, 3, 0, 2},
+                  BlockEntry{1, 0, 3, 0, 3, 2, 1}};
+    idx.summarize_chromosomes();
+    CHECK_EQUAL(0, idx.chromosomes[0].first_record);
+    CHECK_EQUAL(2, idx.chromosomes[0].nrecords);
+    CHECK_EQUAL(2, idx.chromosomes[1].first_record);
+    CHECK_EQUAL(1, idx.chromosomes[1].nrecords);
+
+    std::vector<Record> records = {
+        Record{0, 1, 0, 1000, 2501000, 1, 10, 5, 0, 3.25f},
+        Record{0, 2, 0, 500, 900, 2, 4, 4, 1, 1.5f},
+        Record{1, 2, 1, 10, 20, 1, 7, 6, 0, 12.0f}
+    };
+
+    {
+        DelimitedFileWriter out(filename, '\t');
+        out.writeblock(header());
+        std::string buf;
+        for (const Record& r : records) { append(buf, r); }
+        out.writeblock(buf);
+        out.writeblock(footer(idx));
+        out.closefile();
+    }
+
+    Reader reader(filename);
+    CHECK_EQUAL(3, reader.nrecords);
+    CHECK(reader.index.individuals == idx.individuals);
+    CHECK_EQUAL(2, reader.index.chromosomes.size());
+    CHECK_EQUAL("2", reader.index.chromosomes[1].label);
+    CHECK_EQUAL(2, reader.index.chromosomes[1].first_record);
+    CHECK_EQUAL(2, reader.index.blocks.size());
+    CHECK_EQUAL(1, reader.index.blocks[1].nrecords);
+    CHECK(reader.index.blocks[0].contains(2));
+
+    // Seek to the second chromosome
+    const ChromEntry& c = reader.index.chromosomes[1];
+    std::vector<Record> chrom2 = reader.read(c.first_record, c.nrecords);
+    CHECK_EQUAL(1, chrom2.size());
+    CHECK_EQUAL(7, chrom2[0].nmark);
+
+    std::vector<std::string> expected = {"A", "B", "1", "1000", "2501000", "2.50Mb",
+                                         "1", "10", "5", "0", "3.25"};
+    CHECK(tokens(reader.read(0, 1)[0], reader.index) == expected);
+    CHECK_THROWS(std::out_of_range, reader.read(2, 2));
+
+    remove(filename);
+}
+
+TEST(SegmentFile, RejectsText) {
+    CHECK_THROWS(std::runtime_error, segfile::Reader("unittests/data/abc.txt"));
+}
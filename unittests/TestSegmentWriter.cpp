@@ -0,0 +1,86 @@
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include "FileIOManager.hpp"
+#include "mpscqueue.hpp"
+#include "segmentwriter.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(SegmentWriter) {};
+
+TEST(SegmentWriter, MPSCQueue) {
+    using adios::SegmentBatch;
+    MPSCQueue<SegmentBatch> q;
+    CHECK(q.pop() == nullptr);
+
+    const int nthreads = 4;
+    const int per_thread = 1000;
+    std::vector<std::thread> producers;
+    for (int t = 0; t < nthreads; ++t) {
+        producers.push_back(std::thread([&q, t]() {
+            for (int i = 0; i < per_thread; ++i) {
+                SegmentBatch* b = new SegmentBatch;
+                b->sequence = t * per_thread + i;
+                q.push(b);
+            }
+        }));
+    }
+    for (auto& th : producers) th.join();
+
+    // Everything comes out once, and each producer's items in order
+    std::vector<int> last(nthreads, -1);
+    int n = 0;
+    while (SegmentBatch* b = q.pop()) {
+        int t = b->sequence / per_thread;
+        int i = b->sequence % per_thread;
+        CHECK(i > last[t]);
+        last[t] = i;
+        n++;
+        delete b;
+    }
+    CHECK_EQUAL(nthreads * per_thread, n);
+}
+
+TEST(SegmentWriter, OrderedOutput) {
+    using adios::SegmentBatch;
+    const char* filename = "unittests/data/tmp_segwriter.txt";
+    const int nthreads = 4;
+    const int nbatch = 400;
+
+    long written_pairs = 0;
+    {
+        DelimitedFileWriter out(filename, '\t');
+
+        // A tiny memory limit, so producers have to wait on the writer
+        adios::SegmentWriter writer(out, 64, [&](const SegmentBatch& b) { written_pairs += b.npairs; });
+
+        std::vector<std::thread> producers;
+        for (int t = 0; t < nthreads; ++t) {
+            producers.push_back(std::thread([&writer, t]() {
+                // Each thread submits every nthreads-th batch, so the
+                // writer has to interleave them
+                for (int i = t; i < nbatch; i += nthreads) {
+                    SegmentBatch* b = new SegmentBatch;
+                    b->sequence = i;
+                    b->npairs = 1;
+                    b->text = (i % 3) ? std::to_string(i) + "\n" : "";
+                    writer.submit(b);
+                }
+            }));
+        }
+        for (auto& th : producers) th.join();
+        writer.finish();
+        out.closefile();
+    }
+    CHECK_EQUAL(nbatch, written_pairs);
+
+    UncompressedFile f(filename);
+    for (int i = 0; i < nbatch; ++i) {
+        if (i % 3 == 0) continue;
+        std::string line = f.getline();
+        CHECK_EQUAL(std::to_string(i), line);
+    }
+    f.closefile();
+    remove(filename);
+}
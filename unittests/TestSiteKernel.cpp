@@ -0,0 +1,105 @@
+#include <vector>
+#include <stdlib.h>
+#include "datamodel.hpp"
+#include "adios.hpp"
+#include "bitpack.hpp"
+#include "sitekernel.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(SiteKernel) {};
+
+// A random dataset long enough that the vector loops (not just the
+// scalar tail) get exercised.
+static Dataset random_dataset(int ninds, int nmark) {
+    Dataset d;
+    for (int i = 0; i < ninds; ++i) { d.add_individual("I" + std::to_string(i)); }
+    d.add_chromosome("1");
+
+    srand48(1234);
+    for (int m = 0; m < nmark; ++m) {
+        double fq = drand48() * 0.2;
+        d.chromosomes[0]->add_variant(".", m, fq);
+        for (auto& ind : d.individuals) {
+            if (drand48() < 0.01) { ind.set_allele(0, m, 0, -1); continue; }
+            if (drand48() < fq) ind.set_allele(0, m, 0, 1);
+            if (drand48() < fq) ind.set_allele(0, m, 1, 1);
+        }
+    }
+    d.finalize();
+    d.pack();
+    return d;
+}
+
+TEST(SiteKernel, ImplementationsAgree) {
+    using namespace sitekernel;
+    Dataset d = random_dataset(6, 1000);
+    int nmark = d.chromosomes[0]->nmark();
+
+    std::vector<int> rares;
+    for (int i = 0; i < nmark; ++i) {
+        if (d.chromosomes[0]->frequencies[i] < 0.05) { rares.push_back(i); }
+    }
+    PackedSites rare_mask = bitpack::pack(rares, nmark);
+    std::vector<int> requests = {3, 64, 65, 500, 511, 512, 999};
+
+    const Implementation impls[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512};
+
+    for (size_t i = 0; i < d.ninds(); ++i) {
+        for (size_t j = i + 1; j < d.ninds(); ++j) {
+            auto& ind1 = d.individuals[i];
+            auto& ind2 = d.individuals[j];
+            auto expected = adios::find_informative_sites_unphased(ind1, ind2, 0, rares);
+            auto expected_req = adios::find_informative_sites_unphased(ind1, ind2, 0, rares, requests);
+            CHECK(!expected.sites.empty());
+
+            for (auto impl : impls) {
+                if (!is_available(impl)) continue;
+                auto observed = adios::find_informative_sites_unphased_packed(ind1, ind2, 0, rare_mask,
+                                                                              AlleleSites(), impl);
+                CHECK(expected.sites == observed.sites);
+                CHECK(expected.states == observed.states);
+
+                observed = adios::find_informative_sites_unphased_packed(ind1, ind2, 0, rare_mask,
+                                                                         requests, impl);
+                CHECK(expected_req.sites == observed.sites);
+                CHECK(expected_req.states == observed.states);
+            }
+        }
+    }
+}
+
+TEST(SiteKernel, InformativeMask) {
+    using sitekernel::informative_mask;
+    // bit 0: opposite homozygotes, bit 1: shared het, not rare,
+    // bit 2: shared het, rare, bit 3: shared but missing
+    uint64_t a = 0x1 | 0x2 | 0x4 | 0x8;
+    uint64_t b = 0x1;
+    uint64_t c = 0x2 | 0x4 | 0x8;
+    uint64_t d = 0x0;
+    uint64_t rare = 0x4 | 0x8;
+    uint64_t miss = 0x8;
+    CHECK_EQUAL(0x5u, informative_mask(a, b, c, d, miss, rare, 0));
+    CHECK_EQUAL(0x7u, informative_mask(a, b, c, d, miss, rare, 0x2 | 0x10));
+}
+
+TEST(SiteKernel, Gather) {
+    using namespace sitekernel;
+    std::vector<uint32_t> table(1000);
+    for (size_t i = 0; i < table.size(); ++i) { table[i] = (i * 7919) % 1013; }
+
+    // Lengths that exercise every tail size of the vector paths
+    for (size_t n = 0; n < 40; ++n) {
+        std::vector<int> index;
+        for (size_t i = 0; i < n; ++i) { index.push_back((i * 37 + n) % table.size()); }
+
+        std::vector<uint32_t> expected(n);
+        for (size_t i = 0; i < n; ++i) { expected[i] = table[index[i]]; }
+
+        const Implementation impls[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512};
+        for (auto impl : impls) {
+            std::vector<uint32_t> out(n);
+            gather(table.data(), index.data(), n, out.data(), impl);
+            CHECK(expected == out);
+        }
+    }
+}
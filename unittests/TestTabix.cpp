@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bgzf.hpp"
+#include "tabix.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(Tabix) {};
+
+TEST(Tabix, Reg2Bins) {
+    std::vector<uint32_t> expected = {0, 1, 9, 73, 585, 4681};
+    CHECK(tabix::reg2bins(0, 1, 14, 5) == expected);
+
+    // Straddling two of the smallest bins
+    expected = {0, 1, 9, 73, 585, 4681, 4682};
+    CHECK(tabix::reg2bins(16000, 17000, 14, 5) == expected);
+
+    CHECK(tabix::reg2bins(10, 10, 14, 5).empty());
+}
+
+TEST(Tabix, FindIndex) {
+    CHECK_EQUAL("unittests/data/vcf/test.vcf.gz.csi", tabix::find_index("unittests/data/vcf/test.vcf.gz"));
+    CHECK_EQUAL("", tabix::find_index("unittests/data/vcf/test2.vcf.gz"));
+}
+
+// Lines of the bgzipped test VCF in the chunks the index gives for a region
+static std::vector<std::string> region_lines(const std::string& indexfn, const std::string& chrom,
+                                             int start, int end) {
+    tabix::Index idx(indexfn);
+    BGZFFile f(2);
+    f.set_ranges(idx.query(chrom, start, end));
+    f.openfile("unittests/data/vcf/test.vcf.gz", false);
+    std::vector<std::string> lines;
+    while (f.good()) { lines.push_back(f.getline()); }
+    return lines;
+}
+
+TEST(Tabix, Query) {
+    for (const char* fn : {"unittests/data/vcf/test.vcf.gz.tbi", "unittests/data/vcf/test.vcf.gz.csi"}) {
+        tabix::Index idx(fn);
+        CHECK(idx.has_chrom("20"));
+        CHECK(!idx.has_chrom("X"));
+        CHECK(idx.query("X", 1, 100).empty());
+
+        // Chromosome 1 has one variant, so its chunk is exactly one line
+        std::vector<std::string> lines = region_lines(fn, "1", 1, 1000);
+        CHECK_EQUAL(1, lines.size());
+        CHECK(lines[0].compare(0, 6, "1\t1\trs") == 0);
+
+        // Every line handed out is whole, and the region's variants are there
+        lines = region_lines(fn, "20", 1110000, 1300000);
+        bool found = false;
+        for (const std::string& line : lines) {
+            CHECK(line.compare(0, 3, "20\t") == 0);
+            CHECK_EQUAL(11, std::count(line.begin(), line.end(), '\t'));
+            found |= line.find("\t1230237\t") != std::string::npos;
+        }
+        CHECK(found);
+    }
+}
+
+TEST(Tabix, NotAnIndex) {
+    CHECK_THROWS(std::runtime_error, tabix::Index("unittests/data/vcf/test.vcf.gz"));
+}
@@ -58,4 +58,251 @@ TEST(VCF, MinorAlleleInvert) {
     CHECK(con.alts == expected);
 
 
-}
\ No newline at end of file
+}
+TEST(VCF, RecordViewMatchesRecord) {
+    // The in-place parser has to agree with VCFRecord on every line
+    const char* files[] = {"unittests/data/vcf/test.vcf",
+                           "unittests/data/vcf/test2.vcf",
+                           "unittests/data/vcf/test_informative_sites.vcf"};
+    size_t nchecked = 0;
+    for (const char* fn : files) {
+        UncompressedFile f(fn);
+        size_t ninds = 0;
+        while (f.good()) {
+            std::string line = f.getline();
+            if (line.empty() || stringops::startswith(line, "##")) { continue; }
+            if (stringops::startswith(line, "#")) {
+                ninds = stringops::split(line, "\t").size() - 9;
+                continue;
+            }
+
+            VCFRecord rec(line);
+            VCFRecordView view(line.data(), line.size());
+
+            CHECK(view.chrom == rec.chrom);
+            CHECK_EQUAL(rec.pos, view.pos);
+            CHECK(view.label == rec.label);
+            CHECK(view.infostr == rec.infostr);
+            CHECK(view.format == rec.format);
+            CHECK(view.data == rec.data);
+            CHECK_EQUAL(rec.nalleles(), view.nalleles());
+            CHECK_EQUAL(rec.is_snv(), view.is_snv());
+            CHECK_EQUAL(rec.get_info_freq("AF"), view.get_info_freq("AF"));
+            CHECK_EQUAL(rec.get_info_freq("DP"), view.get_info_freq("DP"));
+            CHECK_EQUAL(rec.get_info_freq("NOPE"), view.get_info_freq("NOPE"));
+
+            VCFRecordGenotypeContainer a(ninds), b(ninds);
+            rec.get_minor_alleles(a);
+            view.get_minor_alleles(b);
+            CHECK(a.alts == b.alts);
+            CHECK(a.missing == b.missing);
+            nchecked++;
+        }
+    }
+    CHECK(nchecked > 0);
+}
+
+TEST(VCF, RecordViewFields) {
+    std::string line = "2\t1234\trs1\tA\tC,GT\t50\tPASS\tAF=0.25;DB;X=1=2\tDP:GT\t3:0|1\t4:./.\t5:1/1\t6:0";
+    VCFRecordView rec(line.data(), line.size());
+    CHECK(rec.chrom == "2");
+    CHECK_EQUAL(1234, rec.pos);
+    CHECK(rec.label == "rs1");
+    CHECK_EQUAL(3, rec.nalleles());
+    CHECK(rec.is_snv());
+    CHECK_EQUAL(0.25, rec.get_info_freq("AF"));
+    CHECK_EQUAL(0.0, rec.get_info_freq("DB"));
+    CHECK_EQUAL(1.0, rec.get_info_freq("X"));
+
+    VCFRecordGenotypeContainer con(4);
+    rec.get_minor_alleles(con);
+    std::vector<size_t> alts = {1, 4, 5};
+    std::vector<size_t> missing = {1};
+    CHECK(con.alts == alts);
+    CHECK(con.missing == missing);
+    CHECK_EQUAL(0, con.malformed);
+
+    std::string shortline = "2\t1234\trs1\tA";
+    CHECK_THROWS(std::invalid_argument, VCFRecordView(shortline.data(), shortline.size()));
+}
+
+TEST(VCF, InfoKey) {
+    std::string info = "AFR=0.9;MAF=0.8;DB;AF=0.25,0.5;X=1=2;AF_EUR=0.1;END";
+    VCFInfoKey::Span value;
+
+    VCFInfoKey af("AF");
+    CHECK(af.find(info.data(), info.size(), value));
+    CHECK(value == "0.25,0.5");
+    CHECK_EQUAL(0.25, af.number(info.data(), info.size()));
+
+    VCFInfoKey db("DB");
+    CHECK(db.find(info.data(), info.size(), value));
+    CHECK(value.empty());
+    CHECK_EQUAL(0.0, db.number(info.data(), info.size()));
+
+    // Flags at the end of the column, and values cut at '='
+    CHECK(VCFInfoKey("END").find(info.data(), info.size(), value));
+    CHECK(value.empty());
+    CHECK_EQUAL(1.0, VCFInfoKey("X").number(info.data(), info.size()));
+    CHECK_EQUAL(0.1, VCFInfoKey("AF_EUR").number(info.data(), info.size()));
+
+    // Prefixes and suffixes of other keys don't match
+    CHECK_FALSE(VCFInfoKey("A").find(info.data(), info.size(), value));
+    CHECK_FALSE(VCFInfoKey("F").find(info.data(), info.size(), value));
+    CHECK_FALSE(VCFInfoKey("EN").find(info.data(), info.size(), value));
+    CHECK_FALSE(VCFInfoKey("").find(info.data(), info.size(), value));
+    CHECK_EQUAL(0.0, VCFInfoKey("NOPE").number(info.data(), info.size()));
+
+    // Only the span is looked at
+    CHECK_FALSE(af.find(info.data(), 4, value));
+    CHECK(VCFInfoKey("AFR").find(info.data(), 5, value));
+    CHECK(value == "0");
+}
+
+TEST(VCF, DecodeGT) {
+    struct Case {
+        const char* gt;
+        GTCall call;
+        bool alt_a;
+        bool alt_b;
+    };
+    std::vector<Case> cases = {
+        {"0|0", GT_CALLED, false, false},
+        {"0/1", GT_CALLED, false, true},
+        {"1|0", GT_CALLED, true, false},
+        {"2/1", GT_CALLED, true, true},
+        {"0", GT_CALLED, false, false},
+        {"1", GT_CALLED, true, true},
+        {"10/0", GT_CALLED, true, false},
+        {"0|12", GT_CALLED, false, true},
+        {"00/0", GT_CALLED, false, false},
+        {".", GT_MISSING, false, false},
+        {"./.", GT_MISSING, false, false},
+        {".|1", GT_MISSING, false, false},
+        {"0/.", GT_MISSING, false, false},
+        {"", GT_MALFORMED, false, false},
+        {"0/1/1", GT_MALFORMED, false, false},
+        {"0/", GT_MALFORMED, false, false},
+        {"/1", GT_MALFORMED, false, false},
+        {"A/T", GT_MALFORMED, false, false},
+        {"0-1", GT_MALFORMED, false, false},
+        {"01x", GT_MALFORMED, false, false}
+    };
+
+    for (const Case& c : cases) {
+        bool a = false, b = false;
+        const char* end = c.gt + strlen(c.gt);
+        CHECK_EQUAL(c.call, decode_gt(c.gt, end, a, b));
+        if (c.call == GT_CALLED) {
+            CHECK_EQUAL(c.alt_a, a);
+            CHECK_EQUAL(c.alt_b, b);
+        }
+    }
+}
+
+TEST(VCF, MalformedGenotypesCounted) {
+    std::vector<std::string> lines = {
+        "1\t100\trs1\tA\tC\t50\tPASS\t.\tGT\t0/1\tA/T\t0/0",
+        "1\t200\trs2\tA\tC\t50\tPASS\t.\tGT\t0/1/1\t0|1\t",
+        "2\t100\trs3\tA\tC\t50\tPASS\t.\tGT:DP\t0/0:3\t1\t./.",
+        "2\t200\trs4\tA\tC\t50\tPASS\t.\tGT\t0/0\t0/0\t0/0"
+    };
+
+    Dataset d;
+    for (const char* lab : {"A", "B", "C"}) { d.add_individual(lab); }
+    VCFParams params = {false, true, true, "-"};
+    VCFRecordGenotypeContainer con(3);
+    VCFMerger merger(d);
+    for (const std::string& line : lines) {
+        VCFRecordView rec(line.data(), line.size());
+        VCFParsedLine parsed;
+        parse_record(rec, params, VCFInfoKey(params.freq_field), con, parsed);
+        merger.add(parsed);
+    }
+
+    CHECK_EQUAL(2, d.nchrom());
+    CHECK_EQUAL(3, d.chromosomes[0]->malformed_genotypes);
+    CHECK_EQUAL(0, d.chromosomes[1]->malformed_genotypes);
+    CHECK(d.individuals[1].chromosomes[0].missing == AlleleSites({0}));
+    CHECK(d.individuals[2].chromosomes[0].missing == AlleleSites({1}));
+    CHECK_EQUAL(2, d.individuals[1].get_minor_allele_count(1, 0));
+    CHECK_EQUAL(1, d.chromosomes[1]->exclusions["Monomorphic"]);
+}
+
+TEST(VCF, ParallelReadMatchesSequential) {
+    const char* files[] = {"unittests/data/vcf/test.vcf",
+                           "unittests/data/vcf/test2.vcf",
+                           "unittests/data/vcf/test_informative_sites.vcf"};
+    VCFParams vcfp = {true, true, true, "AF"};
+
+    for (const char* fn : files) {
+        Dataset seq = read_vcf(fn, vcfp);
+        Dataset par = read_vcf(fn, vcfp, 3);
+
+        CHECK_EQUAL(seq.ninds(), par.ninds());
+        CHECK_EQUAL(seq.nchrom(), par.nchrom());
+        for (size_t c = 0; c < seq.nchrom(); ++c) {
+            const ChromInfo& a = *seq.chromosomes[c];
+            const ChromInfo& b = *par.chromosomes[c];
+            CHECK_EQUAL(a.label, b.label);
+            CHECK(a.positions == b.positions);
+            CHECK(a.frequencies == b.frequencies);
+            CHECK(a.exclusions == b.exclusions);
+
+            for (size_t i = 0; i < seq.ninds(); ++i) {
+                for (size_t m = 0; m < a.nmark(); ++m) {
+                    CHECK_EQUAL(seq.individuals[i].get_minor_allele_count(c, m),
+                                par.individuals[i].get_minor_allele_count(c, m));
+                }
+            }
+        }
+    }
+}
+
+TEST(VCF, RegionParsing) {
+    VCFRegion all;
+    CHECK(all.whole_file());
+    CHECK(all.contains_line("20\t14370\trs6054257"));
+
+    VCFRegion chrom("20");
+    CHECK_EQUAL("20", chrom.chrom);
+    CHECK(chrom.contains_line("20\t14370\trs6054257"));
+    CHECK(!chrom.contains_line("2\t14370\trs6054257"));
+
+    VCFRegion window("20:1,000,000-2000000");
+    CHECK_EQUAL(1000000, window.start);
+    CHECK_EQUAL(2000000, window.end);
+    CHECK(!window.contains_line("20\t14370\trs6054257"));
+    CHECK(window.contains_line("20\t1110696\trs6040355"));
+
+    VCFRegion open_ended("20:17330-");
+    CHECK_EQUAL(17330, open_ended.start);
+    CHECK(open_ended.contains_line("20\t2345679\trecessive"));
+
+    VCFRegion single("20:17330");
+    CHECK_EQUAL(17330, single.end);
+
+    CHECK_THROWS(std::invalid_argument, VCFRegion("20:abc"));
+    CHECK_THROWS(std::invalid_argument, VCFRegion("20:500-100"));
+    CHECK_THROWS(std::invalid_argument, VCFRegion(":1-2"));
+}
+
+TEST(VCF, ReadRegion) {
+    VCFParams vcfp = {false, false, false, "AF"};
+    VCFRegion region("20:17000-1300000");
+
+    // Without an index lines are filtered as they're read; with one (the
+    // .csi next to test.vcf.gz) only the indexed chunks are read
+    Dataset plain = read_vcf("unittests/data/vcf/test.vcf", vcfp, 1, region);
+    Dataset indexed = read_vcf("unittests/data/vcf/test.vcf.gz", vcfp, 2, region);
+
+    std::vector<int> expected_positions = {17330, 1230237};
+    for (Dataset* d : {&plain, &indexed}) {
+        CHECK_EQUAL(1, d->nchrom());
+        CHECK_EQUAL("20", d->chromosomes[0]->label);
+        CHECK(expected_positions == d->chromosomes[0]->positions);
+        CHECK_EQUAL(1, d->chromosomes[0]->exclusions["Non-diallelic"]);
+    }
+
+    CHECK_THROWS(std::invalid_argument, read_vcf("unittests/data/vcf/test.vcf.gz", vcfp, 1, VCFRegion("X")));
+}
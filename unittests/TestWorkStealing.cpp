@@ -0,0 +1,74 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "workstealing.hpp"
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(WorkStealing) {};
+
+TEST(WorkStealing, EveryTaskOnce) {
+    const long ntasks = 5000;
+    const int nthreads = 4;
+    adios::WorkStealingScheduler sched(ntasks, nthreads);
+
+    // Thread 0 is slow, so the others have to take its work
+    std::vector<std::vector<long>> ran(nthreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&sched, &ran, t]() {
+            long task;
+            while (sched.next(t, task)) {
+                if (t == 0) { std::this_thread::sleep_for(std::chrono::microseconds(50)); }
+                ran[t].push_back(task);
+                sched.done(t, t == 0 ? 5e-5 : 1e-7);
+            }
+        }));
+    }
+    for (auto& th : threads) th.join();
+
+    std::vector<int> seen(ntasks, 0);
+    long stolen = 0;
+    std::vector<adios::ThreadLoad> loads = sched.loads(1.0);
+    CHECK_EQUAL(nthreads, (int)loads.size());
+    for (int t = 0; t < nthreads; ++t) {
+        for (long task : ran[t]) { seen[task]++; }
+        CHECK_EQUAL((long)ran[t].size(), loads[t].tasks);
+        stolen += loads[t].stolen;
+    }
+    for (long task = 0; task < ntasks; ++task) { CHECK_EQUAL(1, seen[task]); }
+    CHECK(stolen > 0);
+    CHECK(ran[0].size() < ran[1].size());
+}
+
+TEST(WorkStealing, Loads) {
+    adios::WorkStealingScheduler sched(3, 2);
+    long task;
+    CHECK(sched.next(0, task));
+    CHECK_EQUAL(0, task);
+    sched.done(0, 0.25);
+
+    // Then thread 0 steals from the back of thread 1's tasks
+    CHECK(sched.next(0, task));
+    CHECK_EQUAL(2, task);
+    sched.done(0, 0.25);
+    CHECK(sched.next(0, task));
+    CHECK_EQUAL(1, task);
+    sched.done(0, 0.25);
+    CHECK(!sched.next(0, task));
+    CHECK(!sched.next(1, task));
+
+    std::vector<adios::ThreadLoad> loads = sched.loads(1.0);
+    DOUBLES_EQUAL(0.75, loads[0].busy, 1e-12);
+    DOUBLES_EQUAL(0.25, loads[0].idle, 1e-12);
+    CHECK_EQUAL(3, loads[0].tasks);
+    CHECK_EQUAL(2, loads[0].stolen);
+    DOUBLES_EQUAL(0.0, loads[1].busy, 1e-12);
+    DOUBLES_EQUAL(1.0, loads[1].idle, 1e-12);
+    CHECK_EQUAL(0, loads[1].tasks);
+}
+
+TEST(WorkStealing, NoTasks) {
+    adios::WorkStealingScheduler sched(0, 3);
+    long task;
+    CHECK(!sched.next(2, task));
+}
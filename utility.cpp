@@ -1,4 +1,5 @@
 #include "utility.hpp"
+#include <unistd.h>
 
 
 // Common string and indexing functions
@@ -87,6 +88,15 @@ std::vector<ValueRun> runs_gte_classic(std::vector<int>& sequence, int minval, i
     return out;
 }
 
+size_t l2_cache_size(void) {
+    const size_t fallback = 256 * 1024;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long sz = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (sz > 0) return sz;
+#endif
+    return fallback;
+}
+
 std::string current_time_string(void) {
     time_t rt = time(NULL); 
     struct tm * local;
@@ -1,11 +1,22 @@
 #include "config.h"
 
 #include "vcf.hpp"
+#include "bcf.hpp"
+#include "tabix.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 // VCF Parsing
 
 VCFRecordGenotypeContainer::VCFRecordGenotypeContainer(size_t n) {
     ninds = n;
+    malformed = 0;
     alts.reserve(2 * ninds);
     missing.reserve(ninds);
 }
@@ -32,36 +43,14 @@ void VCFRecordGenotypeContainer::invert(void) {
 }
 
 double VCFRecord::get_info_freq(const std::string& info_field) {
-    std::string val = get_info_by_key(info_field.c_str());
-    if (val.empty()) { freq = 0.0; }
-    freq = atof(val.c_str());
+    freq = VCFInfoKey(info_field).number(infostr.data(), infostr.size());
     return freq;
 }
 
 std::string VCFRecord::get_info_by_key(const char* key) {
-    size_t keylen = strlen(key);
-    std::string retval("");
-    char* orig_infodup = strdup(infostr.c_str());
-    char* infodup = orig_infodup;
-
-    while (char* token = strsep(&infodup, ";")) {
-
-        if (token == NULL) { break; }
-        if (strlen(token) < keylen) { continue; }
-
-        char* subtok = strsep(&token, "=");
-        if (strcmp(subtok, key) == 0) {
-            char* next_subtok = strsep(&token, "=");
-            if (next_subtok != NULL) { retval = next_subtok; }
-            else { retval = "YES"; }
-            break;
-        }
-
-    }
-    if (retval.empty()) { retval = ""; }
-    free(orig_infodup);
-
-    return retval;
+    stringops::StringSpan value;
+    if (!VCFInfoKey(key).find(infostr.data(), infostr.size(), value)) { return ""; }
+    return value.empty() ? "YES" : value.str();
 }
 
 VCFRecord::VCFRecord(const std::string& vcfline) {
@@ -134,6 +123,71 @@ std::map<std::string, std::string> VCFRecord::infomap(void) const {
     return info;
 }
 
+// Character classes for decode_gt
+enum { GTC_OTHER = 0, GTC_DIGIT, GTC_DOT, GTC_SEP };
+
+static const struct GTCharClasses {
+    unsigned char cls[256];
+    GTCharClasses(void) {
+        memset(cls, GTC_OTHER, sizeof(cls));
+        for (int c = '0'; c <= '9'; ++c) { cls[c] = GTC_DIGIT; }
+        cls[(int)'.'] = GTC_DOT;
+        cls[(int)'/'] = GTC_SEP;
+        cls[(int)'|'] = GTC_SEP;
+    }
+} gt_classes;
+
+GTCall decode_gt(const char* gt, const char* end, bool& alt_a, bool& alt_b)
+{
+    const unsigned char* cls = gt_classes.cls;
+
+    // The usual case: a single digit diploid call
+    if (end - gt == 3 && cls[(unsigned char)gt[1]] == GTC_SEP) {
+        unsigned char a = cls[(unsigned char)gt[0]];
+        unsigned char b = cls[(unsigned char)gt[2]];
+        if (a == GTC_DIGIT && b == GTC_DIGIT) {
+            alt_a = gt[0] != '0';
+            alt_b = gt[2] != '0';
+            return GT_CALLED;
+        }
+        if ((a == GTC_DOT || a == GTC_DIGIT) && (b == GTC_DOT || b == GTC_DIGIT)) {
+            return GT_MISSING;
+        }
+        return GT_MALFORMED;
+    }
+
+    bool alt[2] = {false, false};
+    bool missing = false;
+    int ncalls = 0;
+    const char* p = gt;
+    while (true) {
+        if (p == end || ncalls == 2) { return GT_MALFORMED; }
+
+        unsigned char c = cls[(unsigned char)*p];
+        if (c == GTC_DOT) {
+            missing = true;
+            p++;
+        } else if (c == GTC_DIGIT) {
+            // Any allele but 0, however many digits it has
+            for (; p != end && cls[(unsigned char)*p] == GTC_DIGIT; ++p) {
+                alt[ncalls] = alt[ncalls] || *p != '0';
+            }
+        } else {
+            return GT_MALFORMED;
+        }
+        ncalls++;
+
+        if (p == end) { break; }
+        if (cls[(unsigned char)*p] != GTC_SEP) { return GT_MALFORMED; }
+        p++;
+    }
+
+    if (missing) { return GT_MISSING; }
+    alt_a = alt[0];
+    alt_b = ncalls == 2 ? alt[1] : alt[0];
+    return GT_CALLED;
+}
+
 void VCFRecord::get_minor_alleles(VCFRecordGenotypeContainer& con) const {
     int gtidx = 0;
     auto gtfpos = format.find("GT");
@@ -155,31 +209,18 @@ void VCFRecord::get_minor_alleles(VCFRecordGenotypeContainer& con) const {
         }
 
 
-        int gtlen = strlen(gttok);
-        if (gtlen == 3) {
-
-            if (gttok[0] == '.' || gttok[2] == '.') {
-                con.missing.push_back(indidx);
-            } else {
-                const int allele_a = ((int)gttok[0] - 48);
-                const int allele_b = ((int)gttok[2] - 48);
-
-                if (allele_a != 0) {
-                    con.alts.push_back(2 * indidx);
-                }
-
-                if (allele_b != 0) {
-                    con.alts.push_back(2 * indidx + 1);
-                }
-            }
-        } else  {
-            std::cerr << "Malformed genotype: \'" << gttok << "\' ";
-            std::cerr << "at " << chrom << ':' << pos << " (" << label << ")";
-            std::cerr << " for individual at index " << indidx << ". ";
-            std::cerr << "Marked as missing." << std::endl;
-
+        bool alt_a, alt_b;
+        switch (decode_gt(gttok, gttok + strlen(gttok), alt_a, alt_b)) {
+        case GT_CALLED:
+            if (alt_a) { con.alts.push_back(2 * indidx); }
+            if (alt_b) { con.alts.push_back(2 * indidx + 1); }
+            break;
+        case GT_MALFORMED:
+            con.malformed++;
+            // fall through
+        case GT_MISSING:
             con.missing.push_back(indidx);
-
+            break;
         }
 
     }
@@ -200,136 +241,479 @@ bool VCFRecord::is_snv(void) const {
     return true;
 }
 
-Dataset read_vcf(const std::string & filename, const VCFParams& fileparams) {
-    using stringops::split;
-    using stringops::endswith;
-    using std::vector;
-
+VCFRecordView::VCFRecordView(const char* line, size_t len) : pos(0) {
+    const char* p = line;
+    const char* end = line + len;
+
+    // The first nine fields are tab separated, everything after them is
+    // sample data.
+    Span fields[9];
+    for (int f = 0; f < 9; ++f) {
+        const char* tab = (const char*)memchr(p, '\t', end - p);
+        if (!tab) {
+            if (f < 8) { throw std::invalid_argument("Malformed VCF line: too few fields"); }
+            fields[f] = Span(p, end - p);
+            p = end;
+            break;
+        }
+        fields[f] = Span(p, tab - p);
+        p = tab + 1;
+    }
 
-    Dataset data;
-    UncompressedFile uncompressed;
-    FileObject* vcffile;
+    chrom = fields[0];
+    pos = atoi(fields[1].data); // Stops at the tab
+    label = fields[2];
+    ref = fields[3];
+    alt = fields[4];
+    infostr = fields[7];
+    format = fields[8];
+    data = Span(p, end - p);
+}
 
-#ifdef HAVE_ZLIB
+int VCFRecordView::nalleles(void) const {
+    return 1 + (alt.empty() ? 0 : alt.count(',') + 1);
+}
 
-    GZFile compressed;
+bool VCFRecordView::is_snv(void) const {
+    if (ref.size > 2) { return false; }
 
-    bool gzmode = endswith(filename, ".gz");
-    if (gzmode) {
-        compressed.openfile(filename, false);
-        vcffile = &compressed;
-    } else {
-        uncompressed.openfile(filename, false);
-        vcffile = &uncompressed;
+    const char* start = alt.data;
+    for (const char* c = alt.data; c <= alt.end(); ++c) {
+        if (c == alt.end() || *c == ',') {
+            if (c - start > 2) { return false; }
+            start = c + 1;
+        }
     }
+    return true;
+}
 
-#else
+double VCFRecordView::get_info_freq(const std::string& key) const {
+    return get_info_freq(VCFInfoKey(key));
+}
 
-    if (endswith(filename, ".gz")) {
-        std::cerr << "Adios not compiled with gzip support\n";
-        exit(1);
+int VCFRecordView::gt_index(void) const {
+    int idx = 0;
+    const char* start = format.data;
+    for (const char* c = format.data; c <= format.end(); ++c) {
+        if (c == format.end() || *c == ':') {
+            if (c - start == 2 && start[0] == 'G' && start[1] == 'T') { return idx; }
+            idx++;
+            start = c + 1;
+        }
     }
-    uncompressed = UncompressedFileReader(filename);
-    vcffile = &uncompressed;
+    throw std::invalid_argument("No GT field in FORMAT at " + chrom.str() + ':' + std::to_string(pos));
+}
 
-#endif
+void VCFRecordView::get_minor_alleles(VCFRecordGenotypeContainer& con) const {
+    if (data.empty()) { return; }
 
+    const int gtidx = gt_index();
+    const char* p = data.data;
+    const char* end = data.end();
+    bool alt_a, alt_b;
 
-    std::vector<std::string> indlabs;
-    std::string line;
-    while (vcffile->good()) {
-        line = vcffile->getline();
+    int indidx = -1;
+    while (true) {
+        indidx++;
 
-        if (stringops::startswith(line, "##")) {
-            continue;
-        } else if (stringops::startswith(line, "#")) {
-            indlabs = split(line, "\t");
-            indlabs = slice(indlabs, 9, indlabs.size());
-            for (size_t i = 0; i < indlabs.size(); ++i) {
-                data.add_individual(indlabs[i]);
+        // Find this sample's GT subfield without leaving the sample
+        const char* gt = p;
+        int subtokidx = 0;
+        while (subtokidx < gtidx && p != end && *p != '\t' && *p != ' ') {
+            if (*p == ':') {
+                subtokidx++;
+                gt = p + 1;
             }
+            p++;
+        }
+        const char* gtend = gt;
+        while (gtend != end && *gtend != ':' && *gtend != '\t' && *gtend != ' ') { gtend++; }
+
+        // And the end of the sample
+        p = gtend;
+        while (p != end && *p != '\t' && *p != ' ') { p++; }
+
+        // A sample with fewer fields than FORMAT has no GT
+        GTCall call = subtokidx == gtidx ? decode_gt(gt, gtend, alt_a, alt_b) : GT_MALFORMED;
+        switch (call) {
+        case GT_CALLED:
+            if (alt_a) { con.alts.push_back(2 * indidx); }
+            if (alt_b) { con.alts.push_back(2 * indidx + 1); }
+            break;
+        case GT_MALFORMED:
+            con.malformed++;
+            // fall through
+        case GT_MISSING:
+            con.missing.push_back(indidx);
             break;
+        }
+
+        if (p == end) { break; }
+        p++;
+    }
+}
+
+VCFRegion::VCFRegion(void) : start(1), end(std::numeric_limits<int>::max()) {}
+
+VCFRegion::VCFRegion(const std::string& spec) : start(1), end(std::numeric_limits<int>::max())
+{
+    size_t colon = spec.rfind(':');
+    chrom = spec.substr(0, colon);
+    if (chrom.empty()) { throw std::invalid_argument("Invalid region: " + spec); }
+    if (colon == std::string::npos) { return; }
+
+    // Allow 1,000,000 style positions
+    std::string range = spec.substr(colon + 1);
+    range.erase(std::remove(range.begin(), range.end(), ','), range.end());
+    size_t dash = range.find('-');
+    try {
+        size_t used = 0;
+        start = std::stoi(range.substr(0, dash), &used);
+        if (used != range.substr(0, dash).size()) { throw std::invalid_argument(spec); }
+
+        if (dash == std::string::npos) {
+            end = start;
+        } else if (dash + 1 < range.size()) {
+            end = std::stoi(range.substr(dash + 1), &used);
+            if (used != range.size() - dash - 1) { throw std::invalid_argument(spec); }
+        }
+    } catch (const std::exception&) {
+        throw std::invalid_argument("Invalid region: " + spec);
+    }
+
+    if (start < 1 || end < start) { throw std::invalid_argument("Invalid region: " + spec); }
+}
+
+bool VCFRegion::contains(const std::string& c, int pos) const
+{
+    return whole_file() || (c == chrom && pos >= start && pos <= end);
+}
+
+bool VCFRegion::contains_line(const std::string& line) const
+{
+    return contains_line(line.data(), line.size());
+}
+
+bool VCFRegion::contains_line(const char* line, size_t len) const
+{
+    if (whole_file()) { return true; }
+
+    const char* tab = static_cast<const char*>(memchr(line, '\t', len));
+    if (!tab || (size_t)(tab - line) != chrom.size() || memcmp(line, chrom.data(), chrom.size())) {
+        return false;
+    }
+
+    // The line isn't necessarily terminated, so no atoi
+    int pos = 0;
+    for (const char* c = tab + 1; c < line + len && *c >= '0' && *c <= '9'; ++c) {
+        pos = 10 * pos + (*c - '0');
+    }
+    return pos >= start && pos <= end;
+}
+
+static void parse_vcf_line(const char* line, size_t len, const VCFParams& fileparams,
+                           const VCFInfoKey& freq_key,
+                           VCFRecordGenotypeContainer& con, VCFParsedLine& out)
+{
+    VCFRecordView rec(line, len);
+    parse_record(rec, fileparams, freq_key, con, out);
+}
+
+void VCFMerger::add(const VCFParsedLine& rec)
+{
+    if (rec.chrom != last_chromid) {
+        if (chromidx > -1 && (data.chromosomes[chromidx]->nmark() == 0)) {
+            data.chromosomes[chromidx]->label = rec.chrom;
         } else {
-            throw std::invalid_argument("No header line??");
+            data.add_chromosome(rec.chrom);
+            chromidx++;
         }
+        markidx = 0;
     }
 
-    int ninds = data.ninds();
+    data.chromosomes[chromidx]->malformed_genotypes += rec.malformed;
 
-    VCFRecordGenotypeContainer con(ninds);
+    if (rec.exclusion) {
+        data.chromosomes[chromidx]->exclusions[rec.exclusion]++;
+        return;
+    }
 
-    std::string last_chromid("");
-    int chromidx = -1;
-    int markidx = 0;
-    unsigned long rawidx = 0;
-    while (vcffile->good()) {
-        line = vcffile->getline();
+    data.chromosomes[chromidx]->add_variant(rec.label, rec.pos, rec.freq);
 
-        if (!line.length()) { continue; }
-        VCFRecord rec(line);
-        con.clear();
+    for (size_t i = 0; i < rec.missing.size(); ++i) {
+        data.individuals[rec.missing[i]].set_allele(chromidx, markidx, 0, -1);
+    }
 
-        if (rec.chrom.compare(last_chromid)) {
-            if (chromidx > -1 && (data.chromosomes[chromidx]->nmark() == 0)) {
-                data.chromosomes[chromidx]->label = rec.chrom;
-            } else {
-                data.add_chromosome(rec.chrom);
-                chromidx++;
-            }
-            markidx = 0;
+    for (size_t i = 0; i < rec.alts.size(); ++i) {
+        std::div_t divres = std::div(rec.alts[i], 2);
+        data.individuals[divres.quot].set_allele(chromidx, markidx, divres.rem, 1);
+    }
+
+    markidx++;
+    last_chromid = rec.chrom;
+}
+
+// A run of consecutive lines going through the parallel loader. The
+// lines are stored end to end in text; line i is [starts[i], starts[i+1]).
+struct VCFBatch {
+    long sequence;
+    std::string text;
+    std::vector<size_t> starts;
+    std::vector<VCFParsedLine> records;
+
+    inline size_t nlines(void) const { return starts.size() - 1; }
+    std::string error;
+};
+
+// Reads a VCF body with a reader thread handing batches of lines to
+// nthreads parser threads, while the calling thread merges the parsed
+// batches back in file order. At most a few batches per thread are in
+// flight at once, so memory use stays bounded.
+class VCFPipeline {
+public:
+    VCFPipeline(LineReader* f, const VCFParams& p, const VCFRegion& r, size_t n, int nthreads)
+        : file(f), fileparams(p), freq_key(p.freq_field), region(r), ninds(n), max_inflight(4 * nthreads),
+          nread(0), nmerged(0), eof(false), abort(false)
+    {
+        reader = std::thread(&VCFPipeline::read, this);
+        for (int i = 0; i < nthreads; ++i) {
+            parsers.push_back(std::thread(&VCFPipeline::parse, this));
         }
+    }
 
-        if (!rec.is_snv()) {
-            data.chromosomes[chromidx]->exclusions["Non-SNV"]++;
-            continue;
+    ~VCFPipeline(void) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            abort = true;
         }
+        work_ready.notify_all();
+        batch_done.notify_all();
+        space_ready.notify_all();
+
+        reader.join();
+        for (auto& t : parsers) { t.join(); }
+        for (VCFBatch* b : todo) { delete b; }
+        for (auto& kv : done) { delete kv.second; }
+    }
 
+    void merge(VCFMerger& merger) {
+        while (true) {
+            VCFBatch* batch = NULL;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                batch_done.wait(lock, [this]() {
+                    return done.count(nmerged) || (eof && nmerged == nread); 
+                });
+                if (!done.count(nmerged)) { break; }
+                batch = done[nmerged];
+                done.erase(nmerged);
+            }
 
-        if (rec.nalleles() > 2) {
-            data.chromosomes[chromidx]->exclusions["Non-diallelic"]++;
-            continue;
-        }
+            std::unique_ptr<VCFBatch> owner(batch);
+            if (!batch->error.empty()) { throw std::invalid_argument(batch->error); }
+            for (const VCFParsedLine& rec : batch->records) { merger.add(rec); }
 
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                nmerged++;
+            }
+            space_ready.notify_one();
+        }
 
-        rec.get_minor_alleles(con);
+        if (!read_error.empty()) { throw std::runtime_error(read_error); }
+    }
 
-        if (fileparams.drop_monomorphs && con.monomorphic()) {
-            data.chromosomes[chromidx]->exclusions["Monomorphic"]++;
-            continue;
+private:
+    static const size_t BATCH_LINES = 1024;
+    static const size_t BATCH_BYTES = 8 << 20;
+
+    LineReader* file;
+    const VCFParams& fileparams;
+    const VCFInfoKey freq_key;
+    const VCFRegion& region;
+    size_t ninds;
+    long max_inflight;
+
+    std::mutex mtx;
+    std::condition_variable work_ready;
+    std::condition_variable batch_done;
+    std::condition_variable space_ready;
+    std::deque<VCFBatch*> todo;
+    std::map<long, VCFBatch*> done;
+    long nread;
+    long nmerged;
+    bool eof;
+    bool abort;
+    std::string read_error;
+
+    std::thread reader;
+    std::vector<std::thread> parsers;
+
+    void read(void) {
+        try {
+            bool more = true;
+            while (more) {
+                std::unique_ptr<VCFBatch> batch(new VCFBatch);
+                batch->starts.push_back(0);
+                stringops::StringSpan line;
+                while (batch->nlines() < BATCH_LINES && batch->text.size() < BATCH_BYTES) {
+                    if (!(more = file->getline(line))) { break; }
+                    if (line.empty() || !region.contains_line(line.data, line.size)) { continue; }
+                    batch->text.append(line.data, line.size);
+                    batch->starts.push_back(batch->text.size());
+                }
+                if (!batch->nlines()) { break; }
+
+                std::unique_lock<std::mutex> lock(mtx);
+                space_ready.wait(lock, [this]() { return abort || nread - nmerged < max_inflight; });
+                if (abort) { break; }
+                batch->sequence = nread++;
+                todo.push_back(batch.release());
+                work_ready.notify_one();
+            }
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(mtx);
+            read_error = e.what();
         }
 
-        if (fileparams.drop_singletons && con.singleton()) {
-            data.chromosomes[chromidx]->exclusions["Singleton"]++;
-            continue;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            eof = true;
         }
+        work_ready.notify_all();
+        batch_done.notify_all();
+    }
 
-        double fq = fileparams.empirical_freqs ?
-                    con.allele_frequency() :
-                    rec.get_info_freq(fileparams.freq_field);
+    void parse(void) {
+        VCFRecordGenotypeContainer con(ninds);
+        while (true) {
+            VCFBatch* batch = NULL;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                work_ready.wait(lock, [this]() { return abort || eof || !todo.empty(); });
+                if (abort || todo.empty()) { break; }
+                batch = todo.front();
+                todo.pop_front();
+            }
 
-        if (fq > 0.5) {
-            con.invert();
-            fq = 1 - fq;
+            try {
+                batch->records.resize(batch->nlines());
+                for (size_t i = 0; i < batch->nlines(); ++i) {
+                    parse_vcf_line(batch->text.data() + batch->starts[i],
+                                   batch->starts[i + 1] - batch->starts[i],
+                                   fileparams, freq_key, con, batch->records[i]);
+                }
+            } catch (const std::exception& e) {
+                batch->error = e.what();
+            }
+            std::string().swap(batch->text);
+
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done[batch->sequence] = batch;
+            }
+            batch_done.notify_one();
         }
+    }
+};
 
-        data.chromosomes[chromidx]->add_variant(rec.label, rec.pos, fq);
+Dataset read_vcf(const std::string & filename, const VCFParams& fileparams, int nthreads,
+                 const VCFRegion& region)
+{
+    using stringops::split;
+    using stringops::endswith;
+    using std::vector;
 
 
-        for (size_t i = 0; i < con.missing.size(); ++i) {
-            data.individuals[con.missing[i]].set_allele(chromidx, markidx, 0, -1);
-        }
+#ifdef HAVE_ZLIB
+    if (endswith(filename, ".bcf")) { return read_bcf(filename, fileparams, nthreads, region); }
+#endif
 
+    Dataset data;
+    std::unique_ptr<LineReader> lines;
+
+#ifdef HAVE_ZLIB
+
+    GZFile compressed;
+
+    bool gzmode = endswith(filename, ".gz");
+    bool bgzf = gzmode && BGZFFile::is_bgzf(filename);
+    std::string indexfn = (bgzf && !region.whole_file()) ? tabix::find_index(filename) : "";
+
+    // With an index, the header comes from the start of the file and the
+    // variants from wherever the index points
+    BGZFFile blocked(indexfn.empty() ? nthreads : 1);
+    BGZFFile indexed(nthreads);
+    if (!indexfn.empty()) {
+        tabix::Index index(indexfn);
+        indexed.set_ranges(index.query(region.chrom, region.start, region.end));
+    }
+
+    if (bgzf) {
+        blocked.openfile(filename, false);
+        lines.reset(new LineReader(&blocked));
+    } else if (gzmode) {
+        compressed.openfile(filename, false);
+        lines.reset(new LineReader(&compressed));
+    } else {
+        lines.reset(new LineReader(filename));
+    }
+
+#else
+
+    if (endswith(filename, ".gz")) {
+        std::cerr << "Adios not compiled with gzip support\n";
+        exit(1);
+    }
+    lines.reset(new LineReader(filename));
+
+#endif
 
-        for (size_t i = 0; i < con.alts.size(); ++i) {
-            std::div_t divres = std::div(con.alts[i], 2);
-            data.individuals[divres.quot].set_allele(chromidx, markidx, divres.rem, 1);
+
+    std::vector<std::string> indlabs;
+    stringops::StringSpan line;
+    while (lines->getline(line)) {
+        if (line.size >= 2 && line.data[0] == '#' && line.data[1] == '#') {
+            continue;
+        } else if (line.size >= 1 && line.data[0] == '#') {
+            indlabs = split(line.str(), "\t");
+            indlabs = slice(indlabs, 9, indlabs.size());
+            for (size_t i = 0; i < indlabs.size(); ++i) {
+                data.add_individual(indlabs[i]);
+            }
+            break;
+        } else {
+            throw std::invalid_argument("No header line??");
         }
+    }
+
+#ifdef HAVE_ZLIB
+    if (!indexfn.empty()) {
+        indexed.openfile(filename, false);
+        lines.reset(new LineReader(&indexed));
+    }
+#endif
 
-        markidx++;
-        rawidx++;
+    VCFMerger merger(data);
 
-        last_chromid = rec.chrom;
+    if (nthreads > 1) {
+        VCFPipeline pipeline(lines.get(), fileparams, region, data.ninds(), nthreads);
+        pipeline.merge(merger);
+    } else {
+        VCFInfoKey freq_key(fileparams.freq_field);
+        VCFRecordGenotypeContainer con(data.ninds());
+        VCFParsedLine rec;
+        while (lines->getline(line)) {
+            if (line.empty() || !region.contains_line(line.data, line.size)) { continue; }
+            parse_vcf_line(line.data, line.size, fileparams, freq_key, con, rec);
+            merger.add(rec);
+        }
     }
+
+    if (!region.whole_file() && !data.nchrom()) {
+        throw std::invalid_argument("No variants in region " + region.chrom);
+    }
+
     data.finalize();
     return data;
 }
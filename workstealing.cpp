@@ -0,0 +1,111 @@
+#include "workstealing.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace adios {
+
+// A chunk should take about this long to run
+static const double TARGET_CHUNK_SECONDS = 0.005;
+
+WorkStealingScheduler::WorkStealingScheduler(long ntasks, int nthreads)
+    : workers_(std::max(nthreads, 1)), unclaimed_(ntasks)
+{
+    long nworkers = workers_.size();
+    for (long t = 0; t < nworkers; ++t) {
+        workers_[t].lo = ntasks * t / nworkers;
+        workers_[t].hi = ntasks * (t + 1) / nworkers;
+    }
+}
+
+// Move a chunk from the front of w's deque to its claimed tasks. Returns
+// the number of tasks claimed. Called by w's owner.
+long WorkStealingScheduler::claim(Worker& w)
+{
+    std::lock_guard<std::mutex> lock(w.mtx);
+    long available = w.hi - w.lo;
+    if (available <= 0) { return 0; }
+
+    // Enough tasks to fill the target time, but never more than half of
+    // what's left, so there's always something for the others to steal.
+    long n = 1;
+    if (w.mean_seconds > 0) {
+        n = (long)(TARGET_CHUNK_SECONDS / w.mean_seconds);
+    }
+    n = std::max(1L, std::min(n, available / 2));
+
+    w.chunk_next = w.lo;
+    w.chunk_end = w.lo + n;
+    w.lo += n;
+    unclaimed_.fetch_sub(n);
+    return n;
+}
+
+// Take the back half of another thread's deque into tid's (empty) one.
+bool WorkStealingScheduler::steal(int tid)
+{
+    int nworkers = workers_.size();
+    for (int k = 1; k < nworkers; ++k) {
+        Worker& victim = workers_[(tid + k) % nworkers];
+
+        long lo, hi;
+        {
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            long available = victim.hi - victim.lo;
+            if (available <= 0) { continue; }
+            hi = victim.hi;
+            lo = hi - (available + 1) / 2;
+            victim.hi = lo;
+        }
+
+        Worker& thief = workers_[tid];
+        {
+            std::lock_guard<std::mutex> lock(thief.mtx);
+            thief.lo = lo;
+            thief.hi = hi;
+        }
+        thief.load.stolen += hi - lo;
+        return true;
+    }
+    return false;
+}
+
+bool WorkStealingScheduler::next(int tid, long& task)
+{
+    Worker& w = workers_[tid];
+
+    while (w.chunk_next == w.chunk_end) {
+        if (claim(w)) { break; }
+
+        // Our deque is empty. Tasks only move between deques while
+        // they're unclaimed, so keep trying until they're all spoken for.
+        if (!steal(tid)) {
+            if (unclaimed_.load() <= 0) { return false; }
+            std::this_thread::yield();
+        }
+    }
+
+    task = w.chunk_next++;
+    return true;
+}
+
+void WorkStealingScheduler::done(int tid, double seconds)
+{
+    Worker& w = workers_[tid];
+    w.mean_seconds = w.load.tasks ? 0.75 * w.mean_seconds + 0.25 * seconds : seconds;
+    w.load.busy += seconds;
+    w.load.tasks++;
+}
+
+std::vector<ThreadLoad> WorkStealingScheduler::loads(double elapsed) const
+{
+    std::vector<ThreadLoad> out;
+    for (const Worker& w : workers_) {
+        ThreadLoad l = w.load;
+        l.idle = std::max(0.0, elapsed - l.busy);
+        out.push_back(l);
+    }
+    return out;
+}
+
+}